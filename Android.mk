@@ -18,7 +18,8 @@ LOCAL_C_INCLUDES := $(MY_GSTREAMER_HLS_INCLUDE_PATH)
 LOCAL_C_INCLUDES += $(MY_GSTREAMER_HLS_INCLUDE_PATH)
 LOCAL_EXPORT_C_INCLUDES := $(MY_GSTREAMER_HLS_INCLUDE_PATH)
 LOCAL_MODULE    := skippyHLS
-LOCAL_SRC_FILES += $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_fragment.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_hlsdemux.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_m3u8.cpp $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_uridownloader.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_m3u8_parser.cpp $(MY_GSTREAMER_HLS_SOURCE_PATH)/oggOpusdec.cpp
+# Downloads go through the GStreamer source elements: the libcurl backend (CURL_BACKEND in the Makefile, libcurl 7.68 or newer) isn't built here
+LOCAL_SRC_FILES += $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_fragment.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_hlsdemux.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_m3u8.cpp $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_uridownloader.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_download_pool.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_fragment_cache.c $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_m3u8_parser.cpp $(MY_GSTREAMER_HLS_SOURCE_PATH)/skippy_m3u8_store.cpp $(MY_GSTREAMER_HLS_SOURCE_PATH)/oggOpusdec.cpp
 LOCAL_SHARED_LIBRARIES := gstreamer_android
 LOCAL_LDLIBS := -llog -landroid -lstdc++
 include $(BUILD_SHARED_LIBRARY)
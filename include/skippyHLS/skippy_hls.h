@@ -3,6 +3,17 @@
 #include <glib.h>
 
 #define SKIPPY_HLS_DOWNLOAD_AHEAD "skippy-download-ahead"
+// Measured bandwidth in bits per second (guint), used to select the initial variant of a master playlist
+#define SKIPPY_HLS_CONNECTION_SPEED "skippy-connection-speed"
+// File (string) where the binary snapshot of the media playlist gets saved once loaded.
+// Playing that file later (e.g after a restart) starts streaming without downloading and parsing the playlist.
+#define SKIPPY_HLS_PLAYLIST_SNAPSHOT_LOCATION "skippy-playlist-snapshot-location"
+// Max number of fragments (guint) downloaded at the same time, 1 fetches one after the other
+#define SKIPPY_HLS_MAX_PARALLEL_DOWNLOADS "skippy-max-parallel-downloads"
+// Directory (string) where downloaded fragments get kept, they're played from there next time without going to the network
+#define SKIPPY_HLS_FRAGMENT_CACHE_LOCATION "skippy-fragment-cache-location"
+// Max size in bytes (guint64) of the fragment cache directory, least recently used fragments get removed past it
+#define SKIPPY_HLS_FRAGMENT_CACHE_SIZE "skippy-fragment-cache-size"
 #define GST_SKIPPY_HLS_ERROR skippy_hls_error_quark()
 
 G_BEGIN_DECLS
@@ -0,0 +1,546 @@
+/*
+ * skippy_curl_session.c
+ *
+ *  HTTP transfers on a shared libcurl multi handle
+ *
+ */
+
+#include "skippy_curl_session.h"
+
+#include <string.h>
+#include <curl/curl.h>
+
+// curl_multi_poll and curl_multi_wakeup
+#if LIBCURL_VERSION_NUM < 0x074400
+#error "The libcurl backend needs libcurl 7.68.0 or newer"
+#endif
+
+GST_DEBUG_CATEGORY_STATIC (skippy_curl_session_debug);
+#define GST_CAT_DEFAULT skippy_curl_session_debug
+
+// The first block is small so that typefinding and playback can start early
+#define FIRST_BLOCK_SIZE (16 * 1024)
+#define BLOCK_SIZE (64 * 1024)
+// Only a fallback, the session thread gets woken up whenever there is something to do
+#define POLL_TIMEOUT_MS 1000
+#define CONNECT_TIMEOUT_S 15
+// Transfers slower than 1 byte/s for this long are considered broken
+#define STALL_TIMEOUT_S 15
+
+typedef struct _SkippyCurlSession
+{
+  CURLM *multi;
+  GThread *thread;
+  guint refcount;
+
+  GMutex lock;
+  GCond cond;   // Signalled when transfers got removed
+  GQueue added; // Transfers to add to the multi handle
+  GQueue removed;
+  gboolean running;
+} SkippyCurlSession;
+
+struct _SkippyCurlTransfer
+{
+  SkippyCurlSession *session;
+  CURL *easy;
+  struct curl_slist *headers;
+  gchar error_buffer[CURL_ERROR_SIZE];
+
+  // Only touched by the session thread while attached
+  GstMemory *block;
+  GstMapInfo block_map;
+  gsize block_filled;
+  guint blocks;
+  guint64 received;
+  gboolean got_response;
+  // Servers that ignore the range request send the whole resource: we cut the range out
+  gint64 range_start, range_end;
+  guint64 skip;
+  gint64 limit;
+  gboolean range_complete;
+
+  // Shared, under lock
+  GMutex lock;
+  GCond cond;
+  GQueue ready; // Filled blocks
+  gint64 content_length;
+  glong status;
+  CURLcode result;
+  gboolean attached; // Added to the multi handle (or about to be)
+  gboolean done;
+  gboolean cancelled;
+};
+
+static GMutex session_lock;
+static SkippyCurlSession *session = NULL;
+
+static gpointer skippy_curl_session_run (gpointer data);
+
+// Creates the session with the first transfer
+static SkippyCurlSession*
+skippy_curl_session_ref (void)
+{
+  static gboolean initialized = FALSE;
+
+  g_mutex_lock (&session_lock);
+  if (!initialized) {
+    GST_DEBUG_CATEGORY_INIT (skippy_curl_session_debug, "skippyhls-curl", 0, "HTTP transfers (libcurl)");
+    curl_global_init (CURL_GLOBAL_DEFAULT);
+    initialized = TRUE;
+  }
+  if (!session) {
+    session = g_new0 (SkippyCurlSession, 1);
+    session->multi = curl_multi_init ();
+    curl_multi_setopt (session->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    g_mutex_init (&session->lock);
+    g_cond_init (&session->cond);
+    g_queue_init (&session->added);
+    g_queue_init (&session->removed);
+    session->running = TRUE;
+    session->thread = g_thread_new ("skippyhls-curl", skippy_curl_session_run, session);
+  }
+  session->refcount++;
+  g_mutex_unlock (&session_lock);
+  return session;
+}
+
+// Joins the session thread with the last transfer (none is attached anymore)
+static void
+skippy_curl_session_unref (SkippyCurlSession* s)
+{
+  g_mutex_lock (&session_lock);
+  if (--s->refcount > 0) {
+    g_mutex_unlock (&session_lock);
+    return;
+  }
+  session = NULL;
+  g_mutex_unlock (&session_lock);
+
+  g_mutex_lock (&s->lock);
+  s->running = FALSE;
+  g_mutex_unlock (&s->lock);
+  curl_multi_wakeup (s->multi);
+  g_thread_join (s->thread);
+
+  curl_multi_cleanup (s->multi);
+  g_mutex_clear (&s->lock);
+  g_cond_clear (&s->cond);
+  g_free (s);
+}
+
+gboolean
+skippy_curl_handles_uri (const gchar* uri)
+{
+  return uri && (g_ascii_strncasecmp (uri, "http://", 7) == 0 || g_ascii_strncasecmp (uri, "https://", 8) == 0);
+}
+
+// Hands the current block to the consumer: session thread only
+static void
+skippy_curl_transfer_flush_block (SkippyCurlTransfer* transfer)
+{
+  GstMemory *block = transfer->block;
+
+  if (!block) {
+    return;
+  }
+  gst_memory_unmap (block, &transfer->block_map);
+  gst_memory_resize (block, 0, transfer->block_filled);
+  transfer->block = NULL;
+  transfer->blocks++;
+
+  g_mutex_lock (&transfer->lock);
+  g_queue_push_tail (&transfer->ready, block);
+  g_cond_signal (&transfer->cond);
+  g_mutex_unlock (&transfer->lock);
+}
+
+// Blocks don't get larger than the rest of the response (unless it's compressed)
+static gboolean
+skippy_curl_transfer_new_block (SkippyCurlTransfer* transfer)
+{
+  gsize size = transfer->blocks ? BLOCK_SIZE : FIRST_BLOCK_SIZE;
+  gint64 content_length;
+
+  g_mutex_lock (&transfer->lock);
+  content_length = transfer->content_length;
+  g_mutex_unlock (&transfer->lock);
+  if (content_length > 0 && (guint64) content_length > transfer->received
+    && (guint64) content_length - transfer->received < size) {
+    size = (gsize) ((guint64) content_length - transfer->received);
+  }
+
+  transfer->block = gst_allocator_alloc (NULL, size, NULL);
+  transfer->block_filled = 0;
+  if (!gst_memory_map (transfer->block, &transfer->block_map, GST_MAP_WRITE)) {
+    gst_memory_unref (transfer->block);
+    transfer->block = NULL;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Called with the response headers of the final response (after redirects): session thread only
+static void
+skippy_curl_transfer_read_response (SkippyCurlTransfer* transfer)
+{
+  curl_off_t content_length = -1;
+  glong status = 0;
+
+  transfer->got_response = TRUE;
+  curl_easy_getinfo (transfer->easy, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo (transfer->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+
+  if (status == 200 && (transfer->range_start > 0 || transfer->range_end >= 0)) {
+    GST_DEBUG ("Server ignored the byte range, skipping to it");
+    transfer->skip = transfer->range_start;
+    transfer->limit = transfer->range_end >= 0 ? transfer->range_end - transfer->range_start : -1;
+    if (content_length >= 0) {
+      content_length = MAX (content_length - transfer->range_start, 0);
+      if (transfer->limit >= 0) {
+        content_length = MIN (content_length, transfer->limit);
+      }
+    }
+  }
+
+  g_mutex_lock (&transfer->lock);
+  transfer->status = status;
+  transfer->content_length = content_length;
+  g_mutex_unlock (&transfer->lock);
+}
+
+// Copies the data into our blocks: session thread only
+static size_t
+skippy_curl_transfer_write (char *data, size_t size, size_t nmemb, void *user_data)
+{
+  SkippyCurlTransfer *transfer = (SkippyCurlTransfer*) user_data;
+  gsize length = size * nmemb, written = 0, n;
+
+  if (!transfer->got_response) {
+    skippy_curl_transfer_read_response (transfer);
+  }
+  // Error pages are not data
+  if (transfer->status >= 400) {
+    return length;
+  }
+
+  // Cut out the range when the server sent the whole resource
+  if (transfer->skip) {
+    n = MIN (length, transfer->skip);
+    transfer->skip -= n;
+    written = n;
+  }
+  if (transfer->limit >= 0 && transfer->received + (length - written) >= (guint64) transfer->limit) {
+    length = written + (gsize) ((guint64) transfer->limit - transfer->received);
+    transfer->range_complete = TRUE;
+  }
+
+  while (written < length) {
+    if (!transfer->block && !skippy_curl_transfer_new_block (transfer)) {
+      GST_WARNING ("Could not allocate memory for the data");
+      return 0;
+    }
+    n = MIN (length - written, transfer->block_map.size - transfer->block_filled);
+    memcpy (transfer->block_map.data + transfer->block_filled, data + written, n);
+    transfer->block_filled += n;
+    transfer->received += n;
+    written += n;
+    if (transfer->block_filled == transfer->block_map.size) {
+      skippy_curl_transfer_flush_block (transfer);
+    }
+  }
+  // Aborts the rest of the resource (see skippy_curl_transfer_finish)
+  return transfer->range_complete ? 0 : size * nmemb;
+}
+
+// Aborts cancelled transfers (also while waiting for the response): session thread only
+static int
+skippy_curl_transfer_progress (void *user_data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+  SkippyCurlTransfer *transfer = (SkippyCurlTransfer*) user_data;
+  gboolean cancelled;
+
+  g_mutex_lock (&transfer->lock);
+  cancelled = transfer->cancelled;
+  g_mutex_unlock (&transfer->lock);
+  return cancelled ? 1 : 0;
+}
+
+static void
+skippy_curl_transfer_finish (SkippyCurlTransfer* transfer, CURLcode result)
+{
+  // Empty responses never got to the write function
+  if (!transfer->got_response) {
+    skippy_curl_transfer_read_response (transfer);
+  }
+  skippy_curl_transfer_flush_block (transfer);
+  // We stopped it after the range
+  if (result == CURLE_WRITE_ERROR && transfer->range_complete) {
+    result = CURLE_OK;
+  }
+
+  g_mutex_lock (&transfer->lock);
+  transfer->result = result;
+  transfer->done = TRUE;
+  transfer->attached = FALSE;
+  g_cond_signal (&transfer->cond);
+  g_mutex_unlock (&transfer->lock);
+}
+
+// Drops the block of a transfer that got removed before it was done: session thread only
+static void
+skippy_curl_transfer_abandon (SkippyCurlTransfer* transfer)
+{
+  if (transfer->block) {
+    gst_memory_unmap (transfer->block, &transfer->block_map);
+    gst_memory_unref (transfer->block);
+    transfer->block = NULL;
+  }
+  g_mutex_lock (&transfer->lock);
+  transfer->attached = FALSE;
+  g_mutex_unlock (&transfer->lock);
+}
+
+static gpointer
+skippy_curl_session_run (gpointer data)
+{
+  SkippyCurlSession *s = (SkippyCurlSession*) data;
+  SkippyCurlTransfer *transfer;
+  CURLMsg *msg;
+  gint running_handles, pending;
+
+  g_mutex_lock (&s->lock);
+  while (s->running) {
+    while ((transfer = g_queue_pop_head (&s->added))) {
+      curl_multi_add_handle (s->multi, transfer->easy);
+    }
+    if (!g_queue_is_empty (&s->removed)) {
+      while ((transfer = g_queue_pop_head (&s->removed))) {
+        curl_multi_remove_handle (s->multi, transfer->easy);
+        skippy_curl_transfer_abandon (transfer);
+      }
+      g_cond_broadcast (&s->cond);
+    }
+    g_mutex_unlock (&s->lock);
+
+    curl_multi_perform (s->multi, &running_handles);
+    while ((msg = curl_multi_info_read (s->multi, &pending))) {
+      if (msg->msg == CURLMSG_DONE) {
+        curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char**) &transfer);
+        curl_multi_remove_handle (s->multi, msg->easy_handle);
+        skippy_curl_transfer_finish (transfer, msg->data.result);
+      }
+    }
+    curl_multi_poll (s->multi, NULL, 0, POLL_TIMEOUT_MS, NULL);
+
+    g_mutex_lock (&s->lock);
+  }
+  g_mutex_unlock (&s->lock);
+  return NULL;
+}
+
+SkippyCurlTransfer*
+skippy_curl_transfer_new (void)
+{
+  SkippyCurlTransfer *transfer = g_new0 (SkippyCurlTransfer, 1);
+
+  transfer->session = skippy_curl_session_ref ();
+  transfer->easy = curl_easy_init ();
+  g_mutex_init (&transfer->lock);
+  g_cond_init (&transfer->cond);
+  g_queue_init (&transfer->ready);
+  transfer->content_length = -1;
+  return transfer;
+}
+
+void
+skippy_curl_transfer_free (SkippyCurlTransfer* transfer)
+{
+  skippy_curl_transfer_stop (transfer);
+  curl_easy_cleanup (transfer->easy);
+  curl_slist_free_all (transfer->headers);
+  g_mutex_clear (&transfer->lock);
+  g_cond_clear (&transfer->cond);
+  skippy_curl_session_unref (transfer->session);
+  g_free (transfer);
+}
+
+void
+skippy_curl_transfer_start (SkippyCurlTransfer* transfer, const gchar* uri, const gchar* referer,
+  gboolean compress, gboolean refresh, gboolean allow_cache, gint64 range_start, gint64 range_end)
+{
+  SkippyCurlSession *s = transfer->session;
+  gchar *header, *range = NULL;
+  CURL *easy = transfer->easy;
+
+  skippy_curl_transfer_stop (transfer);
+
+  // Options are the same for every fetch: the handle keeps its connection and TLS session caches
+  curl_easy_reset (easy);
+  curl_easy_setopt (easy, CURLOPT_URL, uri);
+  curl_easy_setopt (easy, CURLOPT_PRIVATE, transfer);
+  curl_easy_setopt (easy, CURLOPT_ERRORBUFFER, transfer->error_buffer);
+  curl_easy_setopt (easy, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt (easy, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+  // Rather wait for a connection that can multiplex than opening another one
+  curl_easy_setopt (easy, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt (easy, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt (easy, CURLOPT_CONNECTTIMEOUT, (long) CONNECT_TIMEOUT_S);
+  curl_easy_setopt (easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt (easy, CURLOPT_LOW_SPEED_TIME, (long) STALL_TIMEOUT_S);
+  curl_easy_setopt (easy, CURLOPT_WRITEFUNCTION, skippy_curl_transfer_write);
+  curl_easy_setopt (easy, CURLOPT_WRITEDATA, transfer);
+  curl_easy_setopt (easy, CURLOPT_XFERINFOFUNCTION, skippy_curl_transfer_progress);
+  curl_easy_setopt (easy, CURLOPT_XFERINFODATA, transfer);
+  curl_easy_setopt (easy, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt (easy, CURLOPT_NOSIGNAL, 1L);
+  // All encodings curl supports (decoded before we get the data)
+  curl_easy_setopt (easy, CURLOPT_ACCEPT_ENCODING, compress ? "" : NULL);
+
+  if (range_start > 0 || range_end >= 0) {
+    range = range_end >= 0 ? g_strdup_printf ("%" G_GINT64_FORMAT "-%" G_GINT64_FORMAT, range_start, range_end - 1)
+      : g_strdup_printf ("%" G_GINT64_FORMAT "-", range_start);
+    curl_easy_setopt (easy, CURLOPT_RANGE, range);
+    g_free (range);
+  }
+
+  curl_slist_free_all (transfer->headers);
+  transfer->headers = NULL;
+  if (referer) {
+    header = g_strconcat ("Referer: ", referer, NULL);
+    transfer->headers = curl_slist_append (transfer->headers, header);
+    g_free (header);
+  }
+  if (!allow_cache) {
+    transfer->headers = curl_slist_append (transfer->headers, "Cache-Control: no-cache");
+  } else if (refresh) {
+    transfer->headers = curl_slist_append (transfer->headers, "Cache-Control: max-age=0");
+  }
+  curl_easy_setopt (easy, CURLOPT_HTTPHEADER, transfer->headers);
+
+  transfer->blocks = 0;
+  transfer->received = 0;
+  transfer->got_response = FALSE;
+  transfer->range_start = range_start;
+  transfer->range_end = range_end;
+  transfer->skip = 0;
+  transfer->limit = -1;
+  transfer->range_complete = FALSE;
+  transfer->error_buffer[0] = '\0';
+  g_mutex_lock (&transfer->lock);
+  transfer->content_length = -1;
+  transfer->status = 0;
+  transfer->result = CURLE_OK;
+  transfer->done = FALSE;
+  transfer->cancelled = FALSE;
+  transfer->attached = TRUE;
+  g_mutex_unlock (&transfer->lock);
+
+  GST_DEBUG ("Starting transfer of %s (Byte-Range=%" G_GINT64_FORMAT " - %" G_GINT64_FORMAT ")", uri, range_start, range_end);
+  g_mutex_lock (&s->lock);
+  g_queue_push_tail (&s->added, transfer);
+  g_mutex_unlock (&s->lock);
+  curl_multi_wakeup (s->multi);
+}
+
+// Maps failures to the errors of GStreamer HTTP sources, which the demuxer handles
+static GError*
+skippy_curl_transfer_get_error_locked (SkippyCurlTransfer* transfer)
+{
+  if (transfer->result != CURLE_OK) {
+    return g_error_new (GST_RESOURCE_ERROR, transfer->result == CURLE_COULDNT_RESOLVE_HOST
+      || transfer->result == CURLE_COULDNT_CONNECT ? GST_RESOURCE_ERROR_OPEN_READ : GST_RESOURCE_ERROR_READ,
+      "%s", transfer->error_buffer[0] ? transfer->error_buffer : curl_easy_strerror (transfer->result));
+  }
+  switch (transfer->status) {
+  case 401:
+  case 403:
+    return g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_NOT_AUTHORIZED, "Forbidden (%ld)", transfer->status);
+  case 404:
+  case 410:
+    return g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_NOT_FOUND, "Not Found (%ld)", transfer->status);
+  default:
+    return g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ, "HTTP error %ld", transfer->status);
+  }
+}
+
+SkippyCurlTransferStatus
+skippy_curl_transfer_wait (SkippyCurlTransfer* transfer, GstMemory** memory, GError** err)
+{
+  SkippyCurlTransferStatus status;
+
+  g_mutex_lock (&transfer->lock);
+  while (!transfer->cancelled && !transfer->done && g_queue_is_empty (&transfer->ready)) {
+    g_cond_wait (&transfer->cond, &transfer->lock);
+  }
+  if (transfer->cancelled) {
+    status = SKIPPY_CURL_TRANSFER_CANCELLED;
+  } else if (!g_queue_is_empty (&transfer->ready)) {
+    *memory = g_queue_pop_head (&transfer->ready);
+    status = SKIPPY_CURL_TRANSFER_DATA;
+  } else if (transfer->result != CURLE_OK || transfer->status >= 400) {
+    g_propagate_error (err, skippy_curl_transfer_get_error_locked (transfer));
+    status = SKIPPY_CURL_TRANSFER_FAILED;
+  } else {
+    status = SKIPPY_CURL_TRANSFER_DONE;
+  }
+  g_mutex_unlock (&transfer->lock);
+  return status;
+}
+
+gint64
+skippy_curl_transfer_get_content_length (SkippyCurlTransfer* transfer)
+{
+  gint64 content_length;
+
+  g_mutex_lock (&transfer->lock);
+  content_length = transfer->content_length;
+  g_mutex_unlock (&transfer->lock);
+  return content_length;
+}
+
+void
+skippy_curl_transfer_cancel (SkippyCurlTransfer* transfer)
+{
+  g_mutex_lock (&transfer->lock);
+  transfer->cancelled = TRUE;
+  g_cond_signal (&transfer->cond);
+  g_mutex_unlock (&transfer->lock);
+  // Let the progress function abort it
+  curl_multi_wakeup (transfer->session->multi);
+}
+
+void
+skippy_curl_transfer_stop (SkippyCurlTransfer* transfer)
+{
+  SkippyCurlSession *s = transfer->session;
+  GstMemory *memory;
+  gboolean attached;
+
+  g_mutex_lock (&transfer->lock);
+  attached = transfer->attached;
+  g_mutex_unlock (&transfer->lock);
+
+  if (attached) {
+    g_mutex_lock (&s->lock);
+    // Not added yet: nothing to remove
+    if (!g_queue_remove (&s->added, transfer)) {
+      g_queue_push_tail (&s->removed, transfer);
+      curl_multi_wakeup (s->multi);
+      while (g_queue_find (&s->removed, transfer)) {
+        g_cond_wait (&s->cond, &s->lock);
+      }
+    } else {
+      g_mutex_lock (&transfer->lock);
+      transfer->attached = FALSE;
+      g_mutex_unlock (&transfer->lock);
+    }
+    g_mutex_unlock (&s->lock);
+  }
+
+  g_mutex_lock (&transfer->lock);
+  while ((memory = g_queue_pop_head (&transfer->ready))) {
+    gst_memory_unref (memory);
+  }
+  g_mutex_unlock (&transfer->lock);
+}
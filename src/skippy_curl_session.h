@@ -0,0 +1,46 @@
+/*
+ * skippy_curl_session.h
+ *
+ *  HTTP transfers on a shared libcurl multi handle
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// All transfers of the process run on one curl multi handle driven by its own thread:
+// connections stay open across fetches and get shared by all downloaders, HTTP/2 streams get multiplexed
+// over one connection per host. Received data is written once, straight into GstMemory blocks.
+typedef struct _SkippyCurlTransfer SkippyCurlTransfer;
+
+typedef enum {
+  SKIPPY_CURL_TRANSFER_DATA,      // Got the next block of data
+  SKIPPY_CURL_TRANSFER_DONE,      // All data has been handed out
+  SKIPPY_CURL_TRANSFER_FAILED,    // Error is set
+  SKIPPY_CURL_TRANSFER_CANCELLED
+} SkippyCurlTransferStatus;
+
+// Whether transfers support the URI scheme (http and https)
+gboolean skippy_curl_handles_uri (const gchar* uri);
+
+// Keeps its curl handle (and the session alive) until freed
+SkippyCurlTransfer* skippy_curl_transfer_new (void);
+void skippy_curl_transfer_free (SkippyCurlTransfer* transfer);
+
+// Stops the previous transfer if needed. Byte range end is excluded, -1 for the rest of the resource.
+void skippy_curl_transfer_start (SkippyCurlTransfer* transfer, const gchar* uri, const gchar* referer,
+  gboolean compress, gboolean refresh, gboolean allow_cache, gint64 range_start, gint64 range_end);
+// Blocks until the next block of data (caller owns it), the end of the transfer or a cancellation
+SkippyCurlTransferStatus skippy_curl_transfer_wait (SkippyCurlTransfer* transfer, GstMemory** memory, GError** err);
+// Size of the response body, -1 until known or if the server didn't tell
+gint64 skippy_curl_transfer_get_content_length (SkippyCurlTransfer* transfer);
+// Makes the transfer abort, can be called from any thread (doesn't block)
+void skippy_curl_transfer_cancel (SkippyCurlTransfer* transfer);
+// Removes the transfer from the session and drops data not handed out yet, blocks until done
+void skippy_curl_transfer_stop (SkippyCurlTransfer* transfer);
+
+G_END_DECLS
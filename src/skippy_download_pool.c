@@ -0,0 +1,382 @@
+/*
+ * skippy_download_pool.c
+ *
+ *  Parallel fragment downloads for the stream loop
+ *
+ */
+
+#include "skippy_download_pool.h"
+
+#include <math.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (skippy_download_pool_debug);
+#define GST_CAT_DEFAULT skippy_download_pool_debug
+
+// Weight of a new measurement in the moving averages
+#define MEASUREMENT_WEIGHT 0.3
+// Transfer times below this are not meaningful (e.g data from the HTTP cache)
+#define MIN_TRANSFER_TIME (GST_MSECOND)
+
+typedef enum {
+  SLOT_IDLE,
+  SLOT_RUNNING, // Only the download thread accesses the fragment
+  SLOT_DONE     // Result waits to be taken
+} SkippyDownloadSlotState;
+
+typedef struct _SkippyDownloadSlot
+{
+  SkippyUriDownloader *downloader; // Created on first use
+  SkippyDownloadSlotState state;
+  guint64 sequence_number;
+  SkippyFragment *fragment;
+  gchar *referrer;
+  gboolean allow_cache;
+  SkippyUriDownloaderFetchReturn result;
+  GstBuffer *buffer;
+  GError *err;
+} SkippyDownloadSlot;
+
+struct _SkippyDownloadPool
+{
+  GstBin *bin;
+  GThreadPool *threads;
+  GMutex lock;
+  GCond cond; // Signalled when a download is done
+  SkippyDownloadSlot slots[SKIPPY_DOWNLOAD_POOL_MAX_SLOTS];
+  guint max_downloads;
+  SkippyFragmentCache *cache;
+
+  // Moving averages (nanoseconds)
+  gboolean measured;
+  gdouble latency;  // Until the first byte
+  gdouble transfer; // From the first byte on, as if the download had the connection for itself
+};
+
+static void skippy_download_pool_run (gpointer data, gpointer user_data);
+
+SkippyDownloadPool*
+skippy_download_pool_new (GstBin* bin, guint max_downloads)
+{
+  SkippyDownloadPool *pool = g_new0 (SkippyDownloadPool, 1);
+
+  GST_DEBUG_CATEGORY_INIT (skippy_download_pool_debug, "skippyhls-downloadpool", 0, "Parallel fragment downloads");
+
+  pool->bin = bin;
+  pool->threads = g_thread_pool_new (skippy_download_pool_run, pool, SKIPPY_DOWNLOAD_POOL_MAX_SLOTS, FALSE, NULL);
+  g_mutex_init (&pool->lock);
+  g_cond_init (&pool->cond);
+  skippy_download_pool_set_max_downloads (pool, max_downloads);
+  return pool;
+}
+
+void
+skippy_download_pool_free (SkippyDownloadPool* pool)
+{
+  guint i;
+
+  skippy_download_pool_cancel (pool);
+  // Joins the download threads
+  g_thread_pool_free (pool->threads, FALSE, TRUE);
+
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].downloader) {
+      gst_bin_remove (pool->bin, GST_ELEMENT (pool->slots[i].downloader));
+      gst_object_unref (pool->slots[i].downloader);
+    }
+  }
+  if (pool->cache) {
+    skippy_fragment_cache_unref (pool->cache);
+  }
+  g_mutex_clear (&pool->lock);
+  g_cond_clear (&pool->cond);
+  g_free (pool);
+}
+
+void
+skippy_download_pool_set_max_downloads (SkippyDownloadPool* pool, guint max_downloads)
+{
+  g_mutex_lock (&pool->lock);
+  pool->max_downloads = CLAMP (max_downloads, 1, SKIPPY_DOWNLOAD_POOL_MAX_SLOTS);
+  g_mutex_unlock (&pool->lock);
+}
+
+void
+skippy_download_pool_set_fragment_cache (SkippyDownloadPool* pool, SkippyFragmentCache* cache)
+{
+  guint i;
+
+  g_mutex_lock (&pool->lock);
+  if (pool->cache) {
+    skippy_fragment_cache_unref (pool->cache);
+  }
+  pool->cache = cache ? skippy_fragment_cache_ref (cache) : NULL;
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].downloader) {
+      skippy_uri_downloader_set_fragment_cache (pool->slots[i].downloader, cache);
+    }
+  }
+  g_mutex_unlock (&pool->lock);
+}
+
+static guint
+skippy_download_pool_count_locked (SkippyDownloadPool* pool, SkippyDownloadSlotState state)
+{
+  guint i, count = 0;
+
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].state == state) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// A request is worth starting early for every transfer time that fits into the latency
+static guint
+skippy_download_pool_get_prefetch_count_locked (SkippyDownloadPool* pool)
+{
+  guint limit = pool->max_downloads - 1;
+  gdouble count;
+
+  if (!pool->measured) {
+    return limit;
+  }
+  count = ceil (pool->latency / MAX (pool->transfer, MIN_TRANSFER_TIME));
+  return (guint) MIN (count, limit);
+}
+
+guint
+skippy_download_pool_get_prefetch_count (SkippyDownloadPool* pool)
+{
+  guint count;
+
+  g_mutex_lock (&pool->lock);
+  count = skippy_download_pool_get_prefetch_count_locked (pool);
+  g_mutex_unlock (&pool->lock);
+  return count;
+}
+
+// The downloads running at the same time shared the bandwidth
+static void
+skippy_download_pool_measure_locked (SkippyDownloadPool* pool, SkippyFragment* fragment, guint concurrent)
+{
+  gdouble latency, transfer;
+
+  if (!fragment->download_first_byte_time || fragment->download_stop_time < fragment->download_first_byte_time
+    || fragment->download_first_byte_time < fragment->download_start_time) {
+    return;
+  }
+  latency = fragment->download_first_byte_time - fragment->download_start_time;
+  transfer = (gdouble) (fragment->download_stop_time - fragment->download_first_byte_time) / MAX (concurrent, 1);
+
+  if (pool->measured) {
+    pool->latency += MEASUREMENT_WEIGHT * (latency - pool->latency);
+    pool->transfer += MEASUREMENT_WEIGHT * (transfer - pool->transfer);
+  } else {
+    pool->latency = latency;
+    pool->transfer = transfer;
+    pool->measured = TRUE;
+  }
+  GST_LOG ("Latency %.1f ms, transfer %.1f ms: prefetching %u fragments", pool->latency / GST_MSECOND,
+    pool->transfer / GST_MSECOND, skippy_download_pool_get_prefetch_count_locked (pool));
+}
+
+void
+skippy_download_pool_measure (SkippyDownloadPool* pool, SkippyFragment* fragment)
+{
+  g_mutex_lock (&pool->lock);
+  // The pool's downloads plus this one
+  skippy_download_pool_measure_locked (pool, fragment, skippy_download_pool_count_locked (pool, SLOT_RUNNING) + 1);
+  g_mutex_unlock (&pool->lock);
+}
+
+// Only for slots that are not running
+static void
+skippy_download_pool_release_locked (SkippyDownloadSlot* slot)
+{
+  if (slot->buffer) {
+    gst_buffer_unref (slot->buffer);
+    slot->buffer = NULL;
+  }
+  g_clear_error (&slot->err);
+  if (slot->fragment) {
+    g_object_unref (slot->fragment);
+    slot->fragment = NULL;
+  }
+  g_free (slot->referrer);
+  slot->referrer = NULL;
+  slot->state = SLOT_IDLE;
+}
+
+static SkippyDownloadSlot*
+skippy_download_pool_find_locked (SkippyDownloadPool* pool, guint64 sequence_number)
+{
+  guint i;
+
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].state != SLOT_IDLE && pool->slots[i].sequence_number == sequence_number) {
+      return &pool->slots[i];
+    }
+  }
+  return NULL;
+}
+
+gboolean
+skippy_download_pool_is_pending (SkippyDownloadPool* pool, guint64 sequence_number)
+{
+  gboolean pending;
+
+  g_mutex_lock (&pool->lock);
+  pending = skippy_download_pool_find_locked (pool, sequence_number) != NULL;
+  g_mutex_unlock (&pool->lock);
+  return pending;
+}
+
+// Runs on a thread of the pool
+static void
+skippy_download_pool_run (gpointer data, gpointer user_data)
+{
+  SkippyDownloadSlot *slot = (SkippyDownloadSlot*) data;
+  SkippyDownloadPool *pool = (SkippyDownloadPool*) user_data;
+  SkippyUriDownloaderFetchReturn result;
+  GstBuffer *buffer = NULL;
+  GError *err = NULL;
+
+  GST_DEBUG ("Prefetching fragment %" G_GUINT64_FORMAT ": %s", slot->sequence_number, slot->fragment->uri);
+  slot->fragment->download_start_time = gst_util_get_timestamp ();
+  result = skippy_uri_downloader_fetch_fragment (slot->downloader, slot->fragment, slot->referrer,
+    FALSE, FALSE, slot->allow_cache, &err);
+  if (result == SKIPPY_URI_DOWNLOADER_COMPLETED) {
+    buffer = skippy_uri_downloader_get_buffer (slot->downloader);
+  }
+
+  g_mutex_lock (&pool->lock);
+  if (result == SKIPPY_URI_DOWNLOADER_COMPLETED) {
+    // About one more download runs in the stream loop
+    skippy_download_pool_measure_locked (pool, slot->fragment, skippy_download_pool_count_locked (pool, SLOT_RUNNING) + 1);
+  }
+  slot->result = result;
+  slot->buffer = buffer;
+  slot->err = err;
+  slot->state = SLOT_DONE;
+  g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&pool->lock);
+}
+
+gboolean
+skippy_download_pool_prefetch (SkippyDownloadPool* pool, guint64 first_sequence_number, guint64 sequence_number,
+  SkippyFragment* fragment, const gchar* referrer, gboolean allow_cache)
+{
+  SkippyDownloadSlot *slot = NULL;
+  gboolean pending;
+  guint i;
+
+  g_return_val_if_fail (fragment, FALSE);
+
+  g_mutex_lock (&pool->lock);
+  // Drop what we won't need anymore (running downloads get dropped once done)
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].state == SLOT_DONE && (pool->slots[i].sequence_number < first_sequence_number
+      || pool->slots[i].sequence_number >= first_sequence_number + pool->max_downloads)) {
+      GST_DEBUG ("Dropping prefetched fragment %" G_GUINT64_FORMAT, pool->slots[i].sequence_number);
+      skippy_download_pool_release_locked (&pool->slots[i]);
+    }
+  }
+
+  pending = skippy_download_pool_find_locked (pool, sequence_number) != NULL;
+  if (!pending && SKIPPY_DOWNLOAD_POOL_MAX_SLOTS - skippy_download_pool_count_locked (pool, SLOT_IDLE)
+    < skippy_download_pool_get_prefetch_count_locked (pool)) {
+    for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS && !slot; i++) {
+      if (pool->slots[i].state == SLOT_IDLE) {
+        slot = &pool->slots[i];
+      }
+    }
+  }
+
+  if (slot) {
+    if (!slot->downloader) {
+      slot->downloader = skippy_uri_downloader_new (FALSE);
+      skippy_uri_downloader_set_fragment_cache (slot->downloader, pool->cache);
+      gst_bin_add (pool->bin, GST_ELEMENT (slot->downloader));
+      gst_object_ref (slot->downloader);
+      gst_element_sync_state_with_parent (GST_ELEMENT (slot->downloader));
+    }
+    slot->sequence_number = sequence_number;
+    slot->fragment = g_object_ref (fragment);
+    slot->referrer = g_strdup (referrer);
+    slot->allow_cache = allow_cache;
+    slot->state = SLOT_RUNNING;
+    g_thread_pool_push (pool->threads, slot, NULL);
+  }
+  g_mutex_unlock (&pool->lock);
+  return pending || slot;
+}
+
+SkippyUriDownloaderFetchReturn
+skippy_download_pool_take (SkippyDownloadPool* pool, guint64 sequence_number,
+  SkippyFragment* fragment, GstBuffer** buffer, GError** err)
+{
+  SkippyDownloadSlot *slot;
+  SkippyUriDownloaderFetchReturn result = SKIPPY_URI_DOWNLOADER_VOID;
+
+  g_return_val_if_fail (fragment && buffer, SKIPPY_URI_DOWNLOADER_FAILED);
+
+  g_mutex_lock (&pool->lock);
+  slot = skippy_download_pool_find_locked (pool, sequence_number);
+  if (slot) {
+    while (slot->state == SLOT_RUNNING) {
+      g_cond_wait (&pool->cond, &pool->lock);
+    }
+    if (slot->state != SLOT_DONE) {
+      // Cancelled meanwhile
+      result = SKIPPY_URI_DOWNLOADER_CANCELLED;
+    } else if (strcmp (slot->fragment->uri, fragment->uri) == 0 && slot->fragment->range_start == fragment->range_start
+      && slot->fragment->range_end == fragment->range_end) {
+      result = slot->result;
+      fragment->size = slot->fragment->size;
+      fragment->download_start_time = slot->fragment->download_start_time;
+      fragment->download_first_byte_time = slot->fragment->download_first_byte_time;
+      fragment->download_stop_time = slot->fragment->download_stop_time;
+      fragment->completed = slot->fragment->completed;
+      fragment->cancelled = slot->fragment->cancelled;
+      *buffer = slot->buffer;
+      slot->buffer = NULL;
+      if (err) {
+        *err = slot->err;
+        slot->err = NULL;
+      }
+      skippy_download_pool_release_locked (slot);
+    } else {
+      // Another playlist, e.g after a variant switch
+      GST_DEBUG ("Prefetched fragment %" G_GUINT64_FORMAT " doesn't match anymore", sequence_number);
+      skippy_download_pool_release_locked (slot);
+    }
+  }
+  g_mutex_unlock (&pool->lock);
+  return result;
+}
+
+void
+skippy_download_pool_cancel (SkippyDownloadPool* pool)
+{
+  guint i;
+
+  g_mutex_lock (&pool->lock);
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    if (pool->slots[i].state == SLOT_RUNNING) {
+      skippy_uri_downloader_interrupt (pool->slots[i].downloader);
+    }
+  }
+  while (skippy_download_pool_count_locked (pool, SLOT_RUNNING) > 0) {
+    g_cond_wait (&pool->cond, &pool->lock);
+  }
+  for (i = 0; i < SKIPPY_DOWNLOAD_POOL_MAX_SLOTS; i++) {
+    skippy_download_pool_release_locked (&pool->slots[i]);
+    // Make sure these will handle the next download requested
+    if (pool->slots[i].downloader) {
+      skippy_uri_downloader_continue (pool->slots[i].downloader);
+    }
+  }
+  g_mutex_unlock (&pool->lock);
+}
@@ -0,0 +1,58 @@
+/*
+ * skippy_download_pool.h
+ *
+ *  Parallel fragment downloads for the stream loop
+ *
+ */
+
+#pragma once
+
+#include "skippy_fragment.h"
+#include "skippy_uridownloader.h"
+
+#include <glib.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// Upper bound for the configurable number of parallel downloads
+#define SKIPPY_DOWNLOAD_POOL_MAX_SLOTS 8
+
+// Fetches the fragments following the current one on unlinked downloaders (each on its own thread),
+// into one buffer per fragment. The stream loop takes them in playlist order and pushes the data itself.
+//
+// The number of downloads to keep in flight adapts to the measured request latency and transfer times:
+// as long as a request waits longer for its first byte than it takes to transfer a fragment,
+// one more download keeps the connection busy. Without measurements all slots get used (startup).
+typedef struct _SkippyDownloadPool SkippyDownloadPool;
+
+// Downloaders get created on demand and added to the bin
+SkippyDownloadPool* skippy_download_pool_new (GstBin* bin, guint max_downloads);
+// Cancels everything and removes the downloaders from the bin
+void skippy_download_pool_free (SkippyDownloadPool* pool);
+
+// Including the one of the stream loop, 1 disables prefetching
+void skippy_download_pool_set_max_downloads (SkippyDownloadPool* pool, guint max_downloads);
+// Used by all downloaders of the pool (NULL to stop using it)
+void skippy_download_pool_set_fragment_cache (SkippyDownloadPool* pool, SkippyFragmentCache* cache);
+// How many fragments after the current one should be in flight now
+guint skippy_download_pool_get_prefetch_count (SkippyDownloadPool* pool);
+
+// Whether the fragment with this sequence number is being fetched or waits to be taken
+gboolean skippy_download_pool_is_pending (SkippyDownloadPool* pool, guint64 sequence_number);
+// Starts fetching the fragment unless it's already pending, returns FALSE when no slot is free.
+// Results outside of the window of max downloads from first_sequence_number on (e.g after a seek) are dropped first.
+gboolean skippy_download_pool_prefetch (SkippyDownloadPool* pool, guint64 first_sequence_number, guint64 sequence_number,
+  SkippyFragment* fragment, const gchar* referrer, gboolean allow_cache);
+// Blocks until the prefetch of this fragment (same sequence number, URI and byte range) is done,
+// then copies size and download times into the fragment and hands over the data (buffer can be NULL when empty).
+// Returns SKIPPY_URI_DOWNLOADER_VOID if the fragment wasn't prefetched.
+SkippyUriDownloaderFetchReturn skippy_download_pool_take (SkippyDownloadPool* pool, guint64 sequence_number,
+  SkippyFragment* fragment, GstBuffer** buffer, GError** err);
+// Adds a fragment downloaded elsewhere to the measurements
+void skippy_download_pool_measure (SkippyDownloadPool* pool, SkippyFragment* fragment);
+
+// Interrupts all downloads and drops all results, blocks until the download threads are done
+void skippy_download_pool_cancel (SkippyDownloadPool* pool);
+
+G_END_DECLS
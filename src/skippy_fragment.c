@@ -61,6 +61,7 @@ static void
 skippy_fragment_init (SkippyFragment * fragment)
 {
   fragment->download_start_time = gst_util_get_timestamp ();
+  fragment->download_first_byte_time = 0;
   fragment->start_time = 0;
   fragment->stop_time = 0;
   fragment->duration = 0;
@@ -81,9 +82,34 @@ skippy_fragment_new (const gchar* uri)
 
   fragment = SKIPPY_FRAGMENT (g_object_new (TYPE_SKIPPY_FRAGMENT, NULL));
   fragment->uri = g_strdup (uri);
+  fragment->uri_size = strlen (uri) + 1;
   return fragment;
 }
 
+void
+skippy_fragment_recycle (SkippyFragment * fragment, const gchar* uri)
+{
+  gsize uri_size;
+
+  g_return_if_fail (fragment && uri);
+  g_return_if_fail (G_OBJECT (fragment)->ref_count == 1);
+
+  // The URI buffer only grows
+  uri_size = strlen (uri) + 1;
+  if (uri_size > fragment->uri_size) {
+    g_free (fragment->uri);
+    fragment->uri = g_malloc (uri_size);
+    fragment->uri_size = uri_size;
+  }
+  memcpy (fragment->uri, uri, uri_size);
+
+  g_free (fragment->key_uri);
+  fragment->key_uri = NULL;
+  fragment->download_stop_time = 0;
+
+  skippy_fragment_init (fragment);
+}
+
 void
 skippy_fragment_dispose (GObject * object)
 {
@@ -43,12 +43,14 @@ struct _SkippyFragment
   GObject parent;
 
   gchar* uri;                    /* URI of the fragment */
+  gsize uri_size;                /* Allocated size of uri (kept when recycled) */
   gchar *key_uri;                /* Encryption key */
   guint8 iv[16];                 /* Encryption IV */
-  gint64 range_start, range_end; /* Byte range @ URI */
+  gint64 range_start, range_end; /* Byte range @ URI (end excluded, -1 for the whole resource) */
   gboolean completed;            /* Whether the fragment is complete or not */
   gboolean cancelled;            /* Wether the fragment download was cancelled */
   guint64 download_start_time;   /* Epoch time when the download started */
+  guint64 download_first_byte_time; /* Epoch time when the first data arrived (0 before) */
   guint64 download_stop_time;    /* Epoch time when the download finished */
   guint64 start_time;            /* Media start time of the fragment */
   guint64 stop_time;             /* Media stop time of the fragment */
@@ -64,5 +66,7 @@ struct _SkippyFragmentClass
 
 GType skippy_fragment_get_type (void);
 SkippyFragment * skippy_fragment_new (const gchar* uri);
+// Re-initializes a fragment for another URI, for callers that hold the only reference
+void skippy_fragment_recycle (SkippyFragment * fragment, const gchar* uri);
 
 G_END_DECLS
@@ -0,0 +1,518 @@
+/*
+ * skippy_fragment_cache.c
+ *
+ *  Persistent cache of downloaded fragments
+ *
+ */
+
+#include "skippy_fragment_cache.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+GST_DEBUG_CATEGORY_STATIC (skippy_fragment_cache_debug);
+#define GST_CAT_DEFAULT skippy_fragment_cache_debug
+
+#define CACHE_FILE_MAGIC "\x89SKFRG\r\n"
+#define CACHE_FILE_MAGIC_SIZE 8
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_BYTE_ORDER 0x01020304
+#define CACHE_FILE_SUFFIX ".frag"
+#define CACHE_FILE_TEMP_SUFFIX ".tmp"
+#define CACHE_CHECKSUM_TYPE G_CHECKSUM_MD5
+#define CACHE_CHECKSUM_LENGTH 32
+// New data gets dropped while this much waits to be written
+#define MAX_PENDING_BYTES (16 * 1024 * 1024)
+
+// The data follows right after (native byte order)
+typedef struct
+{
+  gchar magic[CACHE_FILE_MAGIC_SIZE];
+  guint32 version;
+  guint32 byte_order;
+  guint64 size;
+  gchar checksum[CACHE_CHECKSUM_LENGTH]; // Of the data (hex)
+  guint8 padding[8];
+} SkippyFragmentCacheHeader;
+
+typedef struct
+{
+  gchar *name; // File name
+  guint64 size; // File size
+  gint64 mtime; // Only used while scanning
+  GList link; // In the LRU queue
+} SkippyFragmentCacheEntry;
+
+typedef enum {
+  JOB_SCAN, // Indexes the files present (first job)
+  JOB_WRITE,
+  JOB_TOUCH // Marks the file as used
+} SkippyFragmentCacheJobType;
+
+typedef struct
+{
+  SkippyFragmentCacheJobType type;
+  gchar *name;
+  GstBufferList *buffers;
+} SkippyFragmentCacheJob;
+
+struct _SkippyFragmentCache
+{
+  gchar *location;
+  guint refcount; // Under caches_lock
+
+  // Runs one job after the other
+  GThreadPool *jobs;
+
+  GMutex lock;
+  guint64 max_size;
+  GHashTable *entries; // By file name
+  GQueue lru; // Most recently used first
+  guint64 total_size;
+  guint64 pending_bytes; // Waiting to be written
+};
+
+static GMutex caches_lock;
+static GList *caches = NULL;
+
+static void skippy_fragment_cache_run_job (gpointer data, gpointer user_data);
+
+// Same equivalence as comparing URIs without their query: the range is part of the key, the file name is its hash
+static gchar*
+skippy_fragment_cache_get_file_name (const gchar* uri, gint64 range_start, gint64 range_end)
+{
+  GstUri *parsed;
+  gchar *resource, *key, *hash, *name;
+
+  parsed = gst_uri_from_string (uri);
+  if (!parsed) {
+    return NULL;
+  }
+  gst_uri_set_query_string (parsed, "");
+  resource = gst_uri_to_string (parsed);
+  gst_uri_unref (parsed);
+
+  key = g_strdup_printf ("%s %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT, resource, range_start, range_end);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+  name = g_strconcat (hash, CACHE_FILE_SUFFIX, NULL);
+
+  g_free (hash);
+  g_free (key);
+  g_free (resource);
+  return name;
+}
+
+static void
+skippy_fragment_cache_job_free (SkippyFragmentCacheJob* job)
+{
+  if (job->buffers) {
+    gst_buffer_list_unref (job->buffers);
+  }
+  g_free (job->name);
+  g_free (job);
+}
+
+static void
+skippy_fragment_cache_entry_free (gpointer data)
+{
+  SkippyFragmentCacheEntry *entry = (SkippyFragmentCacheEntry*) data;
+  g_free (entry->name);
+  g_free (entry);
+}
+
+static void
+skippy_fragment_cache_push_job (SkippyFragmentCache* cache, SkippyFragmentCacheJobType type, gchar* name, GstBufferList* buffers)
+{
+  SkippyFragmentCacheJob *job = g_new0 (SkippyFragmentCacheJob, 1);
+
+  job->type = type;
+  job->name = name;
+  job->buffers = buffers;
+  g_thread_pool_push (cache->jobs, job, NULL);
+}
+
+SkippyFragmentCache*
+skippy_fragment_cache_open (const gchar* location, guint64 max_size)
+{
+  static gboolean initialized = FALSE;
+  SkippyFragmentCache *cache = NULL;
+  GList *l;
+
+  g_return_val_if_fail (location != NULL, NULL);
+
+  g_mutex_lock (&caches_lock);
+  if (!initialized) {
+    GST_DEBUG_CATEGORY_INIT (skippy_fragment_cache_debug, "skippyhls-fragment-cache", 0, "HLS fragment cache");
+    initialized = TRUE;
+  }
+
+  for (l = caches; l && !cache; l = l->next) {
+    if (strcmp (((SkippyFragmentCache*) l->data)->location, location) == 0) {
+      cache = (SkippyFragmentCache*) l->data;
+    }
+  }
+
+  if (!cache) {
+    if (g_mkdir_with_parents (location, 0700) != 0) {
+      GST_WARNING ("Could not create fragment cache directory %s", location);
+      g_mutex_unlock (&caches_lock);
+      return NULL;
+    }
+    cache = g_new0 (SkippyFragmentCache, 1);
+    cache->location = g_strdup (location);
+    g_mutex_init (&cache->lock);
+    cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, skippy_fragment_cache_entry_free);
+    g_queue_init (&cache->lru);
+    cache->jobs = g_thread_pool_new (skippy_fragment_cache_run_job, cache, 1, FALSE, NULL);
+    skippy_fragment_cache_push_job (cache, JOB_SCAN, NULL, NULL);
+    caches = g_list_prepend (caches, cache);
+    GST_DEBUG ("Opened fragment cache in %s", location);
+  }
+  cache->refcount++;
+  g_mutex_unlock (&caches_lock);
+
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  g_mutex_unlock (&cache->lock);
+
+  return cache;
+}
+
+SkippyFragmentCache*
+skippy_fragment_cache_ref (SkippyFragmentCache* cache)
+{
+  g_mutex_lock (&caches_lock);
+  cache->refcount++;
+  g_mutex_unlock (&caches_lock);
+  return cache;
+}
+
+void
+skippy_fragment_cache_unref (SkippyFragmentCache* cache)
+{
+  g_mutex_lock (&caches_lock);
+  if (--cache->refcount > 0) {
+    g_mutex_unlock (&caches_lock);
+    return;
+  }
+  caches = g_list_remove (caches, cache);
+  g_mutex_unlock (&caches_lock);
+
+  // Finishes the queued jobs
+  g_thread_pool_free (cache->jobs, FALSE, TRUE);
+
+  // The links are part of the entries
+  g_queue_init (&cache->lru);
+  g_hash_table_destroy (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache->location);
+  g_free (cache);
+}
+
+// Checks the header and the checksum of a cache file
+static gboolean
+skippy_fragment_cache_verify (const gchar* data, gsize length)
+{
+  SkippyFragmentCacheHeader header;
+  gchar *checksum;
+  gboolean valid;
+
+  if (!data || length < sizeof (header)) {
+    return FALSE;
+  }
+  memcpy (&header, data, sizeof (header));
+  if (memcmp (header.magic, CACHE_FILE_MAGIC, CACHE_FILE_MAGIC_SIZE) != 0 || header.version != CACHE_FILE_VERSION
+    || header.byte_order != CACHE_FILE_BYTE_ORDER || header.size != length - sizeof (header)) {
+    return FALSE;
+  }
+  checksum = g_compute_checksum_for_data (CACHE_CHECKSUM_TYPE, (const guchar*) data + sizeof (header), header.size);
+  valid = memcmp (checksum, header.checksum, CACHE_CHECKSUM_LENGTH) == 0;
+  g_free (checksum);
+  return valid;
+}
+
+// Removes an entry from the index, but not its file
+static void
+skippy_fragment_cache_forget_locked (SkippyFragmentCache* cache, SkippyFragmentCacheEntry* entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->total_size -= entry->size;
+  g_hash_table_remove (cache->entries, entry->name);
+}
+
+GstBuffer*
+skippy_fragment_cache_lookup (SkippyFragmentCache* cache, const gchar* uri, gint64 range_start, gint64 range_end)
+{
+  SkippyFragmentCacheEntry *entry;
+  GMappedFile *file;
+  GstBuffer *buffer;
+  gchar *name, *path;
+  gsize length;
+
+  g_return_val_if_fail (cache && uri, NULL);
+
+  name = skippy_fragment_cache_get_file_name (uri, range_start, range_end);
+  if (!name) {
+    return NULL;
+  }
+  path = g_build_filename (cache->location, name, NULL);
+
+  file = g_mapped_file_new (path, FALSE, NULL);
+  if (!file) {
+    GST_LOG ("Cache miss for %s", uri);
+    g_free (path);
+    g_free (name);
+    return NULL;
+  }
+
+  length = g_mapped_file_get_length (file);
+  if (!skippy_fragment_cache_verify (g_mapped_file_get_contents (file), length)) {
+    GST_WARNING ("Removing corrupt cache file %s", path);
+    g_mapped_file_unref (file);
+    g_unlink (path);
+    g_mutex_lock (&cache->lock);
+    entry = (SkippyFragmentCacheEntry*) g_hash_table_lookup (cache->entries, name);
+    if (entry) {
+      skippy_fragment_cache_forget_locked (cache, entry);
+    }
+    g_mutex_unlock (&cache->lock);
+    g_free (path);
+    g_free (name);
+    return NULL;
+  }
+
+  // The buffer keeps the file mapped
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, g_mapped_file_get_contents (file), length,
+    sizeof (SkippyFragmentCacheHeader), length - sizeof (SkippyFragmentCacheHeader), file, (GDestroyNotify) g_mapped_file_unref);
+  GST_DEBUG ("Cache hit for %s (%" G_GSIZE_FORMAT " bytes)", uri, gst_buffer_get_size (buffer));
+
+  skippy_fragment_cache_push_job (cache, JOB_TOUCH, name, NULL);
+  g_free (path);
+  return buffer;
+}
+
+void
+skippy_fragment_cache_store (SkippyFragmentCache* cache, const gchar* uri, gint64 range_start, gint64 range_end,
+  GstBufferList* buffers)
+{
+  gsize size;
+  gchar *name;
+  gboolean accepted;
+
+  g_return_if_fail (cache && uri && buffers);
+
+  size = gst_buffer_list_calculate_size (buffers);
+  if (size == 0) {
+    return;
+  }
+
+  g_mutex_lock (&cache->lock);
+  accepted = size <= cache->max_size && cache->pending_bytes + size <= MAX_PENDING_BYTES;
+  if (accepted) {
+    cache->pending_bytes += size;
+  }
+  g_mutex_unlock (&cache->lock);
+
+  if (!accepted) {
+    GST_DEBUG ("Not caching %s (%" G_GSIZE_FORMAT " bytes)", uri, size);
+    return;
+  }
+
+  name = skippy_fragment_cache_get_file_name (uri, range_start, range_end);
+  if (!name) {
+    g_mutex_lock (&cache->lock);
+    cache->pending_bytes -= size;
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+  skippy_fragment_cache_push_job (cache, JOB_WRITE, name, gst_buffer_list_ref (buffers));
+}
+
+// Removes the least recently used files until the size limit holds
+static void
+skippy_fragment_cache_evict_locked (SkippyFragmentCache* cache)
+{
+  SkippyFragmentCacheEntry *entry;
+  gchar *path;
+
+  while (cache->total_size > cache->max_size && cache->lru.tail) {
+    entry = (SkippyFragmentCacheEntry*) cache->lru.tail->data;
+    path = g_build_filename (cache->location, entry->name, NULL);
+    GST_LOG ("Evicting %s (%" G_GUINT64_FORMAT " bytes)", entry->name, entry->size);
+    g_unlink (path);
+    g_free (path);
+    skippy_fragment_cache_forget_locked (cache, entry);
+  }
+}
+
+// Adds the file to the index or updates it, as the most recently used
+static void
+skippy_fragment_cache_add_locked (SkippyFragmentCache* cache, const gchar* name, guint64 size)
+{
+  SkippyFragmentCacheEntry *entry = (SkippyFragmentCacheEntry*) g_hash_table_lookup (cache->entries, name);
+
+  if (entry) {
+    g_queue_unlink (&cache->lru, &entry->link);
+    cache->total_size -= entry->size;
+  } else {
+    entry = g_new0 (SkippyFragmentCacheEntry, 1);
+    entry->name = g_strdup (name);
+    entry->link.data = entry;
+    g_hash_table_insert (cache->entries, entry->name, entry);
+  }
+  entry->size = size;
+  cache->total_size += size;
+  g_queue_push_head_link (&cache->lru, &entry->link);
+}
+
+static gint
+skippy_fragment_cache_compare_newest_first (gconstpointer a, gconstpointer b)
+{
+  gint64 mtime_a = ((const SkippyFragmentCacheEntry*) a)->mtime, mtime_b = ((const SkippyFragmentCacheEntry*) b)->mtime;
+  return mtime_a > mtime_b ? -1 : (mtime_a < mtime_b ? 1 : 0);
+}
+
+// Modification times persist the LRU order (files get touched on use)
+static void
+skippy_fragment_cache_scan (SkippyFragmentCache* cache)
+{
+  GDir *dir;
+  const gchar *name;
+  gchar *path;
+  GStatBuf st;
+  GList *found = NULL, *l;
+  SkippyFragmentCacheEntry *entry;
+
+  dir = g_dir_open (cache->location, 0, NULL);
+  if (!dir) {
+    GST_WARNING ("Could not read fragment cache directory %s", cache->location);
+    return;
+  }
+  while ((name = g_dir_read_name (dir))) {
+    path = g_build_filename (cache->location, name, NULL);
+    if (g_str_has_suffix (name, CACHE_FILE_TEMP_SUFFIX)) {
+      // Left over from an interrupted write
+      g_unlink (path);
+    } else if (g_str_has_suffix (name, CACHE_FILE_SUFFIX) && g_stat (path, &st) == 0) {
+      entry = g_new0 (SkippyFragmentCacheEntry, 1);
+      entry->name = g_strdup (name);
+      entry->size = st.st_size;
+      entry->mtime = st.st_mtime;
+      entry->link.data = entry;
+      found = g_list_prepend (found, entry);
+    }
+    g_free (path);
+  }
+  g_dir_close (dir);
+
+  found = g_list_sort (found, skippy_fragment_cache_compare_newest_first);
+
+  g_mutex_lock (&cache->lock);
+  for (l = found; l; l = l->next) {
+    entry = (SkippyFragmentCacheEntry*) l->data;
+    g_hash_table_insert (cache->entries, entry->name, entry);
+    g_queue_push_tail_link (&cache->lru, &entry->link);
+    cache->total_size += entry->size;
+  }
+  GST_DEBUG ("Fragment cache has %u files, %" G_GUINT64_FORMAT " bytes", cache->lru.length, cache->total_size);
+  skippy_fragment_cache_evict_locked (cache);
+  g_mutex_unlock (&cache->lock);
+
+  g_list_free (found);
+}
+
+// Writes to a temporary file first, so that an interrupted write never leaves a partial entry.
+// The buffers are mapped one after the other, the header with the checksum gets written last.
+static void
+skippy_fragment_cache_write (SkippyFragmentCache* cache, const gchar* name, GstBufferList* buffers)
+{
+  SkippyFragmentCacheHeader header;
+  GstMapInfo info;
+  GChecksum *checksum;
+  gchar *path, *temp_path;
+  FILE *file;
+  guint i, length = gst_buffer_list_length (buffers);
+  gboolean written = FALSE;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CACHE_FILE_MAGIC, CACHE_FILE_MAGIC_SIZE);
+  header.version = CACHE_FILE_VERSION;
+  header.byte_order = CACHE_FILE_BYTE_ORDER;
+  header.size = gst_buffer_list_calculate_size (buffers);
+
+  path = g_build_filename (cache->location, name, NULL);
+  temp_path = g_strconcat (path, CACHE_FILE_TEMP_SUFFIX, NULL);
+
+  file = g_fopen (temp_path, "wb");
+  if (file) {
+    checksum = g_checksum_new (CACHE_CHECKSUM_TYPE);
+    written = fwrite (&header, sizeof (header), 1, file) == 1;
+    for (i = 0; i < length && written; i++) {
+      GstBuffer *buffer = gst_buffer_list_get (buffers, i);
+      if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+        written = FALSE;
+        break;
+      }
+      g_checksum_update (checksum, info.data, info.size);
+      written = fwrite (info.data, 1, info.size, file) == info.size;
+      gst_buffer_unmap (buffer, &info);
+    }
+    if (written) {
+      memcpy (header.checksum, g_checksum_get_string (checksum), CACHE_CHECKSUM_LENGTH);
+      written = fseek (file, 0, SEEK_SET) == 0 && fwrite (&header, sizeof (header), 1, file) == 1;
+    }
+    g_checksum_free (checksum);
+    written = fclose (file) == 0 && written;
+  }
+
+  if (written && g_rename (temp_path, path) == 0) {
+    g_mutex_lock (&cache->lock);
+    skippy_fragment_cache_add_locked (cache, name, sizeof (header) + header.size);
+    skippy_fragment_cache_evict_locked (cache);
+    g_mutex_unlock (&cache->lock);
+  } else {
+    GST_WARNING ("Could not write cache file %s", path);
+    g_unlink (temp_path);
+  }
+
+  g_free (temp_path);
+  g_free (path);
+}
+
+static void
+skippy_fragment_cache_touch (SkippyFragmentCache* cache, const gchar* name)
+{
+  gchar *path = g_build_filename (cache->location, name, NULL);
+  GStatBuf st;
+
+  if (g_utime (path, NULL) == 0 && g_stat (path, &st) == 0) {
+    g_mutex_lock (&cache->lock);
+    skippy_fragment_cache_add_locked (cache, name, st.st_size);
+    g_mutex_unlock (&cache->lock);
+  }
+  g_free (path);
+}
+
+// Runs on the job thread of the cache
+static void
+skippy_fragment_cache_run_job (gpointer data, gpointer user_data)
+{
+  SkippyFragmentCacheJob *job = (SkippyFragmentCacheJob*) data;
+  SkippyFragmentCache *cache = (SkippyFragmentCache*) user_data;
+
+  switch (job->type) {
+    case JOB_SCAN:
+      skippy_fragment_cache_scan (cache);
+      break;
+    case JOB_WRITE:
+      skippy_fragment_cache_write (cache, job->name, job->buffers);
+      g_mutex_lock (&cache->lock);
+      cache->pending_bytes -= gst_buffer_list_calculate_size (job->buffers);
+      g_mutex_unlock (&cache->lock);
+      break;
+    case JOB_TOUCH:
+      skippy_fragment_cache_touch (cache, job->name);
+      break;
+  }
+  skippy_fragment_cache_job_free (job);
+}
@@ -0,0 +1,34 @@
+/*
+ * skippy_fragment_cache.h
+ *
+ *  Persistent cache of downloaded fragments
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// Completed fragments are kept as files in a directory up to a size limit, the least recently used ones get removed first.
+// Entries are keyed by the URI without its query (signed CDN tokens change from one play to the next) and the byte range.
+// Each file starts with a header holding the size and a checksum of the data, which get verified on every hit.
+//
+// Lookups read the file directly. Writes, LRU bookkeeping and eviction happen in order on a background thread.
+typedef struct _SkippyFragmentCache SkippyFragmentCache;
+
+// Everyone using the same directory shares one cache (the last size limit set applies). The directory is created if needed.
+SkippyFragmentCache* skippy_fragment_cache_open (const gchar* location, guint64 max_size);
+SkippyFragmentCache* skippy_fragment_cache_ref (SkippyFragmentCache* cache);
+// Pending writes get finished before the last reference goes away
+void skippy_fragment_cache_unref (SkippyFragmentCache* cache);
+
+// Returns the data (mapped from the file) or NULL when it isn't cached or the file is corrupt
+GstBuffer* skippy_fragment_cache_lookup (SkippyFragmentCache* cache, const gchar* uri, gint64 range_start, gint64 range_end);
+// Queues the data to be written (the buffers, in order, are referenced until then), doesn't block
+void skippy_fragment_cache_store (SkippyFragmentCache* cache, const gchar* uri, gint64 range_start, gint64 range_end,
+  GstBufferList* buffers);
+
+G_END_DECLS
@@ -4,4 +4,5 @@ typedef enum {
   NO_ERROR,
   PLAYLIST_INCOMPLETE,
   PLAYLIST_INVALID_UTF_CONTENT,
+  PLAYLIST_DELTA_UNUSABLE, // Delta update skipping segments we don't have: reload the whole playlist
 } SkippyHlsInternalError;
\ No newline at end of file
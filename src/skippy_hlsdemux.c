@@ -49,6 +49,13 @@
 
 #define MAX_FAILED_COUNT 20
 
+// Adjacent byte ranges of one resource fetched with one request (bounds how much one download covers)
+#define MAX_COMBINED_RANGE_FRAGMENTS 4
+
+// Fragments in flight at most, unless configured otherwise
+#define DEFAULT_PARALLEL_DOWNLOADS 4
+#define DEFAULT_FRAGMENT_CACHE_SIZE (256 * 1024 * 1024)
+
 #define OPUS_FORMAT_PARAM "hls_opus_64_url"
 #define MP3_FORMAT_PARAM "hls_mp3_128_url"
 #define FORMAT_PARAM "format"
@@ -111,8 +118,9 @@ static void skippy_hls_demux_stop (SkippyHLSDemux * demux);
 static void skippy_hls_demux_pause (SkippyHLSDemux * demux);
 static void skippy_hls_demux_reset (SkippyHLSDemux * demux);
 static void skippy_hls_demux_link_pads (SkippyHLSDemux * demux);
-static gboolean skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux);
+static gboolean skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux, gboolean blocking, gboolean delta);
 static GstFlowReturn skippy_hls_demux_proxy_pad_chain (GstPad *pad, GstObject *parent, GstBuffer *buffer);
+static void skippy_hls_demux_playlist_data_received (SkippyUriDownloader *downloader, const guint8 *data, gsize size, gpointer user_data);
 static gboolean skippy_hls_demux_proxy_pad_event (GstPad *pad, GstObject *parent, GstEvent *event);
 
 /* Utility functions */
@@ -175,6 +183,7 @@ skippy_hls_demux_init (SkippyHLSDemux * demux)
 
   // Member objects
   demux->client = skippy_m3u8_client_new ();
+  memset (demux->fragment_pool, 0, sizeof (demux->fragment_pool));
   demux->playlist = NULL;                 // Storage for initial playlist
   demux->caps = NULL;
   demux->oggDemux = createOggDecoder();
@@ -185,6 +194,7 @@ skippy_hls_demux_init (SkippyHLSDemux * demux)
   demux->queue_sinkpad = gst_element_get_static_pad (demux->download_queue, "sink");
   demux->downloader = skippy_uri_downloader_new (TRUE);
   demux->playlist_downloader = skippy_uri_downloader_new (FALSE);
+  skippy_uri_downloader_set_data_callback (demux->playlist_downloader, skippy_hls_demux_playlist_data_received, demux);
 
   demux->queue_proxy_pad = gst_pad_new ("skippyhlsdemux-queue-proxy-pad", GST_PAD_SINK);
   gst_pad_set_element_private (demux->queue_proxy_pad, demux);
@@ -195,13 +205,17 @@ skippy_hls_demux_init (SkippyHLSDemux * demux)
   gst_bin_add (GST_BIN (demux), demux->download_queue);
   gst_bin_add (GST_BIN (demux), GST_ELEMENT(demux->downloader));
   gst_bin_add (GST_BIN (demux), GST_ELEMENT(demux->playlist_downloader));
+  demux->download_pool = skippy_download_pool_new (GST_BIN (demux), DEFAULT_PARALLEL_DOWNLOADS);
 
   demux->need_segment = TRUE;
   demux->need_stream_start = TRUE;
   gst_segment_init (&demux->segment, GST_FORMAT_TIME);
 
   demux->download_ahead = DEFAULT_BUFFER_DURATION;
+  demux->connection_speed = 0;
   demux->force_secure_hls = FALSE;
+  demux->playlist_snapshot_location = NULL;
+  demux->fragment_cache = NULL;
   
   demux->dataCodec = UNKNOWN;
   demux->opus_init_data = g_malloc (129);
@@ -226,10 +240,21 @@ skippy_hls_demux_dispose (GObject * obj)
   GST_DEBUG ("Disposing ...");
 
   SkippyHLSDemux *demux = SKIPPY_HLS_DEMUX (obj);
+  guint i;
 
   skippy_hls_demux_reset (demux);
   skippy_hls_demux_stop (demux);
 
+  if (demux->download_pool) {
+    skippy_download_pool_free (demux->download_pool);
+    demux->download_pool = NULL;
+  }
+
+  if (demux->fragment_cache) {
+    skippy_fragment_cache_unref (demux->fragment_cache);
+    demux->fragment_cache = NULL;
+  }
+
   if (demux->out_adapter) {
     g_object_unref (demux->out_adapter);
     demux->out_adapter = NULL;
@@ -245,6 +270,14 @@ skippy_hls_demux_dispose (GObject * obj)
     demux->client = NULL;
   }
 
+  // Release pooled fragments
+  for (i = 0; i < G_N_ELEMENTS (demux->fragment_pool); i++) {
+    if (demux->fragment_pool[i]) {
+      g_object_unref (demux->fragment_pool[i]);
+      demux->fragment_pool[i] = NULL;
+    }
+  }
+
   // Release ref to queue sinkpad
   if (demux->queue_sinkpad) {
     g_object_unref (demux->queue_sinkpad);
@@ -282,6 +315,9 @@ skippy_hls_demux_dispose (GObject * obj)
     demux->rand_gen = NULL;
   }
 
+  g_free (demux->playlist_snapshot_location);
+  demux->playlist_snapshot_location = NULL;
+
   GST_DEBUG ("Done cleaning up.");
 
   G_OBJECT_CLASS (parent_class)->dispose (obj);
@@ -314,6 +350,10 @@ skippy_hls_demux_reset (SkippyHLSDemux * demux)
   demux->position_downloaded = 0;
   demux->download_failed_count = 0;
   demux->continuing = FALSE;
+  demux->need_media_playlist = FALSE;
+  demux->started_from_cache = FALSE;
+  demux->first_playlist_pending = FALSE;
+  demux->next_playlist_reload = 0;
 
   if (demux->oggDemux) {
     destroyOggDecoder(demux->oggDemux);
@@ -363,9 +403,12 @@ skippy_hls_demux_pause (SkippyHLSDemux * demux)
   // Now cancel all downloads to make the stream function exit quickly in case there are some
   skippy_uri_downloader_interrupt (demux->downloader);
   skippy_uri_downloader_interrupt (demux->playlist_downloader);
+  skippy_download_pool_cancel (demux->download_pool);
   // Block until we're done cancelling
   g_rec_mutex_lock (&demux->stream_lock);
   g_rec_mutex_unlock (&demux->stream_lock);
+  // Drop what the last iteration of the stream loop might have started meanwhile
+  skippy_download_pool_cancel (demux->download_pool);
   // Make sure these will handle the next download requested
   skippy_uri_downloader_continue (demux->downloader);
   skippy_uri_downloader_continue (demux->playlist_downloader);
@@ -451,6 +494,46 @@ skippy_hls_demux_set_context (GstElement *element, GstContext *context)
     demux->download_ahead = buffer_ahead;
   }
 
+  guint connection_speed = 0;
+  if (gst_structure_get_uint (context_structure, SKIPPY_HLS_CONNECTION_SPEED, &connection_speed)) {
+    demux->connection_speed = connection_speed;
+  }
+
+  guint max_parallel_downloads = 0;
+  if (gst_structure_get_uint (context_structure, SKIPPY_HLS_MAX_PARALLEL_DOWNLOADS, &max_parallel_downloads)) {
+    skippy_download_pool_set_max_downloads (demux->download_pool, max_parallel_downloads);
+  }
+
+  const gchar* snapshot_location = gst_structure_get_string (context_structure, SKIPPY_HLS_PLAYLIST_SNAPSHOT_LOCATION);
+  if (snapshot_location) {
+    GST_OBJECT_LOCK (demux);
+    g_free (demux->playlist_snapshot_location);
+    demux->playlist_snapshot_location = g_strdup (snapshot_location);
+    GST_OBJECT_UNLOCK (demux);
+  }
+
+  // Only fragments get cached, playlists need to be fresh
+  const gchar* fragment_cache_location = gst_structure_get_string (context_structure, SKIPPY_HLS_FRAGMENT_CACHE_LOCATION);
+  if (fragment_cache_location) {
+    guint64 fragment_cache_size = DEFAULT_FRAGMENT_CACHE_SIZE;
+    gst_structure_get_uint64 (context_structure, SKIPPY_HLS_FRAGMENT_CACHE_SIZE, &fragment_cache_size);
+
+    SkippyFragmentCache* fragment_cache = skippy_fragment_cache_open (fragment_cache_location, fragment_cache_size);
+    if (fragment_cache) {
+      skippy_uri_downloader_set_fragment_cache (demux->downloader, fragment_cache);
+      skippy_download_pool_set_fragment_cache (demux->download_pool, fragment_cache);
+
+      GST_OBJECT_LOCK (demux);
+      if (demux->fragment_cache) {
+        skippy_fragment_cache_unref (demux->fragment_cache);
+      }
+      demux->fragment_cache = fragment_cache;
+      GST_OBJECT_UNLOCK (demux);
+    } else {
+      GST_WARNING_OBJECT (demux, "Can't use %s as fragment cache", fragment_cache_location);
+    }
+  }
+
   GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
 }
 
@@ -578,6 +661,65 @@ skippy_hls_demux_update_duration (SkippyHLSDemux * demux)
   gst_element_post_message (GST_ELEMENT (demux), gst_message_new_duration_changed (GST_OBJECT (demux)));
 }
 
+// Saves the media playlist we just loaded for a faster start next time, when the application asked for it
+//
+// MT-safe
+static void
+skippy_hls_demux_save_playlist_snapshot (SkippyHLSDemux* demux)
+{
+  gchar* location;
+
+  GST_OBJECT_LOCK (demux);
+  location = g_strdup (demux->playlist_snapshot_location);
+  GST_OBJECT_UNLOCK (demux);
+
+  if (location) {
+    skippy_m3u8_client_save_playlist_snapshot (demux->client, location);
+    g_free (location);
+  }
+}
+
+// Links our pads and starts the streaming task once we have a media playlist to stream from
+//
+// MT-safe
+static void
+skippy_hls_demux_start_streaming (SkippyHLSDemux* demux, const gchar* uri)
+{
+  // Make sure URI downloaders are ready asap
+  skippy_uri_downloader_prepare (demux->downloader, uri);
+  skippy_uri_downloader_prepare (demux->playlist_downloader, uri);
+
+  skippy_hls_demux_link_pads (demux);
+  GST_OBJECT_LOCK (demux);
+  GstTaskState state;
+  if ((state = gst_task_get_state (demux->stream_task)) != GST_TASK_PAUSED)
+    gst_task_start (demux->stream_task);
+  GST_OBJECT_UNLOCK (demux);
+  GST_LOG ("Task started");
+}
+
+// Called on the first playlist data: when the same playlist was parsed recently (e.g the track is
+// played again) we start streaming from that copy right away. The downloaded playlist is merged into it
+// once complete, like a refresh (which also updates the signed fragment URIs).
+//
+// MT-safe
+static void
+skippy_hls_demux_start_from_cached_playlist (SkippyHLSDemux* demux)
+{
+  gchar* uri = skippy_hls_demux_query_location (demux);
+
+  if (uri && skippy_m3u8_client_load_cached_playlist (demux->client, uri)) {
+    GST_INFO_OBJECT (demux, "Starting from cached playlist for %s", uri);
+    GST_OBJECT_LOCK (demux);
+    demux->started_from_cache = TRUE;
+    demux->first_playlist_pending = TRUE;
+    GST_OBJECT_UNLOCK (demux);
+    skippy_hls_demux_update_duration (demux);
+    skippy_hls_demux_start_streaming (demux, uri);
+  }
+  g_free (uri);
+}
+
 // This is called by the URL source (sinkpad) event handler on EOS to handle the initial playlist data
 //
 // MT-safe
@@ -605,7 +747,8 @@ skippy_hls_demux_handle_first_playlist (SkippyHLSDemux* demux)
     goto error;
   }
 
-  result = skippy_m3u8_client_load_playlist (demux->client, uri, demux->playlist);
+  // Data has been parsed while we received it, this validates and commits the result
+  result = skippy_m3u8_client_end_playlist (demux->client, uri, demux->playlist);
 
   switch (result) {
     case PLAYLIST_INCOMPLETE:
@@ -632,24 +775,35 @@ skippy_hls_demux_handle_first_playlist (SkippyHLSDemux* demux)
   // Sending stats message about first playlist fetch
   skippy_hls_demux_post_stat_msg (demux, STAT_TIME_OF_FIRST_PLAYLIST, timestamp, 0);
 
-  // Updates duration field and posts message to bus
-  skippy_hls_demux_update_duration (demux);
+  // With a master playlist we start on the variant that our bandwidth can sustain.
+  // Its media playlist is loaded by the streaming thread.
+  if (skippy_m3u8_client_has_variant_playlist (demux->client)) {
+    gchar* variant_uri = skippy_m3u8_client_get_playlist_for_bitrate (demux->client, demux->connection_speed);
+    GST_INFO_OBJECT (demux, "Master playlist, selected variant for %u bps: %s", demux->connection_speed, variant_uri);
+    skippy_m3u8_client_set_current_playlist (demux->client, variant_uri);
+    g_free (variant_uri);
+    GST_OBJECT_LOCK (demux);
+    demux->need_media_playlist = TRUE;
+    GST_OBJECT_UNLOCK (demux);
+  } else {
+    // Updates duration field and posts message to bus
+    skippy_hls_demux_update_duration (demux);
+    skippy_hls_demux_save_playlist_snapshot (demux);
+  }
 
   GST_DEBUG_OBJECT (demux, "Finished setting up playlist");
 
-  // Make sure URI downloaders are ready asap
-  skippy_uri_downloader_prepare (demux->downloader, uri);
-  skippy_uri_downloader_prepare (demux->playlist_downloader, uri);
+  // Already streaming from the cached copy, which we just validated
+  if (!demux->started_from_cache) {
+    skippy_hls_demux_start_streaming (demux, uri);
+  }
 
-  skippy_hls_demux_link_pads (demux);
+error:
+  // Playlist refreshes of the stream loop can use the parser now
   GST_OBJECT_LOCK (demux);
-  GstTaskState state;
-  if ((state = gst_task_get_state (demux->stream_task)) != GST_TASK_PAUSED)
-    gst_task_start (demux->stream_task);
+  demux->first_playlist_pending = FALSE;
+  g_cond_signal (&demux->wait_cond);
   GST_OBJECT_UNLOCK (demux);
-  GST_LOG ("Task started");
-
-error:
   g_free (uri);
   return;
 }
@@ -758,8 +912,19 @@ static GstFlowReturn
 skippy_hls_demux_sink_data (GstPad * pad, GstObject * parent, GstBuffer * buf)
 {
   SkippyHLSDemux *demux = SKIPPY_HLS_DEMUX (parent);
+  GstMapInfo info;
+  gboolean first_buffer;
 
   GST_OBJECT_LOCK (demux);
+  first_buffer = demux->playlist == NULL;
+  if (first_buffer) {
+    skippy_m3u8_client_begin_playlist (demux->client);
+  }
+  // Parse the data as it arrives (before the buffer is merged into the aggregate)
+  if (gst_buffer_map (buf, &info, GST_MAP_READ)) {
+    skippy_m3u8_client_feed_playlist (demux->client, (const gchar*) info.data, info.size);
+    gst_buffer_unmap (buf, &info);
+  }
   if (demux->playlist == NULL) {
     demux->playlist = buf;
   } else {
@@ -767,6 +932,11 @@ skippy_hls_demux_sink_data (GstPad * pad, GstObject * parent, GstBuffer * buf)
   }
   GST_OBJECT_UNLOCK (demux);
 
+  // Queries upstream, not under our lock
+  if (first_buffer) {
+    skippy_hls_demux_start_from_cached_playlist (demux);
+  }
+
   return GST_FLOW_OK;
 }
 
@@ -1103,11 +1273,32 @@ skippy_hls_demux_proxy_pad_event (GstPad *pad, GstObject *parent, GstEvent *even
   return TRUE;
 }
 
-// Refreshes playlist - only called from streaming thread
+// When streaming started from a cached playlist, the first playlist is still being parsed by the client while it
+// downloads (see skippy_hls_demux_sink_data): a refresh would reset that parse. Waits until it got loaded.
+// Returns FALSE if the task was paused meanwhile. Only called from streaming thread.
 //
 // MT-safe
 static gboolean
-skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux)
+skippy_hls_demux_wait_for_first_playlist (SkippyHLSDemux * demux)
+{
+  gboolean started;
+
+  GST_OBJECT_LOCK (demux);
+  while ((started = GST_TASK_STATE (demux->stream_task) == GST_TASK_STARTED) && demux->first_playlist_pending) {
+    GST_DEBUG_OBJECT (demux, "Waiting for the first playlist before refreshing it");
+    g_cond_wait (&demux->wait_cond, GST_OBJECT_GET_LOCK (demux));
+  }
+  GST_OBJECT_UNLOCK (demux);
+  return started;
+}
+
+// Refreshes playlist - only called from streaming thread.
+// A blocking refresh asks a Low-Latency HLS server for the next part: the request returns once the playlist lists it.
+// A delta refresh lets the server skip the segments we already have, when it supports that.
+//
+// MT-safe
+static gboolean
+skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux, gboolean blocking, gboolean delta)
 {
   SkippyFragment *download;
   GstBuffer *buf = NULL;
@@ -1115,9 +1306,13 @@ skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux)
   SkippyUriDownloaderFetchReturn fetch_ret;
   gboolean ret = FALSE;
   gchar *current_playlist = skippy_m3u8_client_get_current_playlist (demux->client);
+  gchar *request_uri, *value;
+  guint64 next_sequence_number;
+  gint next_part;
   SkippyHlsInternalError load_playlist_result = NO_ERROR;
 
-  if (!current_playlist) {
+  if (!current_playlist || !skippy_hls_demux_wait_for_first_playlist (demux)) {
+    g_free (current_playlist);
     return FALSE;
   }
 
@@ -1130,8 +1325,28 @@ skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux)
     http_replace_query_parameter (&current_playlist, FORMAT_PARAM, format);
   }
   
+  // Delivery directives only go into the request, they are not part of the playlist URI
+  request_uri = g_strdup (current_playlist);
+  if (blocking && skippy_m3u8_client_get_blocking_reload_params (demux->client, &next_sequence_number, &next_part)) {
+    value = g_strdup_printf ("%" G_GUINT64_FORMAT, next_sequence_number);
+    skippy_hls_demux_append_query_param_to_hls_url (&request_uri, "_HLS_msn", value);
+    g_free (value);
+    if (next_part >= 0) {
+      value = g_strdup_printf ("%d", next_part);
+      skippy_hls_demux_append_query_param_to_hls_url (&request_uri, "_HLS_part", value);
+      g_free (value);
+    }
+    GST_DEBUG_OBJECT (demux, "Blocking playlist reload: %s", request_uri);
+  }
+  if (delta && skippy_m3u8_client_can_request_delta_update (demux->client)) {
+    skippy_hls_demux_append_query_param_to_hls_url (&request_uri, "_HLS_skip", "YES");
+  }
+
+  // The playlist gets parsed while downloading (see skippy_hls_demux_playlist_data_received)
+  skippy_m3u8_client_begin_playlist (demux->client);
+
   // Create a download
-  download = skippy_fragment_new (current_playlist);
+  download = skippy_fragment_new (request_uri);
   download->start_time = 0;
   download->stop_time = skippy_m3u8_client_get_total_duration (demux->client);
 
@@ -1154,17 +1369,23 @@ skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux)
 
     g_clear_error (&err);
 
-    load_playlist_result = skippy_m3u8_client_load_playlist (demux->client, current_playlist, buf);
+    load_playlist_result = skippy_m3u8_client_end_playlist (demux->client, current_playlist, buf);
 
     if (G_UNLIKELY(load_playlist_result != NO_ERROR)) {
-      if (load_playlist_result == PLAYLIST_INCOMPLETE) {
+      if (load_playlist_result == PLAYLIST_DELTA_UNUSABLE) {
+        // The client doesn't ask for a delta update again until it got the whole playlist
+        GST_DEBUG_OBJECT (demux, "Delta update not usable, reloading the whole playlist");
+        ret = skippy_hls_demux_refresh_playlist (demux, blocking, FALSE);
+      }
+      else if (load_playlist_result == PLAYLIST_INCOMPLETE) {
         GST_ELEMENT_WARNING (demux, SKIPPY_HLS, PLAYLIST_INCOMPLETE_ON_REFRESH, ("While refreshing playlist: Incomplete M3U8 data."), ("%s", skippy_m3u8_client_get_current_raw_data (demux->client)));
         demux->force_secure_hls = TRUE;
+        ret = FALSE;
       }
       else {
         GST_ELEMENT_ERROR (demux, SKIPPY_HLS, PLAYLIST_INVALID_UTF_CONTENT, ("While refreshing playlist: Invalid M3U8 data (buffer: %p)", buf), (NULL));
+        ret = FALSE;
       }
-      ret = FALSE;
     }
     else {
       ret = TRUE;
@@ -1196,10 +1417,22 @@ skippy_hls_demux_refresh_playlist (SkippyHLSDemux * demux)
   }
 
   g_clear_error (&err);
+  g_free (request_uri);
   g_free (current_playlist);
   return ret;
 }
 
+// Feeds playlist data to the M3U8 parser while the playlist is still being downloaded.
+// Called from the playlist downloader data source thread.
+//
+// MT-safe
+static void
+skippy_hls_demux_playlist_data_received (SkippyUriDownloader *downloader, const guint8 *data, gsize size, gpointer user_data)
+{
+  SkippyHLSDemux *demux = SKIPPY_HLS_DEMUX (user_data);
+  skippy_m3u8_client_feed_playlist (demux->client, (const gchar*) data, size);
+}
+
 static GstClockTime
 skippy_hls_demux_get_time_until_retry_locked (SkippyHLSDemux * demux)
 {
@@ -1321,6 +1554,142 @@ skippy_hlsdemux_opus_push_0_segment (SkippyHLSDemux *demux, gboolean is_discont)
   skippy_hls_demux_proxy_pad_chain(demux->queue_proxy_pad, NULL, opus_head_buffer);
 }
 
+// Live playlists get reloaded every target duration (half of it when the last reload didn't change anything).
+// Only called from the stream loop.
+//
+// MT-safe
+static void
+skippy_hls_demux_reload_live_playlist (SkippyHLSDemux * demux)
+{
+  gint64 now = g_get_monotonic_time ();
+  GstClockTime interval;
+
+  if (demux->next_playlist_reload && now < demux->next_playlist_reload) {
+    return;
+  }
+  // The first playlist was loaded just now
+  if (demux->next_playlist_reload) {
+    GST_DEBUG_OBJECT (demux, "Reloading live playlist");
+    // Failures get retried on the next reload
+    skippy_hls_demux_refresh_playlist (demux, FALSE, TRUE);
+  }
+  interval = skippy_m3u8_client_get_reload_interval (demux->client);
+  if (GST_CLOCK_TIME_IS_VALID (interval)) {
+    demux->next_playlist_reload = now + (gint64) GST_TIME_AS_USECONDS (interval);
+  }
+}
+
+// Returns a fragment to download for the descriptor (caller owns a reference).
+// Re-uses a pooled fragment that nobody else references anymore (prefetched ones are referenced until taken),
+// to avoid allocating one per iteration.
+//
+// Only called from the stream loop
+static SkippyFragment*
+skippy_hls_demux_fragment_from_descriptor (SkippyHLSDemux * demux, const SkippyM3U8FragmentDescriptor* descriptor)
+{
+  SkippyFragment *fragment = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (demux->fragment_pool); i++) {
+    if (!demux->fragment_pool[i]) {
+      fragment = demux->fragment_pool[i] = skippy_fragment_new (descriptor->uri);
+      break;
+    }
+    if (G_OBJECT (demux->fragment_pool[i])->ref_count == 1) {
+      fragment = demux->fragment_pool[i];
+      skippy_fragment_recycle (fragment, descriptor->uri);
+      break;
+    }
+  }
+
+  if (fragment) {
+    g_object_ref (fragment);
+  } else {
+    // All pooled fragments still in use
+    fragment = skippy_fragment_new (descriptor->uri);
+  }
+
+  fragment->start_time = descriptor->start_time;
+  fragment->stop_time = descriptor->stop_time;
+  fragment->duration = descriptor->duration;
+  fragment->range_start = descriptor->range_start;
+  fragment->range_end = descriptor->range_end;
+  return fragment;
+}
+
+// Extends the fragment over the following ones while they are adjacent byte ranges of the same resource,
+// so that one range request fetches them all. Returns the number of fragments it covers.
+//
+// Only called from the stream loop
+static guint
+skippy_hls_demux_combine_byte_ranges (SkippyHLSDemux * demux, SkippyFragment * fragment, const SkippyM3U8FragmentDescriptor * current)
+{
+  SkippyM3U8Lookahead *lookahead = skippy_m3u8_client_lookahead (demux->client, MAX_COMBINED_RANGE_FRAGMENTS);
+  const SkippyM3U8FragmentDescriptor *next, *last = current;
+  guint count = 1;
+
+  // The lookahead starts at the current fragment, unless the cursor moved meanwhile
+  if (lookahead->n_fragments > 0 && lookahead->fragments[0]->sequence_number == current->sequence_number) {
+    for (; count < lookahead->n_fragments; count++) {
+      next = lookahead->fragments[count];
+      if (next->range_end < 0 || next->range_start != last->range_end || g_strcmp0 (next->uri, current->uri) != 0) {
+        break;
+      }
+      last = next;
+    }
+  }
+
+  if (count > 1) {
+    fragment->range_end = last->range_end;
+    fragment->stop_time = last->stop_time;
+    fragment->duration = fragment->stop_time - fragment->start_time;
+    GST_DEBUG_OBJECT (demux, "Fetching %u adjacent byte ranges at once: %" G_GINT64_FORMAT " - %" G_GINT64_FORMAT,
+      count, fragment->range_start, fragment->range_end);
+  }
+  skippy_m3u8_lookahead_free (lookahead);
+  return count;
+}
+
+// Keeps the whole segments after the current one downloading in parallel (as many as the pool finds useful),
+// up to the download-ahead limit. The data only gets pushed once the stream loop gets to them.
+//
+// Only called from the stream loop
+static void
+skippy_hls_demux_prefetch_fragments (SkippyHLSDemux * demux, const SkippyM3U8FragmentDescriptor * current)
+{
+  guint count = skippy_download_pool_get_prefetch_count (demux->download_pool);
+  SkippyM3U8Lookahead *lookahead;
+  const SkippyM3U8FragmentDescriptor *next;
+  SkippyFragment *fragment;
+  gboolean allow_cache, started = TRUE;
+  guint i;
+
+  if (count == 0) {
+    return;
+  }
+  lookahead = skippy_m3u8_client_lookahead (demux->client, count + 1);
+  allow_cache = skippy_hls_demux_is_caching_allowed (demux);
+
+  // The lookahead starts at the current fragment, unless the cursor moved meanwhile
+  if (lookahead->n_fragments > 0 && lookahead->fragments[0]->sequence_number == current->sequence_number) {
+    for (i = 1; i < lookahead->n_fragments && started; i++) {
+      next = lookahead->fragments[i];
+      if (next->part_index >= 0 || next->range_end >= 0 || (GST_CLOCK_TIME_IS_VALID (demux->download_ahead)
+        && next->start_time >= current->start_time + demux->download_ahead)) {
+        break;
+      }
+      if (skippy_download_pool_is_pending (demux->download_pool, next->sequence_number)) {
+        continue;
+      }
+      fragment = skippy_hls_demux_fragment_from_descriptor (demux, next);
+      started = skippy_download_pool_prefetch (demux->download_pool, current->sequence_number, next->sequence_number,
+        fragment, next->playlist_uri, allow_cache);
+      g_object_unref (fragment);
+    }
+  }
+  skippy_m3u8_lookahead_free (lookahead);
+}
+
 // Streaming task function - implements all the HLS logic.
 // When this runs the streaming task mutex is/must be locked.
 //
@@ -1328,14 +1697,19 @@ skippy_hlsdemux_opus_push_0_segment (SkippyHLSDemux *demux, gboolean is_discont)
 static void
 skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
 {
-  SkippyFragment *fragment = NULL, *current_opus_fragment = NULL;
+  SkippyM3U8FragmentDescriptor *current = NULL, *opus_head = NULL;
+  SkippyFragment *fragment = NULL;
   SkippyUriDownloaderFetchReturn fetch_ret = SKIPPY_URI_DOWNLOADER_VOID;
   GError *err = NULL;
-  gchar* referrer_uri = NULL;
   gboolean playlist_outdated = FALSE;
   gboolean media_segment_fatal_error = FALSE;
   gboolean opus_need_head  = FALSE;
   GstClockTime time_until_retry;
+  guint64 blocking_sequence_number;
+  gint blocking_part;
+  GstClockTime reload_interval;
+  guint combined_fragments = 1, i;
+  GstBuffer *prefetched_data = NULL;
 
   GST_TRACE_OBJECT (demux, "Entering stream task");
 
@@ -1347,28 +1721,48 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
   }
   GST_TRACE ("Will try to fetch next fragment ...");
 
+  // With a master playlist we first need the media playlist of the selected variant
+  if (G_UNLIKELY (demux->need_media_playlist)) {
+    if (!skippy_hls_demux_refresh_playlist (demux, FALSE, FALSE)) {
+      GST_OBJECT_LOCK (demux);
+      demux->download_failed_count++;
+      time_until_retry = skippy_hls_demux_get_time_until_retry_locked (demux);
+      GST_DEBUG ("Failed to load variant playlist, next retry scheduled in: %" GST_TIME_FORMAT, GST_TIME_ARGS (time_until_retry));
+      demux->continuing = FALSE;
+      skippy_hls_stream_loop_wait_locked (demux, time_until_retry);
+      demux->continuing = TRUE;
+      GST_OBJECT_UNLOCK (demux);
+      return;
+    }
+    GST_OBJECT_LOCK (demux);
+    demux->need_media_playlist = FALSE;
+    demux->download_failed_count = 0;
+    GST_OBJECT_UNLOCK (demux);
+    skippy_hls_demux_update_duration (demux);
+    skippy_hls_demux_save_playlist_snapshot (demux);
+  }
+
   //g_usleep (1000*1000);
 
-  // Get next fragment from M3U8 list
-  referrer_uri = skippy_m3u8_client_get_uri (demux->client);
-  
-  
-  fragment = skippy_m3u8_client_get_current_fragment (demux->client);
+  if (skippy_m3u8_client_is_live (demux->client)) {
+    skippy_hls_demux_reload_live_playlist (demux);
+  }
+
+  // Get next fragment from M3U8 list (the descriptor also carries the playlist URI we use as referrer)
+  current = skippy_m3u8_client_acquire_current_fragment (demux->client);
   
-  if (demux->dataCodec == OPUS) {
-    current_opus_fragment = skippy_m3u8_client_get_current_fragment (demux->client);
+  if (demux->dataCodec == OPUS && current) {
     // when we seek we first want to make sure that 0 segment is pushed
     if (demux->need_segment && !demux->need_stream_start) {
       if (demux->opus_0_fragment_cached) {
         // if 0 segment is already buffered push it directly
-        demux->position = current_opus_fragment->start_time;
+        demux->position = current->start_time;
         // skippy_hlsdemux_opus_push_0_segment(demux, TRUE);
       } else {
         // we are seeking but 0 segment is not buffered, so stream loop should
         // fetch it
         demux->opus_init_data_written = 0;
         opus_need_head = TRUE;
-        fragment = skippy_m3u8_client_get_fragment (demux->client, 0);
       }
     } else {
       // not seeking but we did not cache the whole 0 segment
@@ -1377,32 +1771,72 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
         // in this case stream loop should fetch 0 segment
         demux->opus_init_data_written = 0;
         opus_need_head = TRUE;
-        fragment = skippy_m3u8_client_get_fragment (demux->client, 0);
       }
     }
+    if (opus_need_head) {
+      opus_head = skippy_m3u8_client_acquire_fragment (demux->client, 0);
+    }
+  }
+  
+  if (current) {
+    fragment = skippy_hls_demux_fragment_from_descriptor (demux, opus_need_head ? opus_head : current);
+    if (!opus_need_head && current->part_index < 0 && current->range_end >= 0) {
+      combined_fragments = skippy_hls_demux_combine_byte_ranges (demux, fragment, current);
+    }
   }
   
   if (fragment) {
     GST_OBJECT_LOCK (demux);
-    if (opus_need_head) {
-      demux->position = current_opus_fragment->start_time;
-    } else {
-      demux->position = fragment->start_time;
-    }
+    demux->position = current->start_time;
     GST_OBJECT_UNLOCK (demux);
     
     GST_INFO_OBJECT (demux, "Pushing data for next fragment: %s (Byte-Range=%" G_GINT64_FORMAT " - %" G_GINT64_FORMAT ")",
       fragment->uri, fragment->range_start, fragment->range_end);
-    // Tell downloader to push data
-    fetch_ret = skippy_uri_downloader_fetch_fragment (demux->downloader,
-      fragment, // Media fragment to load
-      referrer_uri, // Referrer
-      FALSE, // Compress (useless with coded media data)
-      FALSE, // Refresh disabled (don't wipe out cache)
-      skippy_hls_demux_is_caching_allowed (demux), // Allow caching directive
-      &err
-    );
+    // The following whole segments get fetched in parallel, this one might be done already
+    if (!opus_need_head && current->part_index < 0 && current->range_end < 0) {
+      skippy_hls_demux_prefetch_fragments (demux, current);
+      fetch_ret = skippy_download_pool_take (demux->download_pool, current->sequence_number, fragment, &prefetched_data, &err);
+    }
+    if (fetch_ret == SKIPPY_URI_DOWNLOADER_VOID) {
+      // Tell downloader to push data
+      fetch_ret = skippy_uri_downloader_fetch_fragment (demux->downloader,
+        fragment, // Media fragment to load
+        current->playlist_uri, // Referrer
+        FALSE, // Compress (useless with coded media data)
+        FALSE, // Refresh disabled (don't wipe out cache)
+        skippy_hls_demux_is_caching_allowed (demux), // Allow caching directive
+        &err
+      );
+      if (fetch_ret == SKIPPY_URI_DOWNLOADER_COMPLETED) {
+        skippy_download_pool_measure (demux->download_pool, fragment);
+      }
+    } else if (prefetched_data) {
+      // Data of prefetched fragments goes through the same path, in playlist order
+      GST_DEBUG_OBJECT (demux, "Pushing prefetched fragment %" G_GUINT64_FORMAT, current->sequence_number);
+      skippy_hls_demux_proxy_pad_chain (demux->queue_proxy_pad, NULL, prefetched_data);
+      prefetched_data = NULL;
+    }
     skippy_hlsdemux_proxy_pad_reset (demux);
+  } else if (skippy_m3u8_client_is_live (demux->client)) {
+    // Reached the live edge: no end of stream, the next reload lists the following fragments.
+    // A server that supports blocking reloads answers as soon as it has them.
+    if (skippy_m3u8_client_get_blocking_reload_params (demux->client, &blocking_sequence_number, &blocking_part)
+      && skippy_hls_demux_refresh_playlist (demux, TRUE, TRUE)) {
+      // Not live anymore when the reload brought the end tag
+      reload_interval = skippy_m3u8_client_get_reload_interval (demux->client);
+      if (GST_CLOCK_TIME_IS_VALID (reload_interval)) {
+        demux->next_playlist_reload = g_get_monotonic_time () + (gint64) GST_TIME_AS_USECONDS (reload_interval);
+      }
+      goto end_stream_loop;
+    }
+    GST_OBJECT_LOCK (demux);
+    time_until_retry = MAX (demux->next_playlist_reload - g_get_monotonic_time (), 0) * GST_USECOND;
+    GST_DEBUG ("At the live edge, next reload in: %" GST_TIME_FORMAT, GST_TIME_ARGS (time_until_retry));
+    demux->continuing = FALSE;
+    skippy_hls_stream_loop_wait_locked (demux, time_until_retry);
+    demux->continuing = TRUE;
+    GST_OBJECT_UNLOCK (demux);
+    goto end_stream_loop;
   } else {
     GST_INFO_OBJECT (demux, "This playlist doesn't contain more fragments");
   }
@@ -1424,11 +1858,7 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
     //TODO: remove this check once we make sure Error instance is initialized in all cases when download fails
     if (!err) {
       g_warning ("Error not set but download failed!");
-      if (fragment) {
-        g_object_unref (fragment);
-      }
-      g_free (referrer_uri);
-      return;
+      goto end_stream_loop;
     }
     GST_INFO ("Fragment fetch error: %s", err->message);
     // Actual download failure
@@ -1476,7 +1906,8 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
           fragment->uri, (int) demux->download_forbidden_count, err->message),
         ("\n\n%s\n\n", skippy_m3u8_client_get_current_raw_data (demux->client)));
       }
-      playlist_outdated = !skippy_hls_demux_refresh_playlist (demux);
+      // Delta updates would keep the URLs of the skipped segments
+      playlist_outdated = !skippy_hls_demux_refresh_playlist (demux, FALSE, FALSE);
     }
     break;
   case SKIPPY_URI_DOWNLOADER_COMPLETED:
@@ -1491,8 +1922,10 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
       demux->download_failed_count = 0;
       demux->download_forbidden_count = 0;
       demux->continuing = FALSE;
-      // Go to next fragment
-      skippy_m3u8_client_advance_to_next_fragment (demux->client);
+      // Go to next fragment (after all the ones we fetched at once)
+      for (i = 0; i < combined_fragments; i++) {
+        skippy_m3u8_client_advance_to_next_fragment (demux->client);
+      }
     }
     GST_OBJECT_UNLOCK (demux);
     break;
@@ -1514,14 +1947,19 @@ skippy_hls_demux_stream_loop (SkippyHLSDemux * demux)
   }
 
 end_stream_loop:
+  if (prefetched_data) {
+    gst_buffer_unref (prefetched_data);
+  }
   // Unref current fragment
   if (fragment) {
     g_object_unref (fragment);
   }
-  if (current_opus_fragment) {
-    g_object_unref (current_opus_fragment);
+  if (current) {
+    skippy_m3u8_fragment_descriptor_unref (current);
+  }
+  if (opus_head) {
+    skippy_m3u8_fragment_descriptor_unref (opus_head);
   }
-  g_free (referrer_uri);
   g_clear_error (&err);
 }
 
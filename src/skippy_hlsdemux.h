@@ -30,6 +30,7 @@
 
 #include "skippy_m3u8.h"
 #include "skippy_uridownloader.h"
+#include "skippy_download_pool.h"
 
 G_BEGIN_DECLS
 #define TYPE_SKIPPY_HLS_DEMUX \
@@ -82,7 +83,10 @@ struct _SkippyHLSDemux
   GstBuffer* playlist;
   SkippyUriDownloader *downloader;
   SkippyUriDownloader *playlist_downloader;
+  SkippyDownloadPool *download_pool; /* Fetches the fragments after the current one */
   SkippyM3U8Client *client;     /* M3U8 client */
+  /* Recycled by the stream loop: its own two (the downloader keeps the last one) and those of the prefetches */
+  SkippyFragment *fragment_pool[SKIPPY_DOWNLOAD_POOL_MAX_SLOTS + 1];
   GRand *rand_gen;
 
 
@@ -95,6 +99,11 @@ struct _SkippyHLSDemux
 
   /* Internal state */
   GstClockTime download_ahead;
+  guint connection_speed;
+  gboolean need_media_playlist;
+  gboolean started_from_cache;  /* Streaming before the first playlist finished downloading */
+  gboolean first_playlist_pending; /* Started from cache and the first playlist is still being parsed */
+  gint64 next_playlist_reload;  /* Monotonic time (us) of the next live playlist reload, 0 before the first */
   GstClockTime position;
   GstClockTime position_downloaded;
   GstClockTime last_seeking_position;
@@ -102,6 +111,8 @@ struct _SkippyHLSDemux
   gint download_forbidden_count;
   gboolean continuing;
   gboolean force_secure_hls;
+  gchar *playlist_snapshot_location;
+  SkippyFragmentCache *fragment_cache; /* Shared by the fragment downloaders, protected by the object lock */
   
   /* Codec specific state */
   SkippyHLSDemuxCodec dataCodec;
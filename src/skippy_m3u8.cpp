@@ -1,11 +1,18 @@
 #include <string>
 #include <mutex>
-#include <string.h> // for memcpy
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <stdlib.h>
 
 #include "skippy_m3u8.h"
 #include "skippy_fragment.h"
 
 #include "skippy_m3u8_parser.hpp"
+#include "skippy_m3u8_store.hpp"
 #include "skippyHLS/skippy_hls.h"
 #include "skippy_hls_priv.h"
 
@@ -15,29 +22,97 @@ GST_DEBUG_CATEGORY_STATIC (skippy_m3u8_debug);
 
 #define NANOSECONDS_TO_GST_TIME(t) ((GstClockTime)t*GST_NSECOND)
 
+// Live playback starts this many target durations before the end of the playlist (HLS spec, section 6.3.3)
+#define LIVE_EDGE_HOLD_BACK_TARGET_DURATIONS 3
+// Same for partial segments, when the server doesn't give a PART-HOLD-BACK (HLS spec, section 4.4.3.8)
+#define LIVE_EDGE_HOLD_BACK_PART_TARGETS 3
+
 using namespace std;
 
+// Playlist model, immutable once published: readers take a reference on the current snapshot and never lock.
+// Updates copy the snapshot, change the copy and publish it in place of the old one. The items and the variants
+// are shared between snapshots: an update only copies the part it changes (and the store only the blocks it changes).
+struct SkippyM3U8Snapshot
+{
+  SkippyM3U8Snapshot ()
+  :playlist("")
+  ,store(make_shared<SkippyM3UItemStore>())
+  ,master(make_shared<SkippyM3UMasterPlaylist>(""))
+  ,changed(true)
+  {
+
+  }
+
+  SkippyM3UPlaylist playlist; // Header and partial segments (with absolute URIs and media sequence numbers), items are kept in the store
+  shared_ptr<const SkippyM3UItemStore> store;
+  shared_ptr<const SkippyM3UMasterPlaylist> master; // Variants sorted by bandwidth
+  bool changed; // Whether the update that created this snapshot changed any item
+};
+
+typedef shared_ptr<const SkippyM3U8Snapshot> SkippyM3U8SnapshotRef;
+
 struct SkippyM3U8ClientPrivate
 {
   SkippyM3U8ClientPrivate ()
-  :current_index(0)
+  :snapshot(make_shared<SkippyM3U8Snapshot>())
+  ,position(0)
+  ,part(0)
   ,playlist_raw(NULL)
-  ,playlist("")
+  ,playlist_raw_string(NULL)
+  ,feeding(false)
+  ,updated_at(0)
+  ,delta_unusable(false)
   {
 
   }
 
   ~SkippyM3U8ClientPrivate ()
   {
-    g_free (playlist_raw);
+    if (playlist_raw) {
+      gst_buffer_unref (playlist_raw);
+    }
+    g_free (playlist_raw_string);
   }
 
-  int current_index;
-  gchar* playlist_raw;
-  SkippyM3UPlaylist playlist;
+  SkippyM3U8SnapshotRef snapshot; // Only accessed with atomic_load/atomic_store
+  // Cursor: media sequence number of the current item. Unlike an index it stays valid
+  // when a refresh evicts items, so it doesn't have to change together with the snapshot.
+  atomic<guint64> position;
+  // Partial segment of the current item (Low-Latency HLS), 0 when the item is played whole.
+  // Only the streaming thread moves it forward, anything that sets the position resets it.
+  atomic<guint> part;
+
+  // Updates only, under the mutex
+  GstBuffer* playlist_raw; // Data of the last loaded playlist, only copied when asked for
+  gchar* playlist_raw_string;
+  SkippyM3UParser parser; // Re-used across refreshes to keep its buffers
+  bool feeding; // Incremental load ongoing
+  gint64 updated_at; // Monotonic time of the last load from a server, 0 if there was none
+  bool delta_unusable; // Last delta update skipped segments we didn't have, until the next full load
   recursive_mutex mutex;
 };
 
+static SkippyM3U8SnapshotRef skippy_m3u8_client_get_snapshot (SkippyM3U8Client * client)
+{
+  return atomic_load (&client->priv->snapshot);
+}
+
+// Client mutex must be locked (one writer at a time)
+static void skippy_m3u8_client_publish_snapshot_locked (SkippyM3U8Client * client, shared_ptr<SkippyM3U8Snapshot> snapshot)
+{
+  atomic_store (&client->priv->snapshot, SkippyM3U8SnapshotRef (std::move (snapshot)));
+}
+
+// Index of the item at the cursor position in the snapshot, clamped to the window (size when past the end)
+static size_t skippy_m3u8_client_get_index (const SkippyM3U8Snapshot& snapshot, guint64 position)
+{
+  const SkippyM3UItemStore& store = *snapshot.store;
+  if (position < store.firstSequenceNo()) {
+    return 0;
+  }
+  return (size_t) min<guint64> (position - store.firstSequenceNo(), store.size());
+}
+
 static gpointer skippy_m3u8_client_init_once (gpointer user_data)
 {
   GST_DEBUG_CATEGORY_INIT (skippy_m3u8_debug, "skippyhls-m3u8", 0, "M3U8 client");
@@ -61,186 +136,1119 @@ void skippy_m3u8_client_free (SkippyM3U8Client * client)
   g_slice_free(SkippyM3U8Client, client);
 }
 
-static gchar* buf_to_utf8_playlist (GstBuffer * buf)
+static bool compare_variant_bandwidth (const SkippyM3UPlaylist& a, const SkippyM3UPlaylist& b)
 {
-  GstMapInfo info;
-  gchar *playlist;
+  return a.bandwidthKbps < b.bandwidthKbps;
+}
+
+// Builds the variant table from a parsed master playlist
+static void skippy_m3u8_client_update_variants (SkippyM3U8Snapshot& snapshot, const SkippyM3UMasterPlaylist& parsed, const string& uri)
+{
+  shared_ptr<SkippyM3UMasterPlaylist> master = make_shared<SkippyM3UMasterPlaylist> (parsed);
+  master->uri = uri;
+
+  // Variant URIs may be relative to the master playlist
+  for (SkippyM3UPlaylist& variant : master->items) {
+    gchar* variant_uri = gst_uri_join_strings (uri.c_str(), variant.uri.c_str());
+    if (variant_uri) {
+      variant.uri = variant_uri;
+      g_free (variant_uri);
+    }
+  }
+
+  stable_sort (master->items.begin(), master->items.end(), compare_variant_bandwidth);
+
+  GST_DEBUG ("Loaded master playlist with %d variants", (int) master->items.size());
+  snapshot.master = master;
+}
+
+// Last item that starts at least LIVE_EDGE_HOLD_BACK_TARGET_DURATIONS before the end of a live playlist (the first if none does)
+static size_t skippy_m3u8_live_start_index (const SkippyM3UItemStore& store, uint64_t target_duration)
+{
+  uint64_t hold_back = LIVE_EDGE_HOLD_BACK_TARGET_DURATIONS * target_duration;
+  uint64_t distance = 0;
+  size_t index = store.size();
+
+  while (index > 0 && distance < hold_back) {
+    distance += store.duration (--index);
+  }
+  return index;
+}
 
-  if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+// Last independent part that starts at least the part hold back before the end of a live playlist (parts resolved).
+// Returns false if there is none (the playlist has no partial segments or they don't reach back far enough).
+static bool skippy_m3u8_live_start_part (const SkippyM3UPlaylist& playlist, guint64& position, guint& part)
+{
+  const SkippyM3UParts& parts = playlist.parts;
+  uint64_t hold_back = playlist.partHoldBack ? playlist.partHoldBack : LIVE_EDGE_HOLD_BACK_PART_TARGETS * playlist.partTargetDuration;
+  uint64_t distance = 0;
+
+  if (parts.empty() || playlist.partTargetDuration == 0) {
+    return false;
+  }
+  for (size_t i = parts.size(); i > 0; i--) {
+    const SkippyM3UPart& candidate = parts[i - 1];
+    distance += candidate.duration;
+    if (distance >= hold_back && candidate.independent) {
+      position = candidate.index;
+      part = (guint) candidate.partNo;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Where playback of a newly loaded playlist starts: at its first item, or at a distance from the live edge
+// for a live playlist. Returns the media sequence number and sets the part.
+static guint64 skippy_m3u8_client_start_position (const SkippyM3U8Snapshot& snapshot, guint& part)
+{
+  const SkippyM3UItemStore& store = *snapshot.store;
+  guint64 position;
+
+  part = 0;
+  if (snapshot.playlist.isComplete) {
+    return store.firstSequenceNo();
+  }
+  if (skippy_m3u8_live_start_part (snapshot.playlist, position, part)) {
+    GST_DEBUG ("Starting live playlist at part %u of item %" G_GUINT64_FORMAT, part, position);
+    return position;
+  }
+  position = store.firstSequenceNo() + skippy_m3u8_live_start_index (store, snapshot.playlist.targetDuration);
+  GST_DEBUG ("Starting live playlist at item %" G_GUINT64_FORMAT " of %d", position, (int) store.size());
+  return position;
+}
+
+// Rebases the partial segments on media sequence numbers and resolves their URIs (they change with each reload)
+static void skippy_m3u8_client_resolve_parts (SkippyM3UPlaylist& playlist)
+{
+  for (SkippyM3UPart& part : playlist.parts) {
+    gchar* part_uri = gst_uri_join_strings (playlist.uri.c_str(), part.url.c_str());
+    if (part_uri) {
+      part.url = part_uri;
+      g_free (part_uri);
+    }
+    part.index += playlist.sequenceNo;
+  }
+  if (!playlist.preloadHint.empty()) {
+    gchar* hint_uri = gst_uri_join_strings (playlist.uri.c_str(), playlist.preloadHint.c_str());
+    if (hint_uri) {
+      playlist.preloadHint = hint_uri;
+      g_free (hint_uri);
+    }
+  }
+}
+
+// Merges a freshly loaded playlist into the current one, keyed by media sequence number:
+// items that slid out of the window are evicted, known items are kept (and their URL updated in place when it changed),
+// new items are appended. Returns the snapshot to publish. When the model gets replaced, moved is set with the
+// cursor to set once the snapshot is published (position and part). Client mutex must be locked.
+static shared_ptr<SkippyM3U8Snapshot> skippy_m3u8_client_merge_playlist_locked (SkippyM3U8Client * client, SkippyM3UPlaylist& loaded_playlist,
+  bool& moved, guint64& position, guint& part)
+{
+  SkippyM3U8SnapshotRef current = skippy_m3u8_client_get_snapshot (client);
+  shared_ptr<SkippyM3U8Snapshot> next = make_shared<SkippyM3U8Snapshot>();
+  SkippyM3UPlaylistItems& loaded_items = loaded_playlist.items;
+  size_t evicted = 0;
+  size_t known = 0;
+  size_t updated = 0;
+  // A delta update lists the segments after the skipped ones (which we have, see skippy_m3u8_client_update_playlist_locked)
+  size_t skipped = (size_t) loaded_playlist.skippedSegments;
+  size_t listed = skipped + loaded_items.size();
+  shared_ptr<SkippyM3UItemStore> store;
+
+  // Nothing to merge with, or the new window starts before ours (i.e a different stream): replace
+  bool replace = current->store->empty() || loaded_playlist.sequenceNo < current->playlist.sequenceNo;
+  if (replace) {
+    GST_DEBUG ("Replacing playlist model with %d items", (int) loaded_items.size());
+    store = make_shared<SkippyM3UItemStore>();
+
+    // Keep the current index (a first playlist starts where skippy_m3u8_client_start_position says, see below)
+    moved = true;
+    part = 0;
+    position = loaded_playlist.sequenceNo + min (skippy_m3u8_client_get_index (*current, client->priv->position), loaded_items.size());
+  } else {
+    // Shares the blocks of items until they change
+    store = make_shared<SkippyM3UItemStore>(*current->store);
+
+    // Evict what slid out of the window
+    evicted = min ((size_t) (loaded_playlist.sequenceNo - current->playlist.sequenceNo), store->size());
+    if (evicted) {
+      store->evictFront (evicted);
+    }
+
+    // Drop items that the new window doesn't list anymore
+    if (store->size() > listed) {
+      store->truncate (listed);
+    }
+
+    // Update the items we already know (the store keeps the timeline continuous), skipped ones are kept as they are
+    known = store->size();
+    for (size_t i = skipped; i < known; i++) {
+      if (store->setUrl (i, loaded_items[i - skipped].url)) {
+        updated++;
+      }
+      if (store->setDuration (i, loaded_items[i - skipped].duration)) {
+        updated++;
+      }
+      if (store->setRange (i, loaded_items[i - skipped].rangeStart, loaded_items[i - skipped].rangeEnd)) {
+        updated++;
+      }
+    }
+  }
+
+  // Append the new ones (continuing our timeline even if we missed a part of the stream)
+  for (size_t i = known; i < listed; i++) {
+    store->append (loaded_items[i - skipped]);
+  }
+
+  GST_DEBUG ("Merged playlist: %d evicted, %d skipped, %d updated, %d appended (%d bytes)", (int) evicted, (int) skipped,
+    (int) updated, (int) (listed - known), (int) store->memoryUsage());
+
+  // A blocking reload usually only adds a part
+  const SkippyM3UParts& known_parts = current->playlist.parts;
+  const SkippyM3UParts& loaded_parts = loaded_playlist.parts;
+  bool parts_changed = known_parts.size() != loaded_parts.size() || (!loaded_parts.empty()
+    && (known_parts.back().index != loaded_playlist.sequenceNo + loaded_parts.back().index || known_parts.back().partNo != loaded_parts.back().partNo));
+
+  next->changed = replace || evicted || updated || known < listed || parts_changed;
+
+  // Take over the header, the variants don't change
+  store->setFirstSequenceNo (loaded_playlist.sequenceNo);
+  loaded_items.clear();
+  skippy_m3u8_client_resolve_parts (loaded_playlist);
+  next->playlist = std::move (loaded_playlist);
+  next->playlist.totalDuration = store->endTime();
+  next->store = store;
+  next->master = current->master;
+  if (current->store->empty()) {
+    position = skippy_m3u8_client_start_position (*next, part);
+  }
+  return next;
+}
+
+// Parsed media playlists shared by all clients, to start faster when the same stream gets played again.
+// Keyed by resource path: signed URIs of the same playlist differ in their query only.
+struct SkippyM3U8SnapshotCache
+{
+  enum {
+    MAX_ENTRIES = 16,
+    MAX_BYTES = 16 * 1024 * 1024,
+  };
+
+  struct Entry
+  {
+    string key;
+    SkippyM3U8SnapshotRef snapshot;
+    gint64 expires; // Wall clock time (microseconds)
+    size_t bytes;
+  };
+
+  SkippyM3U8SnapshotCache ()
+  :bytes(0)
+  {
+
+  }
+
+  mutex lock;
+  list<Entry> entries; // Most recently used first
+  unordered_map<string, list<Entry>::iterator> index;
+  size_t bytes;
+};
+
+static SkippyM3U8SnapshotCache snapshot_cache;
+
+// Playlists listed (finished) from this long on: only their signed URIs expire
+#define SNAPSHOT_CACHE_VOD_TTL (10 * 60 * G_USEC_PER_SEC)
+// Don't start on a playlist whose fragment URIs are about to expire
+#define SNAPSHOT_CACHE_EXPIRY_MARGIN (60 * G_USEC_PER_SEC)
+
+// Same equivalence as compare_uri_resource_path in the downloader: the URI without query (and fragment)
+static string skippy_m3u8_cache_key (const string& uri)
+{
+  return uri.substr (0, uri.find_first_of ("?#"));
+}
+
+// Expiry time of a signed URI ("Expires" query parameter, seconds since epoch) in microseconds, 0 if none
+static gint64 skippy_m3u8_uri_expiry (const string& uri)
+{
+  size_t query = uri.find ('?');
+  if (query == string::npos) {
+    return 0;
+  }
+  for (size_t pos = uri.find ("Expires=", query); pos != string::npos; pos = uri.find ("Expires=", pos + 1)) {
+    char delimiter = uri[pos - 1];
+    if (delimiter == '?' || delimiter == '&') {
+      return (gint64) strtoull (uri.c_str() + pos + strlen ("Expires="), NULL, 10) * G_USEC_PER_SEC;
+    }
+  }
+  return 0;
+}
+
+// Finished playlists are kept until their signed URIs expire, live ones for a target duration
+static gint64 skippy_m3u8_cache_expiry (const SkippyM3U8Snapshot& snapshot, gint64 now)
+{
+  gint64 expires;
+
+  if (snapshot.playlist.isComplete) {
+    expires = now + SNAPSHOT_CACHE_VOD_TTL;
+  } else {
+    expires = now + (gint64) (snapshot.playlist.targetDuration / 1000);
+  }
+
+  // The fragments are usually signed like the playlist
+  gint64 token_expiry = skippy_m3u8_uri_expiry (snapshot.playlist.uri);
+  if (!snapshot.store->empty()) {
+    gint64 fragment_expiry = skippy_m3u8_uri_expiry (snapshot.store->url (0));
+    if (fragment_expiry && (!token_expiry || fragment_expiry < token_expiry)) {
+      token_expiry = fragment_expiry;
+    }
+  }
+  if (token_expiry) {
+    expires = min (expires, token_expiry - SNAPSHOT_CACHE_EXPIRY_MARGIN);
+  }
+  return expires;
+}
+
+static void skippy_m3u8_cache_remove_locked (list<SkippyM3U8SnapshotCache::Entry>::iterator entry)
+{
+  snapshot_cache.bytes -= entry->bytes;
+  snapshot_cache.index.erase (entry->key);
+  snapshot_cache.entries.erase (entry);
+}
+
+static void skippy_m3u8_cache_put (const SkippyM3U8SnapshotRef& snapshot)
+{
+  gint64 now = g_get_real_time ();
+  gint64 expires = skippy_m3u8_cache_expiry (*snapshot, now);
+  size_t bytes = snapshot->store->memoryUsage();
+  string key = skippy_m3u8_cache_key (snapshot->playlist.uri);
+
+  lock_guard<mutex> lock(snapshot_cache.lock);
+
+  auto it = snapshot_cache.index.find (key);
+  if (it != snapshot_cache.index.end()) {
+    skippy_m3u8_cache_remove_locked (it->second);
+  }
+  if (expires <= now || bytes > SkippyM3U8SnapshotCache::MAX_BYTES) {
+    return;
+  }
+
+  snapshot_cache.entries.push_front (SkippyM3U8SnapshotCache::Entry { key, snapshot, expires, bytes });
+  snapshot_cache.index[key] = snapshot_cache.entries.begin();
+  snapshot_cache.bytes += bytes;
+
+  // Evict the least recently used
+  while (snapshot_cache.entries.size() > SkippyM3U8SnapshotCache::MAX_ENTRIES
+    || snapshot_cache.bytes > SkippyM3U8SnapshotCache::MAX_BYTES) {
+    skippy_m3u8_cache_remove_locked (--snapshot_cache.entries.end());
+  }
+}
+
+static SkippyM3U8SnapshotRef skippy_m3u8_cache_get (const string& uri)
+{
+  lock_guard<mutex> lock(snapshot_cache.lock);
+
+  auto it = snapshot_cache.index.find (skippy_m3u8_cache_key (uri));
+  if (it == snapshot_cache.index.end()) {
+    return SkippyM3U8SnapshotRef ();
+  }
+  if (it->second->expires <= g_get_real_time ()) {
+    skippy_m3u8_cache_remove_locked (it->second);
+    return SkippyM3U8SnapshotRef ();
+  }
+  snapshot_cache.entries.splice (snapshot_cache.entries.begin(), snapshot_cache.entries, it->second);
+  return snapshot_cache.entries.front().snapshot;
+}
+
+// Binary snapshot files of a media playlist, loaded without parsing any text:
+// this header, the playlist URI and type (padded to 8 bytes together) and the serialized item store.
+// 0x89 can't start a text playlist (it isn't valid UTF-8).
+#define SNAPSHOT_FILE_MAGIC "\x89SKM3U\r\n"
+#define SNAPSHOT_FILE_MAGIC_SIZE 8
+#define SNAPSHOT_FILE_VERSION 2 // 2: byte ranges
+#define SNAPSHOT_FILE_BYTE_ORDER 0x01020304
+
+struct SkippyM3U8SnapshotFileHeader
+{
+  char magic[SNAPSHOT_FILE_MAGIC_SIZE];
+  guint32 version;
+  guint32 byte_order; // Native order of the writer
+  guint64 playlist_version;
+  guint64 target_duration;
+  guint32 is_complete;
+  guint32 uri_length;
+  guint32 type_length;
+  guint32 reserved;
+};
+
+static bool skippy_m3u8_is_snapshot_data (const gchar* data, gsize size)
+{
+  return size >= SNAPSHOT_FILE_MAGIC_SIZE && memcmp (data, SNAPSHOT_FILE_MAGIC, SNAPSHOT_FILE_MAGIC_SIZE) == 0;
+}
+
+static void skippy_m3u8_snapshot_serialize (const SkippyM3U8Snapshot& snapshot, string& out)
+{
+  SkippyM3U8SnapshotFileHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, SNAPSHOT_FILE_MAGIC, SNAPSHOT_FILE_MAGIC_SIZE);
+  header.version = SNAPSHOT_FILE_VERSION;
+  header.byte_order = SNAPSHOT_FILE_BYTE_ORDER;
+  header.playlist_version = snapshot.playlist.version;
+  header.target_duration = snapshot.playlist.targetDuration;
+  header.is_complete = snapshot.playlist.isComplete;
+  header.uri_length = snapshot.playlist.uri.size();
+  header.type_length = snapshot.playlist.type.size();
+
+  out.append ((const char*) &header, sizeof (header));
+  out.append (snapshot.playlist.uri);
+  out.append (snapshot.playlist.type);
+  out.append ((8 - out.size() % 8) % 8, '\0');
+  snapshot.store->serialize (out);
+}
+
+// Returns NULL if the data is not a complete snapshot of the current version
+static shared_ptr<SkippyM3U8Snapshot> skippy_m3u8_snapshot_deserialize (const gchar* data, gsize size)
+{
+  SkippyM3U8SnapshotFileHeader header;
+
+  if (size < sizeof (header)) {
+    return NULL;
+  }
+  memcpy (&header, data, sizeof (header));
+  if (header.version != SNAPSHOT_FILE_VERSION || header.byte_order != SNAPSHOT_FILE_BYTE_ORDER) {
+    GST_WARNING ("Playlist snapshot has version %u (byte order %x), expected %u", header.version, header.byte_order, SNAPSHOT_FILE_VERSION);
+    return NULL;
+  }
+
+  gsize strings_size = sizeof (header) + (gsize) header.uri_length + header.type_length;
+  gsize store_offset = (strings_size + 7) & ~(gsize) 7;
+  if (store_offset > size) {
     return NULL;
   }
 
-  // We make the copy before the validation to exclude any
-  // possibility of the validator mutating the data in some way
-  /* alloc size + 1 to end with a null character */
-  playlist = (gchar*) g_malloc0 (info.size + 1);
-  memcpy (playlist, info.data, info.size);
+  shared_ptr<SkippyM3UItemStore> store = make_shared<SkippyM3UItemStore>();
+  if (!store->deserialize (data + store_offset, size - store_offset)) {
+    return NULL;
+  }
+
+  shared_ptr<SkippyM3U8Snapshot> snapshot = make_shared<SkippyM3U8Snapshot>();
+  snapshot->store = store;
+
+  SkippyM3UPlaylist& playlist = snapshot->playlist;
+  playlist.uri.assign (data + sizeof (header), header.uri_length);
+  playlist.type.assign (data + sizeof (header) + header.uri_length, header.type_length);
+  playlist.version = header.playlist_version;
+  playlist.targetDuration = header.target_duration;
+  playlist.isComplete = header.is_complete;
+  playlist.sequenceNo = snapshot->store->firstSequenceNo();
+  playlist.totalDuration = snapshot->store->endTime();
+  return snapshot;
+}
+
+// Replaces the model with the snapshot in the data (the playlist URI is the one the snapshot was taken from).
+// Client mutex must be locked.
+static SkippyHlsInternalError skippy_m3u8_client_load_snapshot_locked (SkippyM3U8Client * client, const gchar* data, gsize size, GstBuffer* playlist_buffer)
+{
+  shared_ptr<SkippyM3U8Snapshot> next = skippy_m3u8_snapshot_deserialize (data, size);
+  if (!next) {
+    GST_ERROR ("Invalid playlist snapshot data (%d bytes)", (int) size);
+    return PLAYLIST_INCOMPLETE;
+  }
+
+  GST_DEBUG ("Loaded playlist snapshot of %s with %d items", next->playlist.uri.c_str(), (int) next->store->size());
+
+  next->master = skippy_m3u8_client_get_snapshot (client)->master;
+  gst_buffer_replace (&client->priv->playlist_raw, playlist_buffer);
+  g_free (client->priv->playlist_raw_string);
+  client->priv->playlist_raw_string = NULL;
+
+  // Cursor is set once the snapshot is published (see skippy_m3u8_client_update_playlist_locked)
+  guint part;
+  guint64 position = skippy_m3u8_client_start_position (*next, part);
+  skippy_m3u8_client_publish_snapshot_locked (client, next);
+  client->priv->position = position;
+  client->priv->part = part;
+  return NO_ERROR;
+}
 
-  GST_DEBUG ("\n\n\nM3U8 data dump:\n\n%s\n\n", playlist);
+gboolean skippy_m3u8_client_save_playlist_snapshot (SkippyM3U8Client * client, const gchar* path)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  GError* err = NULL;
+  string data;
+
+  if (snapshot->store->empty()) {
+    return FALSE;
+  }
+  skippy_m3u8_snapshot_serialize (*snapshot, data);
+
+  // Written to a temporary file and renamed: a reader never sees a partial snapshot
+  if (!g_file_set_contents (path, data.data(), data.size(), &err)) {
+    GST_WARNING ("Failed to save playlist snapshot to %s: %s", path, err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+  GST_DEBUG ("Saved playlist snapshot of %d items (%d bytes) to %s", (int) snapshot->store->size(), (int) data.size(), path);
+  return TRUE;
+}
+
+// Moves a cursor that is outside of the new window to its closest end (the cursor may be moved concurrently)
+static void skippy_m3u8_client_clamp_position (SkippyM3U8Client * client, const SkippyM3U8Snapshot& snapshot)
+{
+  guint64 position = client->priv->position;
+  guint64 clamped;
+  do {
+    clamped = snapshot.store->firstSequenceNo() + skippy_m3u8_client_get_index (snapshot, position);
+  } while (clamped != position && !client->priv->position.compare_exchange_weak (position, clamped));
+  if (clamped != position) {
+    client->priv->part = 0;
+  }
+}
 
-  if (!g_utf8_validate ((const gchar *) info.data, info.size, NULL)) {
+// Keeps a reference on the playlist buffer as raw data. Client mutex must be locked.
+static SkippyHlsInternalError skippy_m3u8_client_update_playlist_locked (SkippyM3U8Client * client, SkippyM3UPlaylist& loaded_playlist, GstBuffer* playlist_buffer)
+{
+  // The parser validated the data while parsing it
+  if (!client->priv->parser.isValidUtf8()) {
     GST_ERROR ("M3U8 was not valid UTF-8 data");
-    gst_buffer_unmap (buf, &info);
-    g_free (playlist);
-    return NULL;
+    return PLAYLIST_INVALID_UTF_CONTENT;
+  }
+
+  //update raw playlist
+  gst_buffer_replace (&client->priv->playlist_raw, playlist_buffer);
+  g_free (client->priv->playlist_raw_string);
+  client->priv->playlist_raw_string = NULL;
+
+  // Master playlists don't have an end tag: the media playlist is loaded later from one of the variants
+  if (!client->priv->parser.masterPlaylist().items.empty()) {
+    // Keeps sharing the items
+    shared_ptr<SkippyM3U8Snapshot> next = make_shared<SkippyM3U8Snapshot>(*skippy_m3u8_client_get_snapshot (client));
+    skippy_m3u8_client_update_variants (*next, client->priv->parser.masterPlaylist(), loaded_playlist.uri);
+    skippy_m3u8_client_publish_snapshot_locked (client, std::move (next));
+    return NO_ERROR;
   }
 
-  gst_buffer_unmap (buf, &info);
-  return playlist;
+  // Without end tag the playlist is live. Unless it has no items, says it's VOD or was complete before:
+  // then the data was cut off.
+  if (!loaded_playlist.isComplete) {
+    SkippyM3U8SnapshotRef current = skippy_m3u8_client_get_snapshot (client);
+    if (loaded_playlist.items.empty() || g_ascii_strcasecmp (loaded_playlist.type.c_str(), "VOD") == 0
+      || (current->playlist.isComplete && loaded_playlist.sequenceNo >= current->playlist.sequenceNo)) {
+      return PLAYLIST_INCOMPLETE;
+    }
+  }
+
+  // Delta updates only work on top of the segments they skip
+  if (loaded_playlist.skippedSegments) {
+    SkippyM3U8SnapshotRef current = skippy_m3u8_client_get_snapshot (client);
+    const SkippyM3UItemStore& store = *current->store;
+    if (store.empty() || loaded_playlist.sequenceNo < store.firstSequenceNo()
+      || loaded_playlist.sequenceNo + loaded_playlist.skippedSegments > store.firstSequenceNo() + store.size()) {
+      GST_WARNING ("Delta update skips segments %" G_GUINT64_FORMAT " to %" G_GUINT64_FORMAT " that we don't have",
+        loaded_playlist.sequenceNo, loaded_playlist.sequenceNo + loaded_playlist.skippedSegments);
+      client->priv->delta_unusable = true;
+      return PLAYLIST_DELTA_UNUSABLE;
+    }
+  } else {
+    client->priv->delta_unusable = false;
+  }
+  client->priv->updated_at = g_get_monotonic_time ();
+
+  bool moved = false;
+  guint64 position = 0;
+  guint part = 0;
+  shared_ptr<SkippyM3U8Snapshot> next = skippy_m3u8_client_merge_playlist_locked (client, loaded_playlist, moved, position, part);
+
+  // Readers may pair the new snapshot with the old cursor in between, which they clamp to the window
+  skippy_m3u8_client_publish_snapshot_locked (client, next);
+  if (moved) {
+    client->priv->position = position;
+    client->priv->part = part;
+  } else {
+    skippy_m3u8_client_clamp_position (client, *next);
+  }
+  skippy_m3u8_cache_put (next);
+  return NO_ERROR;
+}
+
+gboolean skippy_m3u8_client_load_cached_playlist (SkippyM3U8Client * client, const gchar *uri)
+{
+  SkippyM3U8SnapshotRef cached = skippy_m3u8_cache_get (uri);
+  if (!cached) {
+    return FALSE;
+  }
+
+  GST_DEBUG ("Loaded playlist with %d items from cache for %s", (int) cached->store->size(), uri);
+
+  // The items are shared with the cached snapshot, the variants stay those of this client
+  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  shared_ptr<SkippyM3U8Snapshot> next = make_shared<SkippyM3U8Snapshot>(*cached);
+  next->master = skippy_m3u8_client_get_snapshot (client)->master;
+  guint part;
+  guint64 position = skippy_m3u8_client_start_position (*next, part);
+  skippy_m3u8_client_publish_snapshot_locked (client, next);
+  client->priv->position = position;
+  client->priv->part = part;
+  return TRUE;
 }
 
 // Update/set/identify variant (sub-) playlist by URIs advertised in master playlist
 SkippyHlsInternalError skippy_m3u8_client_load_playlist (SkippyM3U8Client * client, const gchar *uri, GstBuffer* playlist_buffer)
 {
-  SkippyM3UParser p;
-  gchar* playlist = buf_to_utf8_playlist (playlist_buffer);
-    
-  if (!playlist) {
+  GstMapInfo info;
+
+  // Validated and parsed in place, without copying
+  if (!gst_buffer_map (playlist_buffer, &info, GST_MAP_READ)) {
     return PLAYLIST_INVALID_UTF_CONTENT;
   }
+
+  if (skippy_m3u8_is_snapshot_data ((const gchar*) info.data, info.size)) {
+    lock_guard<recursive_mutex> lock(client->priv->mutex);
+    SkippyHlsInternalError result = skippy_m3u8_client_load_snapshot_locked (client, (const gchar*) info.data, info.size, playlist_buffer);
+    gst_buffer_unmap (playlist_buffer, &info);
+    client->priv->feeding = false;
+    return result;
+  }
+
+  GST_LOG ("\n\n\nM3U8 data dump:\n\n%.*s\n\n", (int) info.size, (const gchar*) info.data);
+
   {
     lock_guard<recursive_mutex> lock(client->priv->mutex);
-    string loaded_playlist_uri = (uri != NULL) ? uri : client->priv->playlist.uri;
-    SkippyM3UPlaylist loaded_playlist = p.parse(loaded_playlist_uri, playlist);
-    
-    //update raw playlist
-    g_free (client->priv->playlist_raw);
-    client->priv->playlist_raw = playlist;
-    
-    if (!loaded_playlist.isComplete) {
-      return PLAYLIST_INCOMPLETE;
-    }
-    
-    client->priv->playlist = loaded_playlist;
-    return NO_ERROR;
+    string loaded_playlist_uri = (uri != NULL) ? uri : skippy_m3u8_client_get_snapshot (client)->playlist.uri;
+    SkippyM3UPlaylist loaded_playlist = client->priv->parser.parse(loaded_playlist_uri, (const char*) info.data, info.size);
+    gst_buffer_unmap (playlist_buffer, &info);
+    client->priv->feeding = false;
+    return skippy_m3u8_client_update_playlist_locked (client, loaded_playlist, playlist_buffer);
   }
 }
 
-gchar* skippy_m3u8_client_get_current_raw_data (SkippyM3U8Client * client) {
+void skippy_m3u8_client_begin_playlist (SkippyM3U8Client * client)
+{
   lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return client->priv->playlist_raw;
+  // Any previously unfinished incremental load gets discarded here
+  client->priv->parser.begin("");
+  client->priv->feeding = true;
 }
 
-// Called to get the next fragment
-SkippyFragment* skippy_m3u8_client_get_fragment (SkippyM3U8Client * client, guint64 sequence_number)
+void skippy_m3u8_client_feed_playlist (SkippyM3U8Client * client, const gchar *data, gsize size)
 {
   lock_guard<recursive_mutex> lock(client->priv->mutex);
+  if (!client->priv->feeding) {
+    GST_WARNING ("Got playlist data without beginning an incremental load");
+    return;
+  }
+  client->priv->parser.feed(data, size);
+  GST_TRACE ("Fed %d bytes of playlist data, %d items complete so far", (int) size,
+    (int) client->priv->parser.playlist().items.size());
+}
 
-  SkippyFragment *fragment;
-  SkippyM3UItem item;
+// The data has been validated and parsed while it was fed already
+SkippyHlsInternalError skippy_m3u8_client_end_playlist (SkippyM3U8Client * client, const gchar *uri, GstBuffer* playlist_buffer)
+{
+  lock_guard<recursive_mutex> lock(client->priv->mutex);
+
+  // Nothing was fed, or a binary snapshot (the parser stopped on its first byte): load the whole buffer at once
+  if (!client->priv->feeding
+    || gst_buffer_memcmp (playlist_buffer, 0, SNAPSHOT_FILE_MAGIC, SNAPSHOT_FILE_MAGIC_SIZE) == 0) {
+    client->priv->feeding = false;
+    return skippy_m3u8_client_load_playlist (client, uri, playlist_buffer);
+  }
+  client->priv->feeding = false;
+
+  SkippyM3UPlaylist loaded_playlist = client->priv->parser.finish();
+  loaded_playlist.uri = (uri != NULL) ? uri : skippy_m3u8_client_get_snapshot (client)->playlist.uri;
+  return skippy_m3u8_client_update_playlist_locked (client, loaded_playlist, playlist_buffer);
+}
+
+// Only used for error reports: the string is created on the first call after a load
+gchar* skippy_m3u8_client_get_current_raw_data (SkippyM3U8Client * client) {
+  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  GstMapInfo info;
+
+  if (!client->priv->playlist_raw_string && client->priv->playlist_raw
+    && gst_buffer_map (client->priv->playlist_raw, &info, GST_MAP_READ)) {
+    client->priv->playlist_raw_string = g_strndup ((const gchar*) info.data, info.size);
+    gst_buffer_unmap (client->priv->playlist_raw, &info);
+  }
+  return client->priv->playlist_raw_string;
+}
+
+// Descriptor with its storage. The snapshot reference keeps the playlist URI alive,
+// the URL is built into uri_storage whose capacity is kept when the descriptor is recycled.
+struct SkippyM3U8PooledFragment : SkippyM3U8FragmentDescriptor
+{
+  atomic<int> refcount;
+  string uri_storage;
+  SkippyM3U8SnapshotRef snapshot;
+};
+
+// Released descriptors, shared by all clients
+struct SkippyM3U8FragmentPool
+{
+  enum { MAX_FREE = 8 };
+
+  ~SkippyM3U8FragmentPool ()
+  {
+    for (SkippyM3U8PooledFragment* fragment : free_fragments) {
+      delete fragment;
+    }
+  }
+
+  mutex lock;
+  vector<SkippyM3U8PooledFragment*> free_fragments;
+};
+
+static SkippyM3U8FragmentPool fragment_pool;
+
+// Takes count descriptors at once
+static void skippy_m3u8_fragment_pool_take (SkippyM3U8FragmentDescriptor** fragments, size_t count)
+{
+  size_t taken = 0;
+  {
+    lock_guard<mutex> lock(fragment_pool.lock);
+    while (taken < count && !fragment_pool.free_fragments.empty()) {
+      fragments[taken++] = fragment_pool.free_fragments.back();
+      fragment_pool.free_fragments.pop_back();
+    }
+  }
+  for (; taken < count; taken++) {
+    fragments[taken] = new SkippyM3U8PooledFragment();
+  }
+}
+
+static void skippy_m3u8_fragment_pool_give (SkippyM3U8PooledFragment* fragment)
+{
+  // Don't keep a playlist alive from the pool
+  fragment->snapshot.reset();
+  {
+    lock_guard<mutex> lock(fragment_pool.lock);
+    if (fragment_pool.free_fragments.size() < SkippyM3U8FragmentPool::MAX_FREE) {
+      fragment_pool.free_fragments.push_back(fragment);
+      return;
+    }
+  }
+  delete fragment;
+}
+
+// Fills descriptors for count items from index on (which must be in the snapshot)
+static void skippy_m3u8_client_acquire_fragments_at (const SkippyM3U8SnapshotRef& snapshot, size_t index, size_t count, SkippyM3U8FragmentDescriptor** descriptors)
+{
+  const SkippyM3UItemStore& store = *snapshot->store;
+  skippy_m3u8_fragment_pool_take (descriptors, count);
+
+  GstClockTime start_time = NANOSECONDS_TO_GST_TIME (store.start (index));
+  for (size_t i = 0; i < count; i++) {
+    SkippyM3U8PooledFragment* fragment = static_cast<SkippyM3U8PooledFragment*> (descriptors[i]);
+    fragment->refcount = 1;
+    store.url (index + i, fragment->uri_storage);
+    fragment->uri = fragment->uri_storage.c_str();
+    fragment->playlist_uri = snapshot->playlist.uri.c_str();
+    fragment->sequence_number = store.firstSequenceNo() + index + i;
+    // Consecutive items: no need to look up each start time
+    fragment->start_time = start_time;
+    fragment->duration = NANOSECONDS_TO_GST_TIME (store.duration (index + i));
+    fragment->stop_time = start_time + fragment->duration;
+    fragment->range_start = store.rangeStart (index + i);
+    fragment->range_end = store.rangeEnd (index + i);
+    fragment->part_index = -1;
+    fragment->snapshot = snapshot;
+    start_time = fragment->stop_time;
+  }
+}
+
+static SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_fragment_at (const SkippyM3U8SnapshotRef& snapshot, size_t index)
+{
+  SkippyM3U8FragmentDescriptor* descriptor;
 
-  if (sequence_number >= client->priv->playlist.items.size()) {
+  if (index >= snapshot->store->size()) {
     return NULL;
   }
+  skippy_m3u8_client_acquire_fragments_at (snapshot, index, 1, &descriptor);
+  return descriptor;
+}
+
+// Listed partial segment, NULL if there is none
+static const SkippyM3UPart* skippy_m3u8_client_find_part (const SkippyM3U8Snapshot& snapshot, guint64 sequence_number, guint part)
+{
+  for (const SkippyM3UPart& candidate : snapshot.playlist.parts) {
+    if (candidate.index == sequence_number && candidate.partNo == part) {
+      return &candidate;
+    }
+  }
+  return NULL;
+}
 
-  item = client->priv->playlist.items.at (sequence_number);
+// Resolves the cursor to the index of its item and the part to play, NULL to play the item whole.
+// An item is played by parts only once we started to (at the live edge, before it was complete):
+// then it continues with its next listed part, or with the next item once there are no more parts.
+static size_t skippy_m3u8_client_resolve_cursor (const SkippyM3U8Snapshot& snapshot, guint64 position, guint part, const SkippyM3UPart** part_entry)
+{
+  const SkippyM3UItemStore& store = *snapshot.store;
+  size_t index = skippy_m3u8_client_get_index (snapshot, position);
 
-  fragment = skippy_fragment_new (item.url.c_str());
-  fragment->start_time = NANOSECONDS_TO_GST_TIME (item.start);
-  fragment->stop_time = NANOSECONDS_TO_GST_TIME (item.end);
-  fragment->duration = NANOSECONDS_TO_GST_TIME (item.duration);
-  return fragment;
+  *part_entry = NULL;
+  if (part == 0 && index < store.size()) {
+    return index;
+  }
+  *part_entry = skippy_m3u8_client_find_part (snapshot, store.firstSequenceNo() + index, part);
+  if (!*part_entry && index < store.size()) {
+    index++;
+    if (index == store.size()) {
+      *part_entry = skippy_m3u8_client_find_part (snapshot, store.firstSequenceNo() + index, 0);
+    }
+  }
+  return index;
 }
 
-SkippyFragment* skippy_m3u8_client_get_current_fragment (SkippyM3U8Client * client)
+// Partial segment of the item at index (which may not be listed yet when it is the one after the last)
+static SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_part_at (const SkippyM3U8SnapshotRef& snapshot, size_t index, const SkippyM3UPart& part)
+{
+  const SkippyM3UItemStore& store = *snapshot->store;
+  SkippyM3U8FragmentDescriptor* descriptor;
+  uint64_t start = index < store.size() ? store.start (index) : store.endTime();
+
+  // Parts are listed in order: the ones before this one of the same item give its offset
+  for (const SkippyM3UPart& previous : snapshot->playlist.parts) {
+    if (&previous == &part) {
+      break;
+    }
+    if (previous.index == part.index) {
+      start += previous.duration;
+    }
+  }
+
+  skippy_m3u8_fragment_pool_take (&descriptor, 1);
+  SkippyM3U8PooledFragment* fragment = static_cast<SkippyM3U8PooledFragment*> (descriptor);
+  fragment->refcount = 1;
+  fragment->uri_storage = part.url;
+  fragment->uri = fragment->uri_storage.c_str();
+  fragment->playlist_uri = snapshot->playlist.uri.c_str();
+  fragment->sequence_number = part.index;
+  fragment->start_time = NANOSECONDS_TO_GST_TIME (start);
+  fragment->duration = NANOSECONDS_TO_GST_TIME (part.duration);
+  fragment->stop_time = fragment->start_time + fragment->duration;
+  fragment->range_start = 0;
+  fragment->range_end = -1;
+  fragment->part_index = (gint) part.partNo;
+  fragment->snapshot = snapshot;
+  return descriptor;
+}
+
+SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_current_fragment (SkippyM3U8Client * client)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UPart* part;
+  size_t index = skippy_m3u8_client_resolve_cursor (*snapshot, client->priv->position, client->priv->part, &part);
+
+  if (part) {
+    return skippy_m3u8_client_acquire_part_at (snapshot, index, *part);
+  }
+  return skippy_m3u8_client_acquire_fragment_at (snapshot, index);
+}
+
+SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_fragment (SkippyM3U8Client * client, guint64 index)
+{
+  return skippy_m3u8_client_acquire_fragment_at (skippy_m3u8_client_get_snapshot (client), (size_t) index);
+}
+
+SkippyM3U8FragmentDescriptor* skippy_m3u8_fragment_descriptor_ref (SkippyM3U8FragmentDescriptor* descriptor)
+{
+  static_cast<SkippyM3U8PooledFragment*> (descriptor)->refcount++;
+  return descriptor;
+}
+
+void skippy_m3u8_fragment_descriptor_unref (SkippyM3U8FragmentDescriptor* descriptor)
+{
+  SkippyM3U8PooledFragment* fragment = static_cast<SkippyM3U8PooledFragment*> (descriptor);
+  if (--fragment->refcount == 0) {
+    skippy_m3u8_fragment_pool_give (fragment);
+  }
+}
+
+// GObject wrapper for the public API
+static SkippyFragment* skippy_m3u8_fragment_new_from_descriptor (SkippyM3U8FragmentDescriptor* descriptor)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  
   SkippyFragment *fragment;
-  SkippyM3UItem item;
-  
-  if (client->priv->current_index >= client->priv->playlist.items.size()) {
+
+  if (!descriptor) {
     return NULL;
   }
-  
-  item = client->priv->playlist.items.at (client->priv->current_index);
-  
-  fragment = skippy_fragment_new (item.url.c_str());
-  fragment->start_time = NANOSECONDS_TO_GST_TIME (item.start);
-  fragment->stop_time = NANOSECONDS_TO_GST_TIME (item.end);
-  fragment->duration = NANOSECONDS_TO_GST_TIME (item.duration);
+
+  fragment = skippy_fragment_new (descriptor->uri);
+  fragment->start_time = descriptor->start_time;
+  fragment->duration = descriptor->duration;
+  fragment->stop_time = descriptor->stop_time;
+  fragment->range_start = descriptor->range_start;
+  fragment->range_end = descriptor->range_end;
+  skippy_m3u8_fragment_descriptor_unref (descriptor);
   return fragment;
 }
 
-void skippy_m3u8_client_advance_to_next_fragment (SkippyM3U8Client * client)
+static SkippyM3U8Lookahead* skippy_m3u8_lookahead_new (const SkippyM3U8SnapshotRef& snapshot, size_t index, size_t count)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  SkippyM3U8Lookahead* lookahead = g_slice_new0 (SkippyM3U8Lookahead);
 
-  if (client->priv->current_index < client->priv->playlist.items.size()) {
-    client->priv->current_index++;
+  lookahead->n_fragments = (guint) count;
+  lookahead->fragments = g_new (SkippyM3U8FragmentDescriptor*, count);
+  lookahead->cumulative_durations = g_new (GstClockTime, count);
+  skippy_m3u8_client_acquire_fragments_at (snapshot, index, count, lookahead->fragments);
+
+  GstClockTime total = 0;
+  for (size_t i = 0; i < count; i++) {
+    const SkippyM3U8FragmentDescriptor* fragment = lookahead->fragments[i];
+    total += fragment->duration;
+    lookahead->cumulative_durations[i] = total;
+    if (fragment->range_end >= 0) {
+      lookahead->known_bytes += fragment->range_end - fragment->range_start;
+    } else {
+      lookahead->n_unknown_sizes++;
+    }
   }
+  return lookahead;
 }
 
-gboolean skippy_m3u8_client_seek_to (SkippyM3U8Client * client, GstClockTime target)
+SkippyM3U8Lookahead* skippy_m3u8_client_lookahead (SkippyM3U8Client * client, guint max_fragments)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  size_t index = skippy_m3u8_client_get_index (*snapshot, client->priv->position);
+  size_t count = min<size_t> (max_fragments, snapshot->store->size() - index);
+
+  return skippy_m3u8_lookahead_new (snapshot, index, count);
+}
+
+SkippyM3U8Lookahead* skippy_m3u8_client_lookahead_window (SkippyM3U8Client * client, GstClockTime start, GstClockTime stop)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UItemStore& store = *snapshot->store;
+  guint64 start_ns = (guint64) GST_TIME_AS_NSECONDS (start);
+  guint64 stop_ns = (guint64) GST_TIME_AS_NSECONDS (stop);
+  size_t first, last;
+  guint64 item_start;
+
+  // A window starting before the playlist starts with its first item
+  if (store.empty() || start_ns < store.start (0)) {
+    first = 0;
+  } else {
+    first = store.find (start_ns);
+  }
+
+  // Start times of the following items are summed up from the first one
+  item_start = first < store.size() ? store.start (first) : 0;
+  for (last = first; last < store.size() && item_start < stop_ns; last++) {
+    item_start += store.duration (last);
+  }
 
-  SkippyM3UItem item;
+  return skippy_m3u8_lookahead_new (snapshot, first, last - first);
+}
+
+void skippy_m3u8_lookahead_free (SkippyM3U8Lookahead* lookahead)
+{
+  for (guint i = 0; i < lookahead->n_fragments; i++) {
+    skippy_m3u8_fragment_descriptor_unref (lookahead->fragments[i]);
+  }
+  g_free (lookahead->fragments);
+  g_free (lookahead->cumulative_durations);
+  g_slice_free (SkippyM3U8Lookahead, lookahead);
+}
+
+// Called to get the next fragment
+SkippyFragment* skippy_m3u8_client_get_fragment (SkippyM3U8Client * client, guint64 sequence_number)
+{
+  return skippy_m3u8_fragment_new_from_descriptor (skippy_m3u8_client_acquire_fragment (client, sequence_number));
+}
+
+SkippyFragment* skippy_m3u8_client_get_current_fragment (SkippyM3U8Client * client)
+{
+  return skippy_m3u8_fragment_new_from_descriptor (skippy_m3u8_client_acquire_current_fragment (client));
+}
+
+void skippy_m3u8_client_advance_to_next_fragment (SkippyM3U8Client * client)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  guint64 position = client->priv->position;
+  guint64 next;
+  guint part, next_part;
+  const SkippyM3UPart* current_part;
+  size_t index;
+
+  // Retried if the cursor was moved meanwhile (e.g a seek)
+  do {
+    part = client->priv->part;
+    index = skippy_m3u8_client_resolve_cursor (*snapshot, position, part, &current_part);
+    if (current_part) {
+      next = current_part->index;
+      next_part = (guint) current_part->partNo + 1;
+    } else if (index < snapshot->store->size()) {
+      next = snapshot->store->firstSequenceNo() + index + 1;
+      next_part = 0;
+    } else {
+      return;
+    }
+  } while (!client->priv->position.compare_exchange_weak (position, next));
+  client->priv->part = next_part;
+}
+
+gboolean skippy_m3u8_client_seek_to (SkippyM3U8Client * client, GstClockTime target)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UItemStore& store = *snapshot->store;
   guint64 target_pos = (guint64) GST_TIME_AS_NSECONDS(target);
 
   GST_LOG ("Seek to target: %" GST_TIME_FORMAT " ns", GST_TIME_ARGS(GST_NSECOND * target_pos));
 
-  for (int i=0;i<client->priv->playlist.items.size();i++) {
-    item = client->priv->playlist.items.at(i);
-    if (target_pos >= item.start && target_pos < item.end)
-    {
-      GST_LOG ("Seeked to index %d, interval %ld - %ld", i, (long) item.start, (long) item.end);
-      client->priv->current_index = i;
-      return TRUE;
-    }
+  size_t index = store.find (target_pos);
+  if (index == store.size()) {
+    return FALSE;
+  }
+
+  GST_LOG ("Seeked to index %d, interval %ld - %ld", (int) index, (long) store.start (index), (long) store.end (index));
+  client->priv->position = store.firstSequenceNo() + index;
+  client->priv->part = 0;
+  return TRUE;
+}
+
+gboolean skippy_m3u8_client_seek_to_sequence_number (SkippyM3U8Client * client, guint64 media_sequence_number)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+
+  size_t index;
+  if (!snapshot->store->indexOf (media_sequence_number, index)) {
+    GST_DEBUG ("Media sequence number %" G_GUINT64_FORMAT " is not in the playlist window", media_sequence_number);
+    return FALSE;
   }
-  return FALSE;
+  client->priv->position = media_sequence_number;
+  client->priv->part = 0;
+  return TRUE;
+}
+
+guint64 skippy_m3u8_client_get_current_sequence_number (SkippyM3U8Client * client)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  return snapshot->store->firstSequenceNo() + skippy_m3u8_client_get_index (*snapshot, client->priv->position);
 }
 
 gchar* skippy_m3u8_client_get_uri(SkippyM3U8Client * client)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return g_strdup(client->priv->playlist.uri.c_str());
+  return g_strdup(skippy_m3u8_client_get_snapshot (client)->playlist.uri.c_str());
+}
+
+static bool compare_bitrate_to_variant (guint bitrate, const SkippyM3UPlaylist& variant)
+{
+  return bitrate / 1000 < variant.bandwidthKbps;
 }
 
+// Returns the variant with the highest bandwidth that does not exceed the bitrate (bits per second),
+// or the lowest variant if none does. NULL when we have no master playlist.
 gchar* skippy_m3u8_client_get_playlist_for_bitrate (SkippyM3U8Client * client, guint bitrate)
 {
-  //lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return NULL;
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UMasterPlaylistItems& variants = snapshot->master->items;
+
+  if (variants.empty()) {
+    return NULL;
+  }
+
+  SkippyM3UMasterPlaylistItems::const_iterator it = upper_bound (variants.begin(), variants.end(), bitrate, compare_bitrate_to_variant);
+  if (it != variants.begin()) {
+    it--;
+  }
+
+  GST_DEBUG ("Selected variant of %d kbps for bitrate %u: %s", (int) it->bandwidthKbps, bitrate, it->uri.c_str());
+  return g_strdup(it->uri.c_str());
 }
 
 gchar *skippy_m3u8_client_get_current_playlist (SkippyM3U8Client * client)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return g_strdup(client->priv->playlist.uri.c_str());
+  return g_strdup(skippy_m3u8_client_get_snapshot (client)->playlist.uri.c_str());
 }
 
+// The items of the variant get loaded with the next playlist refresh
 void skippy_m3u8_client_set_current_playlist (SkippyM3U8Client * client, const gchar *uri)
 {
-  //lock_guard<recursive_mutex> lock(client->priv->mutex);
+  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  // Only the header is copied, the items and variants are shared
+  shared_ptr<SkippyM3U8Snapshot> next = make_shared<SkippyM3U8Snapshot>(*skippy_m3u8_client_get_snapshot (client));
+  next->playlist.uri = uri;
+  skippy_m3u8_client_publish_snapshot_locked (client, std::move (next));
 }
 
 GstClockTime skippy_m3u8_client_get_total_duration (SkippyM3U8Client * client)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return NANOSECONDS_TO_GST_TIME (client->priv->playlist.totalDuration);
+  return NANOSECONDS_TO_GST_TIME (skippy_m3u8_client_get_snapshot (client)->playlist.totalDuration);
 }
 
 GstClockTime skippy_m3u8_client_get_target_duration (SkippyM3U8Client * client)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return NANOSECONDS_TO_GST_TIME (client->priv->playlist.targetDuration);
+  return NANOSECONDS_TO_GST_TIME (skippy_m3u8_client_get_snapshot (client)->playlist.targetDuration);
 }
 
 gboolean skippy_m3u8_client_has_variant_playlist(SkippyM3U8Client * client)
 {
-  //lock_guard<recursive_mutex> lock(client->priv->mutex);
-  return FALSE;
+  return !skippy_m3u8_client_get_snapshot (client)->master->items.empty();
 }
 
+// Media playlists without end tag (EVENT playlists and sliding windows) are live
 gboolean skippy_m3u8_client_is_live(SkippyM3U8Client * client)
 {
-  lock_guard<recursive_mutex> lock(client->priv->mutex);
-  if (client->priv->playlist.type == "event") {
-    return TRUE;
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  return !snapshot->store->empty() && !snapshot->playlist.isComplete;
+}
+
+GstClockTime skippy_m3u8_client_get_reload_interval (SkippyM3U8Client * client)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UPlaylist& playlist = snapshot->playlist;
+  // Playlists with partial segments change with each part
+  GstClockTime target_duration = NANOSECONDS_TO_GST_TIME (playlist.partTargetDuration ? playlist.partTargetDuration : playlist.targetDuration);
+
+  if (snapshot->store->empty() || playlist.isComplete) {
+    return GST_CLOCK_TIME_NONE;
   }
-  // Defaults to "vod"
-  return FALSE;
+  // HLS spec, section 6.3.4: wait half a target duration after a reload that didn't change the playlist
+  return snapshot->changed ? target_duration : target_duration / 2;
+}
+
+gboolean skippy_m3u8_client_get_blocking_reload_params (SkippyM3U8Client * client, guint64* media_sequence_number, gint* part)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UPlaylist& playlist = snapshot->playlist;
+  const SkippyM3UItemStore& store = *snapshot->store;
+  guint64 next_sequence_number = store.firstSequenceNo() + store.size();
+
+  if (store.empty() || playlist.isComplete || !playlist.canBlockReload) {
+    return FALSE;
+  }
+
+  // The part after the last listed one, or the segment after the last one
+  if (!playlist.parts.empty()) {
+    const SkippyM3UPart& last = playlist.parts.back();
+    if (last.index == next_sequence_number) {
+      *media_sequence_number = last.index;
+      *part = (gint) last.partNo + 1;
+    } else {
+      *media_sequence_number = next_sequence_number;
+      *part = 0;
+    }
+  } else {
+    *media_sequence_number = next_sequence_number;
+    *part = -1;
+  }
+  return TRUE;
+}
+
+// HLS spec, section 6.2.5.1: only with a playlist no older than half of the skip boundary
+gboolean skippy_m3u8_client_can_request_delta_update (SkippyM3U8Client * client)
+{
+  SkippyM3U8SnapshotRef snapshot = skippy_m3u8_client_get_snapshot (client);
+  const SkippyM3UPlaylist& playlist = snapshot->playlist;
+  gint64 max_age = (gint64) GST_TIME_AS_USECONDS (NANOSECONDS_TO_GST_TIME (playlist.canSkipUntil) / 2);
+
+  if (snapshot->store->empty() || playlist.isComplete || !playlist.canSkipUntil) {
+    return FALSE;
+  }
+  lock_guard<recursive_mutex> lock(client->priv->mutex);
+  return !client->priv->delta_unusable && client->priv->updated_at
+    && g_get_monotonic_time () - client->priv->updated_at < max_age;
 }
 
 gboolean skippy_m3u8_client_is_caching_allowed(SkippyM3U8Client * client)
@@ -37,19 +37,68 @@ typedef struct _SkippyM3U8Client
   struct SkippyM3U8ClientPrivate* priv;
 } SkippyM3U8Client;
 
+// Lightweight, refcounted fragment description for the streaming loop (no GObject).
+// Descriptors are recycled through a pool, the strings stay valid until the descriptor is released.
+typedef struct _SkippyM3U8FragmentDescriptor
+{
+  const gchar* uri;
+  const gchar* playlist_uri;     /* Media playlist the fragment belongs to (referrer) */
+  guint64 sequence_number;       /* Media sequence number */
+  GstClockTime start_time;
+  GstClockTime stop_time;
+  GstClockTime duration;
+  gint64 range_start, range_end; /* Byte range @ URI (end excluded), range_end is -1 when the size is not known */
+  gint part_index;               /* Partial segment (Low-Latency HLS) of the media sequence number, -1 for a whole segment */
+} SkippyM3U8FragmentDescriptor;
+
+// Consecutive fragments taken from the same version of the playlist, to plan prefetching
+typedef struct _SkippyM3U8Lookahead
+{
+  SkippyM3U8FragmentDescriptor** fragments;
+  GstClockTime* cumulative_durations;  /* From the start of the first fragment to the end of fragment i */
+  guint n_fragments;
+  guint64 known_bytes;                 /* Total size of the fragments with a known byte range */
+  guint n_unknown_sizes;               /* Fragments whose size is not known */
+} SkippyM3U8Lookahead;
+
 SkippyM3U8Client *skippy_m3u8_client_new ();
 void skippy_m3u8_client_free (SkippyM3U8Client * client);
 
 // Called to get the next fragment
 SkippyFragment* skippy_m3u8_client_get_current_fragment (SkippyM3U8Client * client);
 SkippyFragment* skippy_m3u8_client_get_fragment (SkippyM3U8Client * client, guint64 sequence_number);
+// Same without allocating a GObject, NULL when there is no such fragment. Release with skippy_m3u8_fragment_descriptor_unref.
+SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_current_fragment (SkippyM3U8Client * client);
+SkippyM3U8FragmentDescriptor* skippy_m3u8_client_acquire_fragment (SkippyM3U8Client * client, guint64 index);
+SkippyM3U8FragmentDescriptor* skippy_m3u8_fragment_descriptor_ref (SkippyM3U8FragmentDescriptor* descriptor);
+void skippy_m3u8_fragment_descriptor_unref (SkippyM3U8FragmentDescriptor* descriptor);
+// Up to max_fragments fragments from the current one on (without moving the cursor)
+SkippyM3U8Lookahead* skippy_m3u8_client_lookahead (SkippyM3U8Client * client, guint max_fragments);
+// All fragments that play between start and stop
+SkippyM3U8Lookahead* skippy_m3u8_client_lookahead_window (SkippyM3U8Client * client, GstClockTime start, GstClockTime stop);
+void skippy_m3u8_lookahead_free (SkippyM3U8Lookahead* lookahead);
 void skippy_m3u8_client_advance_to_next_fragment (SkippyM3U8Client * client);
 gboolean skippy_m3u8_client_seek_to (SkippyM3U8Client * client, GstClockTime target);
+// Media sequence numbers of the playlist (stay valid across refreshes of a live window)
+gboolean skippy_m3u8_client_seek_to_sequence_number (SkippyM3U8Client * client, guint64 media_sequence_number);
+guint64 skippy_m3u8_client_get_current_sequence_number (SkippyM3U8Client * client);
 
 gchar* skippy_m3u8_client_get_uri(SkippyM3U8Client * client);
 
 // Update/set/identify variant (sub-) playlist by URIs advertised in master playlist
 SkippyHlsInternalError skippy_m3u8_client_load_playlist (SkippyM3U8Client * client, const gchar *uri, GstBuffer* playlist_buffer);
+// Loads a media playlist parsed earlier (by any client) for the same resource, if it is still valid.
+// The downloaded playlist should still be loaded afterwards: it gets merged like a refresh.
+gboolean skippy_m3u8_client_load_cached_playlist (SkippyM3U8Client * client, const gchar *uri);
+// Saves the current media playlist in binary form. Loading the file with skippy_m3u8_client_load_playlist
+// restores it without parsing (the playlist keeps the URI it was downloaded from).
+gboolean skippy_m3u8_client_save_playlist_snapshot (SkippyM3U8Client * client, const gchar* path);
+
+// Incremental loading: parses playlist data while it is still being received.
+// The complete data has to be passed on end for validation (and is kept as raw data).
+void skippy_m3u8_client_begin_playlist (SkippyM3U8Client * client);
+void skippy_m3u8_client_feed_playlist (SkippyM3U8Client * client, const gchar *data, gsize size);
+SkippyHlsInternalError skippy_m3u8_client_end_playlist (SkippyM3U8Client * client, const gchar *uri, GstBuffer* playlist_buffer);
 
 gchar *skippy_m3u8_client_get_playlist_for_bitrate (SkippyM3U8Client * client, guint bitrate);
 gchar *skippy_m3u8_client_get_current_playlist (SkippyM3U8Client * client);
@@ -60,6 +109,13 @@ GstClockTime skippy_m3u8_client_get_target_duration (SkippyM3U8Client * client);
 
 gboolean skippy_m3u8_client_has_variant_playlist(SkippyM3U8Client * client);
 gboolean skippy_m3u8_client_is_live(SkippyM3U8Client * client);
+// Time until a live playlist should be reloaded, GST_CLOCK_TIME_NONE if it is not live
+GstClockTime skippy_m3u8_client_get_reload_interval (SkippyM3U8Client * client);
+// Low-Latency HLS blocking reload: the next media sequence number and part (-1 for a whole segment) to ask the server for
+// with _HLS_msn and _HLS_part. FALSE if the playlist is not live or the server doesn't support blocking reloads.
+gboolean skippy_m3u8_client_get_blocking_reload_params (SkippyM3U8Client * client, guint64* media_sequence_number, gint* part);
+// Whether the next reload can ask for a delta update (_HLS_skip=YES): the server supports it and our copy is recent enough
+gboolean skippy_m3u8_client_can_request_delta_update (SkippyM3U8Client * client);
 gboolean skippy_m3u8_client_is_caching_allowed(SkippyM3U8Client * client);
 
 gchar* skippy_m3u8_client_get_current_raw_data (SkippyM3U8Client * client);
@@ -7,9 +7,10 @@
 #define UNIT_SECONDS 1000000000L // 10^9 (Nanoseconds)
 #define ENABLE_DEBUG_LOG FALSE
 
-#include <sstream>
-#include <cmath>
+#include <string.h>
 #include <algorithm>
+#include <thread>
+#include <system_error>
 
 #include <glib-object.h>
 
@@ -23,95 +24,428 @@
 
 using namespace std;
 
-static const string default_delimiters ("# -.,:");
-// words
-static const string EXT("EXT");
-static const string X("X");
-static const string INF("INF");
-static const string ID("ID");
-static const string EXTM3U("EXTM3U");
-static const string EXTINF("EXTINF");
-static const string PLAYLIST("PLAYLIST");
-static const string TYPE("TYPE");
-static const string STREAM("STREAM");
-static const string PROGRAM("PROGRAM");
-static const string VERSION("VERSION");
-static const string BANDWIDTH("BANDWIDTH");
-static const string RES("READ");
-static const string CODEC("CODEC");
-static const string VOD("VOD");
-static const string EVENT("EVENT");
-static const string TARGETDURATION("TARGETDURATION");
-static const string MEDIA("MEDIA");
-static const string SEQUENCE("SEQUENCE");
-static const string ENDLIST("ENDLIST");
-
-typedef vector<string> Tokens;
-Tokens custom_split(const string &s, const string &delim = default_delimiters) {
-	vector<string> result;
-	auto from = begin(s);
-	auto endIt = end(s);
-	auto is_delim = [&](const char &c) { return delim.find(c) != string::npos; };
-	while( (from = find_if_not(from, endIt, is_delim)) != endIt ){
-		auto tokEnd = find_if(from, endIt, is_delim);
-		result.push_back(string(from, tokEnd));
-		from = tokEnd;
-	}
-	return result;
+#define DECIMAL_DIGITS_NS 9 // Nanoseconds have 9 decimal digits
+#define PARSE_SLICE_SIZE 65536 // Validated and parsed in one go, while it is in the cache
+#define PARALLEL_PARSE_THRESHOLD (4 * 1024 * 1024) // Smaller playlists are parsed on the calling thread only
+#define PARALLEL_PARSE_MAX_THREADS 4
+
+static const char META_LINE_PREFIX[] = "#EXT";
+// attributes
+static const char PROGRAM_ID[] = "PROGRAM-ID";
+static const char BANDWIDTH[] = "BANDWIDTH";
+static const char RESOLUTION[] = "RESOLUTION";
+static const char CODECS[] = "CODECS";
+static const char DURATION[] = "DURATION";
+static const char URI[] = "URI";
+static const char INDEPENDENT[] = "INDEPENDENT";
+static const char PART_TARGET[] = "PART-TARGET";
+static const char CAN_BLOCK_RELOAD[] = "CAN-BLOCK-RELOAD";
+static const char PART_HOLD_BACK[] = "PART-HOLD-BACK";
+static const char HOLD_BACK[] = "HOLD-BACK";
+static const char CAN_SKIP_UNTIL[] = "CAN-SKIP-UNTIL";
+static const char SKIPPED_SEGMENTS[] = "SKIPPED-SEGMENTS";
+static const char TYPE[] = "TYPE";
+static const char YES[] = "YES";
+static const char PART[] = "PART";
+
+// All tags of the HLS specification (including Low-Latency HLS), most of them are ignored
+#define SKIPPY_M3U_TAGS(TAG) \
+  TAG(TAG_EXTM3U, "EXTM3U") \
+  TAG(TAG_EXTINF, "EXTINF") \
+  TAG(TAG_VERSION, "EXT-X-VERSION") \
+  TAG(TAG_TARGETDURATION, "EXT-X-TARGETDURATION") \
+  TAG(TAG_MEDIA_SEQUENCE, "EXT-X-MEDIA-SEQUENCE") \
+  TAG(TAG_DISCONTINUITY_SEQUENCE, "EXT-X-DISCONTINUITY-SEQUENCE") \
+  TAG(TAG_PLAYLIST_TYPE, "EXT-X-PLAYLIST-TYPE") \
+  TAG(TAG_ENDLIST, "EXT-X-ENDLIST") \
+  TAG(TAG_I_FRAMES_ONLY, "EXT-X-I-FRAMES-ONLY") \
+  TAG(TAG_INDEPENDENT_SEGMENTS, "EXT-X-INDEPENDENT-SEGMENTS") \
+  TAG(TAG_START, "EXT-X-START") \
+  TAG(TAG_ALLOW_CACHE, "EXT-X-ALLOW-CACHE") \
+  TAG(TAG_DEFINE, "EXT-X-DEFINE") \
+  TAG(TAG_BYTERANGE, "EXT-X-BYTERANGE") \
+  TAG(TAG_DISCONTINUITY, "EXT-X-DISCONTINUITY") \
+  TAG(TAG_KEY, "EXT-X-KEY") \
+  TAG(TAG_MAP, "EXT-X-MAP") \
+  TAG(TAG_PROGRAM_DATE_TIME, "EXT-X-PROGRAM-DATE-TIME") \
+  TAG(TAG_DATERANGE, "EXT-X-DATERANGE") \
+  TAG(TAG_GAP, "EXT-X-GAP") \
+  TAG(TAG_BITRATE, "EXT-X-BITRATE") \
+  TAG(TAG_PART, "EXT-X-PART") \
+  TAG(TAG_PART_INF, "EXT-X-PART-INF") \
+  TAG(TAG_SERVER_CONTROL, "EXT-X-SERVER-CONTROL") \
+  TAG(TAG_PRELOAD_HINT, "EXT-X-PRELOAD-HINT") \
+  TAG(TAG_RENDITION_REPORT, "EXT-X-RENDITION-REPORT") \
+  TAG(TAG_SKIP, "EXT-X-SKIP") \
+  TAG(TAG_MEDIA, "EXT-X-MEDIA") \
+  TAG(TAG_STREAM_INF, "EXT-X-STREAM-INF") \
+  TAG(TAG_I_FRAME_STREAM_INF, "EXT-X-I-FRAME-STREAM-INF") \
+  TAG(TAG_SESSION_DATA, "EXT-X-SESSION-DATA") \
+  TAG(TAG_SESSION_KEY, "EXT-X-SESSION-KEY") \
+  TAG(TAG_CONTENT_STEERING, "EXT-X-CONTENT-STEERING")
+
+#define SKIPPY_M3U_TAG_ENUM(id, name) id,
+enum Tag {
+  TAG_UNKNOWN,
+  SKIPPY_M3U_TAGS(SKIPPY_M3U_TAG_ENUM)
+};
+
+// FNV-1a, usable as case label. The compiler rejects duplicate case values,
+// so the tag switch below only builds as long as the hash is perfect over the tag names.
+static constexpr uint32_t tag_hash(const char* name, size_t length, uint32_t hash = 2166136261u)
+{
+  return length == 0 ? hash : tag_hash(name + 1, length - 1, (hash ^ (unsigned char) *name) * 16777619u);
+}
+
+// Classifies a tag name (without '#') with one hash and one comparison
+static Tag classify_tag(const SkippyM3UToken& name)
+{
+#define SKIPPY_M3U_TAG_CASE(id, word) \
+  case tag_hash(word, sizeof(word) - 1): return name == word ? id : TAG_UNKNOWN;
+
+  switch (tag_hash(name.data, name.length)) {
+  SKIPPY_M3U_TAGS(SKIPPY_M3U_TAG_CASE)
+  default:
+    return TAG_UNKNOWN;
+  }
+}
+
+// Reads the next NAME=VALUE pair of an attribute list and advances the position.
+// Quotes are removed from quoted-string values (which may contain commas).
+static bool next_attribute(const char*& pos, const char* end, SkippyM3UToken& name, SkippyM3UToken& value)
+{
+  // Skip separators
+  while (pos != end && (*pos == ',' || *pos == ' ')) {
+    pos++;
+  }
+  if (pos == end) {
+    return false;
+  }
+  const char* nameEnd = (const char*) memchr(pos, '=', end - pos);
+  if (!nameEnd) {
+    return false;
+  }
+  name = SkippyM3UToken(pos, nameEnd - pos);
+  pos = nameEnd + 1;
+  if (pos != end && *pos == '"') {
+    const char* quoteEnd = (const char*) memchr(pos + 1, '"', end - pos - 1);
+    if (!quoteEnd) {
+      quoteEnd = end;
+    }
+    value = SkippyM3UToken(pos + 1, quoteEnd - pos - 1);
+    pos = quoteEnd == end ? end : quoteEnd + 1;
+  } else {
+    const char* valueEnd = (const char*) memchr(pos, ',', end - pos);
+    if (!valueEnd) {
+      valueEnd = end;
+    }
+    value = SkippyM3UToken(pos, valueEnd - pos);
+    pos = valueEnd;
+  }
+  return true;
 }
 
 SkippyM3UParser::SkippyM3UParser()
-:state (STATE_RESET)
-,subState (SUBSTATE_RESET)
-// Put default values here
-,mediaSequenceNo(0)
-,targetDuration(0)
-,programId(0)
-,bandwidth(0)
-,length(0)
-,index(0)
-,position(0)
-{}
+:output("")
+,master("")
+,parallelThreshold(PARALLEL_PARSE_THRESHOLD)
+,parallelThreads(min(std::thread::hardware_concurrency(), (unsigned) PARALLEL_PARSE_MAX_THREADS))
+{
+  reset();
+}
+
+void SkippyM3UParser::setParallelParsing(size_t thresholdBytes, unsigned maxThreads)
+{
+  parallelThreshold = thresholdBytes;
+  parallelThreads = maxThreads;
+}
+
+void SkippyM3UParser::reset()
+{
+  state = STATE_RESET;
+  subState = SUBSTATE_RESET;
+  // Put default values here
+  version = 0;
+  mediaSequenceNo = 0;
+  targetDuration = 0;
+  playlistType.clear();
+  partTargetDuration = 0;
+  partHoldBack = holdBack = 0;
+  canBlockReload = false;
+  preloadHint.clear();
+  canSkipUntil = 0;
+  skippedSegments = 0;
+  partNo = 0;
+  programId = 0;
+  bandwidth = 0;
+  res.clear();
+  codec.clear();
+  duration = 0;
+  rangeLength = rangeOffset = -1;
+  nextRangeStart = 0;
+  leadingImplicitRanges = 0;
+  rangesFromStart = true;
+  index = 0;
+  position = 0;
+  line = value = token = url = SkippyM3UToken();
+  pending.clear();
+  master.items.clear();
+  utf8.reset();
+  utf8Valid = true;
+}
 
 SkippyM3UPlaylist SkippyM3UParser::parse(string uri, const string& playlist)
 {
-  stringstream in(playlist);
+  return parse(uri, playlist.data(), playlist.size());
+}
+
+SkippyM3UPlaylist SkippyM3UParser::parse(string uri, const char* data, size_t size)
+{
+  LOG ("Dumping whole M3U8:\n\n\n%.*s\n\n\n", (int) size, data);
+
+  begin(uri);
+  if (size >= parallelThreshold && parallelThreads > 1) {
+    parseParallel(data, size);
+  } else {
+    feedSliced(data, size);
+  }
+  return finish();
+}
+
+void SkippyM3UParser::feedSliced(const char* data, size_t size)
+{
+  for (size_t offset = 0; offset < size && utf8Valid; offset += PARSE_SLICE_SIZE) {
+    feed(data + offset, min<size_t>(size - offset, PARSE_SLICE_SIZE));
+  }
+}
+
+// Returns the start of the line following the URL of the first item that starts after the line containing pos (or end).
+// Cutting after a URL keeps the tags of the next item with it, whether they come before or after its "#EXTINF" line.
+static const char* find_item_boundary(const char* pos, const char* end)
+{
+  static const char LINE_PREFIX[] = "#EXTINF";
+  bool inItem = false;
+  const char* eol = SkippyM3UScan::findNewline(pos, end);
+  while (eol != end) {
+    pos = eol + 1;
+    eol = SkippyM3UScan::findNewline(pos, end);
+    if ((size_t) (end - pos) >= sizeof(LINE_PREFIX) - 1 && memcmp(pos, LINE_PREFIX, sizeof(LINE_PREFIX) - 1) == 0) {
+      inItem = true;
+    } else if (inItem && pos != eol && *pos != '#' && *pos != '\r') {
+      // URL of the item: the boundary is the next line
+      return eol == end ? end : eol + 1;
+    }
+  }
+  return end;
+}
+
+// Splits the data into chunks that start after the URL of an item and parses them in parallel.
+// The first chunk is parsed by this parser on the calling thread: header tags come before the first item,
+// so it resolves them while the other chunks are parsed by separate parsers (each starting at index and time 0).
+// Their items are then appended with the index and time offsets summed up over the previous chunks.
+void SkippyM3UParser::parseParallel(const char* data, size_t size)
+{
+  const char* end = data + size;
+  vector<const char*> bounds(1, data);
+
+  for (unsigned i = 1; i < parallelThreads; i++) {
+    const char* split = find_item_boundary(max(bounds.back(), data + size / parallelThreads * i), end);
+    if (split == end) {
+      break;
+    }
+    bounds.push_back(split);
+  }
+  bounds.push_back(end);
+
+  size_t chunks = bounds.size() - 1;
+  if (chunks < 2) {
+    // No items to split at (e.g a master playlist)
+    feedSliced(data, size);
+    return;
+  }
+
+  LOG ("Parsing %d bytes in %d chunks", (int) size, (int) chunks);
+
+  vector<SkippyM3UPlaylist> results(chunks - 1, SkippyM3UPlaylist(""));
+  vector<char> resultsValid(chunks - 1, false);
+  vector<size_t> resultsImplicitRanges(chunks - 1, 0);
+  vector<thread> workers;
+
+  auto parseChunk = [&bounds, &results, &resultsValid, &resultsImplicitRanges](size_t c) {
+    SkippyM3UParser parser;
+    parser.begin("");
+    parser.feedSliced(bounds[c], bounds[c + 1] - bounds[c]);
+    results[c - 1] = parser.finish();
+    resultsValid[c - 1] = parser.isValidUtf8();
+    resultsImplicitRanges[c - 1] = parser.leadingImplicitRanges;
+  };
+
+  // Reserved: only starting a thread may throw (e.g when the process is out of threads)
+  workers.reserve(chunks - 1);
+  for (size_t c = 1; c < chunks; c++) {
+    try {
+      workers.push_back(thread(parseChunk, c));
+    } catch (const system_error& e) {
+      LOG ("Failed to start a parser thread (%s), parsing the rest here", e.what());
+      break;
+    }
+  }
+
+  feedSliced(bounds[0], bounds[1] - bounds[0]);
+
+  // Chunks that didn't get a thread
+  for (size_t c = workers.size() + 1; c < chunks; c++) {
+    parseChunk(c);
+  }
+
+  for (thread& worker : workers) {
+    worker.join();
+  }
+
+  size_t total = output.items.size();
+  for (const SkippyM3UPlaylist& result : results) {
+    total += result.items.size();
+  }
+  output.items.reserve(total);
+
+  bool complete = false;
+  for (size_t c = 0; c < results.size(); c++) {
+    SkippyM3UPlaylist& result = results[c];
+    uint64_t chunkDuration = result.items.empty() ? 0 : result.items.back().end;
+
+    // Implicit byte range offsets continue from the end of the previous chunk
+    for (size_t i = 0; i < resultsImplicitRanges[c]; i++) {
+      result.items[i].rangeStart += nextRangeStart;
+      result.items[i].rangeEnd += nextRangeStart;
+    }
+    if (!result.items.empty() && result.items.back().rangeEnd >= 0) {
+      nextRangeStart = result.items.back().rangeEnd;
+    }
+
+    // A skip only counts at the start of the playlist, not at the start of a chunk
+    for (SkippyM3UItem& item : result.items) {
+      item.index += index - result.skippedSegments;
+      item.start += position;
+      item.end += position;
+      output.items.push_back( std::move(item) );
+    }
+    for (SkippyM3UPart& part : result.parts) {
+      part.index += index - result.skippedSegments;
+      output.parts.push_back( std::move(part) );
+    }
+    if (!result.preloadHint.empty()) {
+      preloadHint = std::move(result.preloadHint);
+    }
+    index += result.items.size();
+    position += chunkDuration;
+
+    complete = complete || result.isComplete;
+    utf8Valid = utf8Valid && resultsValid[c];
+  }
+
+  if (complete) {
+    completeHeader(output);
+  }
+}
+
+void SkippyM3UParser::begin(string uri)
+{
+  // The parser might have been used before
+  reset();
 
   // Output playlist
-  SkippyM3UPlaylist outputPlaylist(uri);
+  output = SkippyM3UPlaylist(uri);
+  master.uri = uri;
+}
+
+size_t SkippyM3UParser::feed(const char* data, size_t size)
+{
+  const char* pos = data;
+  const char* end = data + size;
+  size_t itemsBefore = output.items.size();
+
+  if (!utf8Valid || !(utf8Valid = utf8.feed(data, size))) {
+    LOG ("Playlist data is not valid UTF-8");
+    return 0;
+  }
+
+  while (pos < end) {
+    const char* eol = SkippyM3UScan::findNewline(pos, end);
 
-  LOG ("Dumping whole M3U8:\n\n\n%s\n\n\n", playlist.c_str());
+    // Keep the incomplete line until the next chunk arrives
+    if (eol == end) {
+      pending.append(pos, end - pos);
+      break;
+    }
+
+    // Complete the line started in a previous chunk
+    if (!pending.empty()) {
+      pending.append(pos, eol - pos);
+      processLine(pending.data(), pending.data() + pending.size());
+      pending.clear();
+    } else {
+      processLine(pos, eol);
+    }
+    pos = eol + 1;
+  }
 
-  while ( getline(in, line) ){
-    // evaluate main state of parser
-    evalState();
+  return output.items.size() - itemsBefore;
+}
 
-    // Parses the current line into tokens
-    // and updates the parser members
-    readLine();
+SkippyM3UPlaylist SkippyM3UParser::finish()
+{
+  utf8Valid = utf8Valid && utf8.finish();
 
-    // Updates the output playlist after every line
-    update(outputPlaylist);
+  // The last line might not be terminated
+  if (utf8Valid && !pending.empty()) {
+    processLine(pending.data(), pending.data() + pending.size());
   }
+  pending.clear();
 
-  return outputPlaylist;
+  // Live playlists have no end tag: their header is complete once all the data is there
+  if (!output.isComplete) {
+    resolveHeader(output);
+  }
+  return std::move(output);
 }
 
-void SkippyM3UParser::metaTokenize() {
-  tokens = custom_split (line);
-  tokenIt = begin(tokens);
+void SkippyM3UParser::processLine(const char* begin, const char* end)
+{
+  // Strip CR of CRLF line endings
+  if (end > begin && end[-1] == '\r') {
+    end--;
+  }
+
+  // Blank lines and comments are ignored
+  if (end == begin) {
+    return;
+  }
+
+  line = SkippyM3UToken(begin, end - begin);
+  if (*begin == '#' && !line.startsWith(META_LINE_PREFIX)) {
+    return;
+  }
+
+  // evaluate main state of parser
+  evalState();
+
+  // Parses the current line and updates the parser members
+  readLine();
+
+  // Updates the output playlist after every line
+  update(output);
 }
 
 void SkippyM3UParser::evalState() {
 
-  LOG ("Evaluating line: %s", line.c_str());
+  LOG ("Evaluating line: %.*s", (int) line.length, line.data);
 
-  if (line.find("#EXT") == 0) { //check if its a META line and that are not already in META line state
+  if (line.startsWith(META_LINE_PREFIX)) { //check if its a META line and that are not already in META line state
 
     LOG ("Found meta line");
     state = STATE_META_LINE;
 
-  } else if(state == STATE_META_LINE && subState == SUBSTATE_INF) {
+  } else if(state == STATE_META_LINE && (subState == SUBSTATE_INF || subState == SUBSTATE_STREAM)) {
 
     LOG ("Assuming URL line");
     state = STATE_URL_LINE;
@@ -126,81 +460,189 @@ void SkippyM3UParser::evalState() {
   }
 }
 
-bool SkippyM3UParser::nextToken() {
-  if(tokenIt == tokens.end()) {
-    return false;
+// Sets the token to the first value of the tag (e.g the number of "#EXTINF:10.0,title" is "10")
+bool SkippyM3UParser::firstValueToken() {
+  const char* begin = value.data;
+  const char* end = value.end();
+  while (begin != end && SkippyM3UScan::isDelimiter(*begin)) {
+    begin++;
   }
-  token = *tokenIt++;
-  return true;
+  token = SkippyM3UToken(begin, SkippyM3UScan::findDelimiter(begin, end) - begin);
+  return token.length > 0;
 }
 
+// Only the tag name is looked at before we know that we need the value
 void SkippyM3UParser::evalSubstate() {
 
-  // Get the very first token !
-  nextToken();
-
-  // Skip these tokens
-  if (token == EXT) {
-    nextToken();
-  }
-  if (token == X) {
-    nextToken();
+  const char* nameEnd = (const char*) memchr(line.data, ':', line.length);
+  if (!nameEnd) {
+    nameEnd = line.end();
+    value = SkippyM3UToken(nameEnd, 0);
+  } else {
+    value = SkippyM3UToken(nameEnd + 1, line.end() - nameEnd - 1);
   }
 
-  LOG ("Evaluating metaline substate from token: %s", token.c_str());
+  SkippyM3UToken name(line.data + 1, nameEnd - line.data - 1);
 
-  if (token == EXTM3U) {
+  LOG ("Evaluating metaline substate from tag: %.*s", (int) name.length, name.data);
+
+  switch (classify_tag(name)) {
+  case TAG_EXTM3U:
 
     LOG ("Start of M3U");
+    break;
 
-  } else if ( token == EXTINF ) {
+  case TAG_EXTINF:
 
     subState = SUBSTATE_INF;
 
     LOG ("Sub-State to: INF");
 
-  } else if ( token == STREAM && nextToken()
-      && token == INF) {
+    // The duration is the first value, the rest of the line is the (ignored) title
+    duration = firstValueToken() ? tokenToNanoseconds() : 0;
+
+    LOG ("Got INF duration: %" G_GUINT64_FORMAT " ns", duration);
+    break;
+
+  case TAG_STREAM_INF:
 
     subState = SUBSTATE_STREAM;
 
     LOG ("Sub-State to: STREAM");
 
-  } else if ( token == MEDIA && nextToken()
-      && token == SEQUENCE && nextToken() ) {
+    readStreamAttributes();
+    break;
 
-    mediaSequenceNo = tokenToUnsignedInt();
+  case TAG_MEDIA_SEQUENCE:
 
-    LOG ("Media sequence no: %u", mediaSequenceNo);
+    if (firstValueToken()) {
+      mediaSequenceNo = tokenToUnsignedInt();
+    }
 
-  } else if (token == PLAYLIST && nextToken()
-      && token == TYPE && nextToken() ) {
+    LOG ("Media sequence no: %u", (unsigned) mediaSequenceNo);
+    break;
+
+  case TAG_PLAYLIST_TYPE:
 
-    playlistType = token;
+    if (firstValueToken()) {
+      playlistType.assign(token.data, token.length);
+    }
 
     LOG ("Playlist type: %s", playlistType.c_str());
+    break;
+
+  case TAG_VERSION:
+
+    if (firstValueToken()) {
+      version = tokenToUnsignedInt();
+    }
+
+    LOG ("Version is: %u", (unsigned) version);
+    break;
+
+  case TAG_TARGETDURATION:
+
+    if (firstValueToken()) {
+      targetDuration = tokenToUnsignedInt();
+    }
+
+    LOG ("Target duration is: %u", (unsigned) targetDuration);
+    break;
+
+  case TAG_PART:
+
+    readPartAttributes();
+    break;
+
+  case TAG_PART_INF: {
+    SkippyM3UToken name;
+    const char* pos = value.data;
+    while (next_attribute(pos, value.end(), name, token)) {
+      if (name == PART_TARGET) {
+        partTargetDuration = attributeToNanoseconds();
+      }
+    }
+
+    LOG ("Part target duration: %" G_GUINT64_FORMAT " ns", partTargetDuration);
+    break;
+  }
 
-  } else if (token == VERSION && nextToken()) {
+  case TAG_SERVER_CONTROL:
 
-    version = tokenToUnsignedInt();
+    readServerControlAttributes();
+    break;
 
-    LOG ("Version is: %u", version);
-  } else if (token == TARGETDURATION && nextToken()) {
+  case TAG_PRELOAD_HINT: {
+    SkippyM3UToken name, uri;
+    bool isPart = false;
+    const char* pos = value.data;
+    while (next_attribute(pos, value.end(), name, token)) {
+      if (name == TYPE) {
+        isPart = token == PART;
+      } else if (name == URI) {
+        uri = token;
+      }
+    }
+    // Hints for other types (e.g a map) don't help us
+    if (isPart) {
+      preloadHint.assign(uri.data, uri.length);
+    }
+
+    LOG ("Preload hint: %s", preloadHint.c_str());
+    break;
+  }
 
-    targetDuration = tokenToUnsignedInt();
+  case TAG_BYTERANGE: {
+    // "<length>[@<offset>]", without offset the sub-range follows the one of the previous item
+    const char* at = (const char*) memchr(value.data, '@', value.length);
+    token = SkippyM3UToken(value.data, (at ? at : value.end()) - value.data);
+    rangeLength = (int64_t) tokenToUnsignedInt();
+    rangeOffset = -1;
+    if (at) {
+      token = SkippyM3UToken(at + 1, value.end() - at - 1);
+      rangeOffset = (int64_t) tokenToUnsignedInt();
+    }
 
-    LOG ("Target duration is: %u", targetDuration);
-  } else if (token == ENDLIST) {
+    LOG ("Byte range: %d@%d", (int) rangeLength, (int) rangeOffset);
+    break;
+  }
 
-    LOG("Sub-State to: RESET (end of list)");
+  case TAG_SKIP: {
+    // Delta update: the first segments are not listed, the server expects us to have them from a previous reload.
+    // Only valid before the first item, whose index is the number of skipped segments.
+    if (!output.items.empty()) {
+      LOG ("Ignoring skip after the first item");
+      break;
+    }
+    SkippyM3UToken name;
+    const char* pos = value.data;
+    while (next_attribute(pos, value.end(), name, token)) {
+      if (name == SKIPPED_SEGMENTS) {
+        skippedSegments = tokenToUnsignedInt();
+      }
+    }
+    index = skippedSegments;
+
+    LOG ("Skipped segments: %u", (unsigned) skippedSegments);
+    break;
+  }
+
+  case TAG_ENDLIST:
+
+    LOG("Sub-State to: END (end of list)");
 
     subState = SUBSTATE_END;
-    
-  } else {
+    break;
 
-    LOG("Sub-State to: RESET (unknown token): %s", token.c_str());
+  case TAG_UNKNOWN:
 
-    subState = SUBSTATE_RESET;
+    LOG("Skipping unknown tag: %.*s", (int) name.length, name.data);
+    break;
+
+  default:
+    // Known tags that we don't support (yet) don't interrupt an item or variant:
+    // e.g the URL after "#EXTINF" and "#EXT-X-PROGRAM-DATE-TIME" lines still belongs to the item.
+    break;
   }
 
 }
@@ -208,77 +650,160 @@ void SkippyM3UParser::evalSubstate() {
 uint64_t SkippyM3UParser::tokenToUnsignedInt()
 {
   uint64_t i = 0;
-  if (! (istringstream(token) >> i)) {
+  const char* c = token.data;
+  const char* end = token.end();
+  if (c == end) {
     LOG ("Failed to parse integer value!");
     state = STATE_RESET;
+    return 0;
+  }
+  for (; c != end; c++) {
+    unsigned digit = (unsigned char) *c - '0';
+    if (digit > 9) {
+      LOG ("Failed to parse integer value!");
+      state = STATE_RESET;
+      return 0;
+    }
+    i = i * 10 + digit;
   }
   return i;
 }
 
+// Parses a decimal number of seconds starting at the current token into nanoseconds.
+// The fractional part is read from the line data following the token (the tokenizer splits at the dot).
+// Digits beyond nanosecond precision are ignored.
+uint64_t SkippyM3UParser::tokenToNanoseconds()
+{
+  uint64_t seconds = 0, fraction = 0;
+  int fractionDigits = 0;
+  const char* c = token.data;
+  const char* end = line.end();
+  const char* intEnd = token.end();
+
+  for (; c != intEnd; c++) {
+    unsigned digit = (unsigned char) *c - '0';
+    if (digit > 9) {
+      LOG ("Failed to parse decimal value!");
+      state = STATE_RESET;
+      return 0;
+    }
+    seconds = seconds * 10 + digit;
+  }
+  if (c != end && *c == '.') {
+    for (c++; c != end; c++) {
+      unsigned digit = (unsigned char) *c - '0';
+      if (digit > 9) {
+        break;
+      }
+      if (fractionDigits < DECIMAL_DIGITS_NS) {
+        fraction = fraction * 10 + digit;
+        fractionDigits++;
+      }
+    }
+  }
+  for (; fractionDigits < DECIMAL_DIGITS_NS; fractionDigits++) {
+    fraction *= 10;
+  }
+  return seconds * UNIT_SECONDS + fraction;
+}
+
 void SkippyM3UParser::readLine() {
 
   switch(state) {
   case STATE_RESET:
     break;
   case STATE_URL_LINE:
-    if (line.find_first_of("\r", 0) != string::npos && line.length() >= 2) {
-      line = line.substr(0, line.length()-1);
-    }
     url = line;
     state = STATE_URL_LINE;
-    subState = SUBSTATE_RESET;
     break;
   case STATE_META_LINE:
 
-    // Reset the segment length (duration) field
-    length = -1;
+    // Evaluate the tag, reads its value only if we need it
+    evalSubstate();
+    break;
+  }
+}
 
-    // Tokenize the line
-    metaTokenize();
+void SkippyM3UParser::readStreamAttributes() {
+  SkippyM3UToken name;
+  const char* pos = value.data;
+
+  programId = 0;
+  bandwidth = 0;
+  res.clear();
+  codec.clear();
+
+  while (next_attribute(pos, value.end(), name, token)) {
+    if (name == PROGRAM_ID) {
+      programId = tokenToUnsignedInt();
+    } else if (name == BANDWIDTH) {
+      bandwidth = tokenToUnsignedInt();
+    } else if (name == CODECS) {
+      codec.assign(token.data, token.length);
+    } else if (name == RESOLUTION) {
+      res.assign(token.data, token.length);
+    }
+  }
 
-    // Evaluate the substate
-    evalSubstate();
-// 9.12345
-    //iterate over all tokens of this line
-    while (nextToken()) {
-      switch(subState) {
-      case SUBSTATE_INF: {
-        // Integer part already parsed?
-        if (length == -1) {
-          length = (float) tokenToUnsignedInt();
-        } else { // Now parse fractional part
-          double decimals = tokenToUnsignedInt();
-          LOG ("Got decimals: %f (%s)", decimals, token.c_str());
-          length += decimals / pow(10, token.length());
-        }
-        LOG ("Got INF duration: %f", length);
-        break;
-      }
-      case SUBSTATE_STREAM:
-        if ( token == PROGRAM && nextToken () && token == ID ) {
-         nextToken();
-         programId = tokenToUnsignedInt();
-        }
-        else if ( token == CODEC ) {
-         nextToken();
-         codec = token;
-        }
-        else if ( token == RES) {
-         nextToken();
-         res = token;
-        }
-        else if ( token == BANDWIDTH) {
-         nextToken();
-         bandwidth = tokenToUnsignedInt();
-        }
-        break;
-      case SUBSTATE_RESET:
-      default:
-        break;
-      }
+  LOG ("Variant stream: bandwidth %u, codecs %s, resolution %s", (unsigned) bandwidth, codec.c_str(), res.c_str());
+}
+
+// Partial segments are added to the output right away: they have all of their data on one line
+void SkippyM3UParser::readPartAttributes() {
+  SkippyM3UToken name;
+  const char* pos = value.data;
+  SkippyM3UPart part;
+
+  part.duration = 0;
+  part.independent = false;
+  while (next_attribute(pos, value.end(), name, token)) {
+    if (name == DURATION) {
+      part.duration = attributeToNanoseconds();
+    } else if (name == URI) {
+      part.url.assign(token.data, token.length);
+    } else if (name == INDEPENDENT) {
+      part.independent = token == YES;
     }
-      break;
   }
+  if (part.url.empty()) {
+    LOG ("Skipping partial segment without URI");
+    return;
+  }
+  part.index = index;
+  part.partNo = partNo++;
+
+  LOG ("Added part %u of item %u: %s", (unsigned) part.partNo, (unsigned) part.index, part.url.c_str());
+
+  output.parts.push_back( std::move(part) );
+}
+
+void SkippyM3UParser::readServerControlAttributes() {
+  SkippyM3UToken name;
+  const char* pos = value.data;
+
+  while (next_attribute(pos, value.end(), name, token)) {
+    if (name == CAN_BLOCK_RELOAD) {
+      canBlockReload = token == YES;
+    } else if (name == PART_HOLD_BACK) {
+      partHoldBack = attributeToNanoseconds();
+    } else if (name == HOLD_BACK) {
+      holdBack = attributeToNanoseconds();
+    } else if (name == CAN_SKIP_UNTIL) {
+      canSkipUntil = attributeToNanoseconds();
+    }
+  }
+
+  LOG ("Server control: blocking reload %d, part hold back %" G_GUINT64_FORMAT " ns", (int) canBlockReload, partHoldBack);
+}
+
+// Decimal attribute values are one token: the integer part becomes the token, tokenToNanoseconds reads the fraction after it
+uint64_t SkippyM3UParser::attributeToNanoseconds()
+{
+  const char* dot = (const char*) memchr(token.data, '.', token.length);
+  if (dot) {
+    token.length = dot - token.data;
+  }
+  return tokenToNanoseconds();
 }
 
 void SkippyM3UParser::update(SkippyM3UPlaylist& playlist) {
@@ -287,38 +812,84 @@ void SkippyM3UParser::update(SkippyM3UPlaylist& playlist) {
   case STATE_RESET:
     break;
   case STATE_URL_LINE: {
+    // Variant stream of a master playlist
+    if (subState == SUBSTATE_STREAM) {
+      SkippyM3UPlaylist variant(string(url.data, url.length));
+      variant.bandwidthKbps = bandwidth / 1000; // BANDWIDTH is in bits per second
+      variant.codec = codec;
+      variant.resolution = res;
+      variant.programId = programId;
+
+      LOG ("Added variant: %s", variant.uri.c_str());
+
+      master.items.push_back( std::move(variant) );
+      subState = SUBSTATE_RESET;
+      break;
+    }
+
     SkippyM3UItem item;
     item.start = position;
-    item.duration = length * UNIT_SECONDS;
+    item.duration = duration;
     item.end = item.start + item.duration;
-    item.url = url;
+    item.url.assign(url.data, url.length);
     item.encrypted = false;
     item.index = index;
-
-    playlist.items.push_back( item );
+    if (rangeLength >= 0) {
+      item.rangeStart = rangeOffset >= 0 ? rangeOffset : nextRangeStart;
+      item.rangeEnd = item.rangeStart + rangeLength;
+      nextRangeStart = item.rangeEnd;
+      rangesFromStart = rangesFromStart && rangeOffset < 0;
+      if (rangesFromStart) {
+        leadingImplicitRanges++;
+      }
+    } else {
+      item.rangeStart = 0;
+      item.rangeEnd = -1;
+      rangesFromStart = false;
+    }
+    rangeLength = rangeOffset = -1;
 
     position += item.duration;
     index++;
+    partNo = 0;
+
+    LOG ("Added item: %s", item.url.c_str());
 
-    LOG ("Added item: %s", url.c_str());
+    playlist.items.push_back( std::move(item) );
+    subState = SUBSTATE_RESET;
     break;
   }
   case STATE_META_LINE:
     switch (subState) {
     case SUBSTATE_END:
-      playlist.bandwidthKbps = bandwidth; //kbps
-      playlist.codec = codec;
-      playlist.resolution = res;
-      playlist.programId = programId;
-      playlist.sequenceNo = mediaSequenceNo;
-      playlist.targetDuration = targetDuration * UNIT_SECONDS;
-      playlist.totalDuration = position;
-      playlist.type = playlistType;
-      playlist.isComplete = true;
+      completeHeader(playlist);
       break;
     default:
       break;
     }
     break;
   }
-}
\ No newline at end of file
+}
+
+void SkippyM3UParser::completeHeader(SkippyM3UPlaylist& playlist) {
+  resolveHeader(playlist);
+  playlist.isComplete = true;
+}
+
+void SkippyM3UParser::resolveHeader(SkippyM3UPlaylist& playlist) {
+  playlist.bandwidthKbps = bandwidth / 1000; //kbps
+  playlist.codec = codec;
+  playlist.resolution = res;
+  playlist.programId = programId;
+  playlist.sequenceNo = mediaSequenceNo;
+  playlist.targetDuration = targetDuration * UNIT_SECONDS;
+  playlist.totalDuration = position;
+  playlist.type = playlistType;
+  playlist.partTargetDuration = partTargetDuration;
+  playlist.partHoldBack = partHoldBack;
+  playlist.holdBack = holdBack;
+  playlist.canBlockReload = canBlockReload;
+  playlist.canSkipUntil = canSkipUntil;
+  playlist.skippedSegments = skippedSegments;
+  playlist.preloadHint = preloadHint;
+}
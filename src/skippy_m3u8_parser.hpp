@@ -10,12 +10,16 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include "skippy_m3u8_scan.hpp"
 
 // Child item info
 struct SkippyM3UItem
  {
   std::string url, keyUri;
-  //size_t rangeStart, rangeEnd; // not supported yet
+  int64_t rangeStart, rangeEnd; // Byte range of the URL (end excluded), rangeEnd is -1 without EXT-X-BYTERANGE
   uint64_t index;
   uint64_t start, end, duration; // Nanoseconds
   uint8_t iv[16];
@@ -24,10 +28,24 @@ struct SkippyM3UItem
 
 typedef std::vector<SkippyM3UItem> SkippyM3UPlaylistItems;
 
+// Partial segment (Low-Latency HLS), listed before the EXTINF of the segment it belongs to
+struct SkippyM3UPart
+{
+  std::string url;
+  uint64_t index; // Of the segment (the next item, which may not be listed yet)
+  uint64_t partNo; // Within the segment
+  uint64_t duration; // Nanoseconds
+  bool independent;
+};
+
+typedef std::vector<SkippyM3UPart> SkippyM3UParts;
+
 struct SkippyM3UPlaylist
 {
   SkippyM3UPlaylist(std::string uri)
   : version(0), programId(0), sequenceNo(0), bandwidthKbps(0), targetDuration(0), totalDuration(0), uri(uri), isComplete(false)
+  , partTargetDuration(0), partHoldBack(0), holdBack(0), canBlockReload(false)
+  , canSkipUntil(0), skippedSegments(0)
   {}
 
   uint64_t version;
@@ -40,9 +58,20 @@ struct SkippyM3UPlaylist
   std::string resolution;
   std::string uri;
   std::string type;
-  bool isComplete;
+  bool isComplete; // Has an end tag: no items will be added (otherwise the playlist is live)
+
+  // Low-Latency HLS (nanoseconds)
+  uint64_t partTargetDuration; // 0 without partial segments
+  uint64_t partHoldBack, holdBack; // Distance to keep from the live edge, 0 if not specified
+  bool canBlockReload; // Server supports _HLS_msn/_HLS_part requests
+
+  // Delta updates (nanoseconds)
+  uint64_t canSkipUntil; // Server supports _HLS_skip for segments this far from the end, 0 if it doesn't
+  uint64_t skippedSegments; // Segments replaced by EXT-X-SKIP: the items start after them (their index counts them)
+  std::string preloadHint; // URI of the next partial segment (before it is listed)
 
   SkippyM3UPlaylistItems items;
+  SkippyM3UParts parts; // Usually only listed for the last segments
 };
 
 typedef std::vector<SkippyM3UPlaylist> SkippyM3UMasterPlaylistItems;
@@ -57,6 +86,46 @@ struct SkippyM3UMasterPlaylist
   SkippyM3UMasterPlaylistItems items;
 };
 
+// Non-owning view on a range of the playlist data (a line or a token of a line)
+struct SkippyM3UToken
+{
+  SkippyM3UToken()
+  : data(NULL), length(0)
+  {}
+
+  SkippyM3UToken(const char* data, size_t length)
+  : data(data), length(length)
+  {}
+
+  // Compare against a string literal without creating any string object
+  template<size_t N>
+  bool operator==(const char (&word)[N]) const
+  {
+    return length == N - 1 && memcmp(data, word, N - 1) == 0;
+  }
+
+  template<size_t N>
+  bool startsWith(const char (&word)[N]) const
+  {
+    return length >= N - 1 && memcmp(data, word, N - 1) == 0;
+  }
+
+  const char* end() const { return data + length; }
+
+  const char* data;
+  size_t length;
+};
+
+typedef std::vector<SkippyM3UToken> SkippyM3UTokens;
+
+// The parser reads views over the input data and doesn't copy any of it
+// except into the output items. Instances can be reused for several parses,
+// which will then not allocate anything but the output playlist.
+//
+// Data can also be fed incrementally (begin/feed/finish) as it arrives:
+// each item is appended to the output playlist as soon as its EXTINF and URL lines are complete.
+//
+// The input is validated as UTF-8 while it is parsed (see isValidUtf8), parsing stops at the first invalid byte.
 class SkippyM3UParser
 {
 public:
@@ -71,15 +140,42 @@ public:
 	SkippyM3UParser();
 
 	SkippyM3UPlaylist parse(std::string uri, const std::string& playlist);
+	SkippyM3UPlaylist parse(std::string uri, const char* data, size_t size);
+
+  // Incremental parsing
+  void begin(std::string uri);
+  // Returns the number of items completed by this chunk
+  size_t feed(const char* data, size_t size);
+  SkippyM3UPlaylist finish();
+  // Output playlist of the ongoing incremental parse (complete items so far)
+  const SkippyM3UPlaylist& playlist() const { return output; }
+  // Variant streams of the last parse (empty unless it was a master playlist)
+  const SkippyM3UMasterPlaylist& masterPlaylist() const { return master; }
+  // Whether the data of the last parse was valid UTF-8 (complete only after finish)
+  bool isValidUtf8() const { return utf8Valid; }
+
+  // parse() splits playlists of at least thresholdBytes at item boundaries and parses the parts on up to maxThreads threads.
+  // Defaults to 4 MiB and the number of CPUs (at most 4). Less than 2 threads disables it.
+  void setParallelParsing(size_t thresholdBytes, unsigned maxThreads);
 
 protected:
+  void reset();
+  void feedSliced(const char* data, size_t size);
+  void parseParallel(const char* data, size_t size);
+  void resolveHeader(SkippyM3UPlaylist& playlist);
+  void completeHeader(SkippyM3UPlaylist& playlist);
+  void processLine(const char* begin, const char* end);
   void readLine();
   void evalState();
   void evalSubstate();
   void update(SkippyM3UPlaylist& playlist);
-  void metaTokenize();
-  bool nextToken();
+  void readStreamAttributes();
+  void readPartAttributes();
+  void readServerControlAttributes();
+  uint64_t attributeToNanoseconds();
+  bool firstValueToken();
   uint64_t tokenToUnsignedInt();
+  uint64_t tokenToNanoseconds();
 
 private:
   // Parsing state
@@ -91,23 +187,49 @@ private:
   uint64_t targetDuration;
   std::string playlistType;
 
-  // Line buffer
-  std::string line;
-  std::string token;
-  std::vector<std::string> tokens;
-  std::vector<std::string>::iterator tokenIt;
+  // Low-Latency HLS header
+  uint64_t partTargetDuration; // Nanoseconds
+  uint64_t partHoldBack, holdBack; // Nanoseconds
+  bool canBlockReload;
+  std::string preloadHint;
+  uint64_t partNo; // Parts seen for the next item
+
+  // Delta updates
+  uint64_t canSkipUntil; // Nanoseconds
+  uint64_t skippedSegments;
+
+  // Line buffer (views on the input data)
+  SkippyM3UToken line;
+  SkippyM3UToken value; // Of the tag on a meta line (after the colon)
+  SkippyM3UToken token;
 
   // Stream sub-state vars
   uint64_t programId;
-  uint64_t bandwidth;
+  uint64_t bandwidth; // bits per second
   std::string res;
   std::string codec;
 
   // Xinf sub-state vars
-  double length;
+  uint64_t duration; // Nanoseconds
+  int64_t rangeLength, rangeOffset; // Of the next item, -1 without EXT-X-BYTERANGE or without explicit offset
+  int64_t nextRangeStart; // End of the last sub-range: where an implicit one starts
+  // Items at the start of the data whose implicit offsets continue the sub-range before it
+  // (relative to 0 here: a chunk parsed in parallel doesn't know where the previous chunk ended)
+  size_t leadingImplicitRanges;
+  bool rangesFromStart;
   uint64_t index;
   uint64_t position;
   
   // URI state vars
-  std::string url;
+  SkippyM3UToken url;
+
+  // Incomplete last line of the previous chunk (capacity is kept across parses)
+  std::string pending;
+  SkippyM3UScan::Utf8Validator utf8;
+  bool utf8Valid;
+  SkippyM3UPlaylist output;
+  SkippyM3UMasterPlaylist master;
+
+  size_t parallelThreshold;
+  unsigned parallelThreads;
 };
@@ -0,0 +1,199 @@
+/*
+ * skippy_m3u8_scan.hpp
+ *
+ *  Vectorized byte scanning for the M3U8 tokenizer
+ *
+ */
+
+#pragma once
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define SKIPPY_M3U_SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define SKIPPY_M3U_SCAN_NEON 1
+#endif
+
+// Finds line ends and validates UTF-8 16 bytes at a time (SSE2 on x86, NEON on ARM),
+// falls back to scalar code for the remaining bytes and on other architectures.
+namespace SkippyM3UScan
+{
+
+enum { BLOCK_SIZE = 16 };
+
+// Delimiters splitting the tokens of a meta line: "# -.,:"
+inline bool isDelimiter(char c)
+{
+  switch (c) {
+  case '#':
+  case ' ':
+  case '-':
+  case '.':
+  case ',':
+  case ':':
+    return true;
+  default:
+    return false;
+  }
+}
+
+#if SKIPPY_M3U_SCAN_SSE2
+
+inline int firstSetByte(__m128i mask)
+{
+  int bits = _mm_movemask_epi8(mask);
+  return bits ? __builtin_ctz(bits) : -1;
+}
+
+#elif SKIPPY_M3U_SCAN_NEON
+
+inline int firstSetByte(uint8x16_t mask)
+{
+  // Narrow to 4 bits per byte so that the mask fits in 64 bits
+  uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+  return bits ? __builtin_ctzll(bits) / 4 : -1;
+}
+
+#endif
+
+// Validates UTF-8 data that may be split into several chunks at any byte.
+// Follows g_utf8_validate: no overlong forms, no surrogates, nothing above U+10FFFF and no NUL bytes.
+// Blocks of ASCII characters are skipped 16 bytes at a time.
+class Utf8Validator
+{
+public:
+  Utf8Validator() { reset(); }
+
+  void reset()
+  {
+    remaining = 0;
+    lower = 0x80;
+    upper = 0xBF;
+    isValid = true;
+  }
+
+  // Returns false as soon as some invalid data has been seen
+  bool feed(const char* data, size_t size)
+  {
+    const unsigned char* pos = (const unsigned char*) data;
+    const unsigned char* end = pos + size;
+
+    while (isValid && pos != end) {
+      if (remaining == 0) {
+        pos = skipAscii(pos, end);
+        if (pos == end) {
+          break;
+        }
+        beginSequence(*pos++);
+      } else {
+        unsigned char c = *pos++;
+        if (c < lower || c > upper) {
+          isValid = false;
+        }
+        lower = 0x80;
+        upper = 0xBF;
+        remaining--;
+      }
+    }
+    return isValid;
+  }
+
+  // The data must not end within a multi-byte sequence
+  bool finish() const { return isValid && remaining == 0; }
+
+private:
+  static const unsigned char* skipAscii(const unsigned char* pos, const unsigned char* end)
+  {
+#if SKIPPY_M3U_SCAN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - pos >= BLOCK_SIZE; pos += BLOCK_SIZE) {
+      __m128i block = _mm_loadu_si128((const __m128i*) pos);
+      if (_mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, zero)))) {
+        break;
+      }
+    }
+#elif SKIPPY_M3U_SCAN_NEON
+    for (; end - pos >= BLOCK_SIZE; pos += BLOCK_SIZE) {
+      uint8x16_t block = vld1q_u8(pos);
+      if (firstSetByte(vorrq_u8(vcgeq_u8(block, vdupq_n_u8(0x80)), vceqq_u8(block, vdupq_n_u8(0)))) >= 0) {
+        break;
+      }
+    }
+#endif
+    for (; pos != end && *pos > 0 && *pos < 0x80; pos++);
+    return pos;
+  }
+
+  void beginSequence(unsigned char c)
+  {
+    if (c >= 0xC2 && c <= 0xDF) {
+      remaining = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      remaining = 2;
+      if (c == 0xE0) {
+        lower = 0xA0; // Overlong
+      } else if (c == 0xED) {
+        upper = 0x9F; // Surrogates
+      }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      remaining = 3;
+      if (c == 0xF0) {
+        lower = 0x90; // Overlong
+      } else if (c == 0xF4) {
+        upper = 0x8F; // Above U+10FFFF
+      }
+    } else {
+      isValid = false;
+    }
+  }
+
+  int remaining; // Continuation bytes of the current sequence
+  unsigned char lower, upper; // Range of the next continuation byte
+  bool isValid;
+};
+
+// Returns the position of the next '\n', or end if there is none
+inline const char* findNewline(const char* pos, const char* end)
+{
+#if SKIPPY_M3U_SCAN_SSE2
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; end - pos >= BLOCK_SIZE; pos += BLOCK_SIZE) {
+    int i = firstSetByte(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) pos), newline));
+    if (i >= 0) {
+      return pos + i;
+    }
+  }
+#elif SKIPPY_M3U_SCAN_NEON
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  for (; end - pos >= BLOCK_SIZE; pos += BLOCK_SIZE) {
+    int i = firstSetByte(vceqq_u8(vld1q_u8((const uint8_t*) pos), newline));
+    if (i >= 0) {
+      return pos + i;
+    }
+  }
+#endif
+  for (; pos != end; pos++) {
+    if (*pos == '\n') {
+      break;
+    }
+  }
+  return pos;
+}
+
+// Returns the position of the next delimiter, or end if there is none.
+// Attribute values are short: a plain loop is as fast as vector code here.
+inline const char* findDelimiter(const char* pos, const char* end)
+{
+  for (; pos != end; pos++) {
+    if (isDelimiter(*pos)) {
+      break;
+    }
+  }
+  return pos;
+}
+
+}
@@ -0,0 +1,558 @@
+/*
+ * skippy_m3u8_store.cpp
+ *
+ *  Compact storage of the items of a media playlist
+ *
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "skippy_m3u8_store.hpp"
+
+using namespace std;
+
+SkippyM3UItemStore::Block::Block()
+:unusedUrlBytes(0)
+{}
+
+SkippyM3UItemStore::SkippyM3UItemStore()
+:endUs(0)
+,sequenceNo(0)
+,first(0)
+,count(0)
+{}
+
+void SkippyM3UItemStore::clear()
+{
+  endUs = 0;
+  sequenceNo = 0;
+  checkpoints.clear();
+  blocks.clear();
+  first = 0;
+  count = 0;
+  prefix.clear();
+}
+
+SkippyM3UItemStore::Block& SkippyM3UItemStore::writable(size_t blockIndex)
+{
+  // Stores are changed by one thread at a time and copies only get made from the store being changed:
+  // a block that is only referenced here can't get shared meanwhile
+  if (blocks[blockIndex].use_count() > 1) {
+    blocks[blockIndex] = make_shared<Block>(*blocks[blockIndex]);
+  }
+  return *blocks[blockIndex];
+}
+
+void SkippyM3UItemStore::slots(size_t blockIndex, size_t& from, size_t& to) const
+{
+  size_t begin = blockIndex * CHECKPOINT_INTERVAL;
+  from = max(first, begin) - begin;
+  to = min(first + count - begin, (size_t) CHECKPOINT_INTERVAL);
+}
+
+uint64_t SkippyM3UItemStore::startUs(size_t index) const
+{
+  const Block& items = block(index);
+  uint64_t start = checkpoints[(first + index) / CHECKPOINT_INTERVAL];
+  // Evicted items of the first block still count: the checkpoint is the start of its first slot
+  for (size_t i = 0; i < slot(index); i++) {
+    start += items.durations[i];
+  }
+  return start;
+}
+
+uint64_t SkippyM3UItemStore::start(size_t index) const
+{
+  return startUs(index) * US_TO_NS;
+}
+
+uint64_t SkippyM3UItemStore::endTime() const
+{
+  return endUs * US_TO_NS;
+}
+
+size_t SkippyM3UItemStore::find(uint64_t time) const
+{
+  uint64_t timeUs = time / US_TO_NS;
+
+  if (empty() || timeUs < startUs(0) || timeUs >= endUs) {
+    return size();
+  }
+
+  // Last block starting at or before the time
+  size_t blockIndex = upper_bound(checkpoints.begin(), checkpoints.end(), timeUs) - checkpoints.begin() - 1;
+  const Block& items = *blocks[blockIndex];
+  uint64_t start = checkpoints[blockIndex];
+  size_t from, to;
+
+  slots(blockIndex, from, to);
+  for (size_t i = 0; i < to; i++) {
+    uint64_t end = start + items.durations[i];
+    if (timeUs < end && i >= from) {
+      return blockIndex * CHECKPOINT_INTERVAL + i - first;
+    }
+    start = end;
+  }
+  return size();
+}
+
+bool SkippyM3UItemStore::indexOf(uint64_t mediaSequenceNo, size_t& index) const
+{
+  if (mediaSequenceNo < sequenceNo || mediaSequenceNo - sequenceNo >= size()) {
+    return false;
+  }
+  index = mediaSequenceNo - sequenceNo;
+  return true;
+}
+
+// Adds an item whose URL doesn't include the prefix
+void SkippyM3UItemStore::push(uint32_t durationUs, const char* url, size_t length)
+{
+  // First item of a new block
+  if ((first + count) % CHECKPOINT_INTERVAL == 0) {
+    blocks.push_back(make_shared<Block>());
+    checkpoints.push_back(endUs);
+  }
+
+  Block& items = writable(blocks.size() - 1);
+  size_t i = (first + count) % CHECKPOINT_INTERVAL;
+  items.durations[i] = durationUs;
+  items.urlOffsets[i] = items.urls.size();
+  items.urlLengths[i] = length;
+  items.urls.append(url, length);
+  // Slot may have been used by a truncated item
+  if (!items.rangeLengths.empty()) {
+    items.rangeStarts[i] = 0;
+    items.rangeLengths[i] = NO_RANGE;
+  }
+
+  endUs += durationUs;
+  count++;
+}
+
+void SkippyM3UItemStore::append(const SkippyM3UItem& item)
+{
+  uint32_t durationUs = (uint32_t) min<uint64_t>((item.duration + US_TO_NS / 2) / US_TO_NS, UINT32_MAX);
+
+  // The first URL determines the prefix: everything up to the last path separator
+  if (empty()) {
+    size_t pathEnd = item.url.find('?');
+    size_t slash = item.url.rfind('/', pathEnd == string::npos ? string::npos : pathEnd);
+    prefix.assign(item.url, 0, slash == string::npos ? 0 : slash + 1);
+  } else if (item.url.compare(0, prefix.size(), prefix) != 0) {
+    shrinkPrefix(item.url);
+  }
+
+  push(durationUs, item.url.data() + prefix.size(), item.url.size() - prefix.size());
+  setRange(size() - 1, item.rangeStart, item.rangeEnd);
+}
+
+bool SkippyM3UItemStore::setRange(size_t index, int64_t start, int64_t end)
+{
+  uint64_t rangeStart = end >= 0 ? (uint64_t) start : 0;
+  uint32_t rangeLength = end >= 0 ? (uint32_t) min<int64_t>(end - start, NO_RANGE - 1) : NO_RANGE;
+  Block& items = mutableBlock(index);
+  size_t i = slot(index);
+
+  // Items before the first one with a byte range get the whole resource
+  if (items.rangeLengths.empty()) {
+    if (end < 0) {
+      return false;
+    }
+    items.rangeStarts.assign(CHECKPOINT_INTERVAL, 0);
+    items.rangeLengths.assign(CHECKPOINT_INTERVAL, NO_RANGE);
+  }
+  if (items.rangeStarts[i] == rangeStart && items.rangeLengths[i] == rangeLength) {
+    return false;
+  }
+  items.rangeStarts[i] = rangeStart;
+  items.rangeLengths[i] = rangeLength;
+  return true;
+}
+
+int64_t SkippyM3UItemStore::rangeStart(size_t index) const
+{
+  const Block& items = block(index);
+  return items.rangeLengths.empty() ? 0 : (int64_t) items.rangeStarts[slot(index)];
+}
+
+int64_t SkippyM3UItemStore::rangeEnd(size_t index) const
+{
+  const Block& items = block(index);
+  size_t i = slot(index);
+  if (items.rangeLengths.empty() || items.rangeLengths[i] == NO_RANGE) {
+    return -1;
+  }
+  return (int64_t) (items.rangeStarts[i] + items.rangeLengths[i]);
+}
+
+void SkippyM3UItemStore::evictFront(size_t evicted)
+{
+  evicted = min(evicted, size());
+  if (evicted == 0) {
+    return;
+  }
+
+  // The timeline continues where the evicted items ended
+  sequenceNo += evicted;
+  if (evicted == count) {
+    blocks.clear();
+    checkpoints.clear();
+    first = 0;
+    count = 0;
+    return;
+  }
+
+  // Blocks are only dropped once all of their items are gone, their checkpoints stay valid
+  first += evicted;
+  count -= evicted;
+  while (first >= CHECKPOINT_INTERVAL) {
+    blocks.pop_front();
+    checkpoints.pop_front();
+    first -= CHECKPOINT_INTERVAL;
+  }
+}
+
+void SkippyM3UItemStore::truncate(size_t index)
+{
+  if (index >= size()) {
+    return;
+  }
+  endUs = startUs(index);
+  if (index == 0) {
+    blocks.clear();
+    checkpoints.clear();
+    first = 0;
+    count = 0;
+    return;
+  }
+
+  size_t used = (first + index + CHECKPOINT_INTERVAL - 1) / CHECKPOINT_INTERVAL;
+  size_t from, to;
+  blocks.resize(used);
+  checkpoints.resize(used);
+
+  // The rest of the last block is unused now
+  slots(used - 1, from, to);
+  count = index;
+  Block& last = writable(used - 1);
+  for (size_t i = (first + count - 1) % CHECKPOINT_INTERVAL + 1; i < to; i++) {
+    last.unusedUrlBytes += last.urlLengths[i];
+  }
+  compactUrls(used - 1);
+}
+
+bool SkippyM3UItemStore::setUrl(size_t index, const string& url)
+{
+  if (urlEquals(index, url)) {
+    return false;
+  }
+  if (url.compare(0, prefix.size(), prefix) != 0) {
+    shrinkPrefix(url);
+  }
+
+  Block& items = mutableBlock(index);
+  size_t i = slot(index);
+  size_t length = url.size() - prefix.size();
+  if (length <= items.urlLengths[i]) {
+    // Fits in place (usually the case for changed tokens)
+    url.copy(&items.urls[items.urlOffsets[i]], length, prefix.size());
+    items.unusedUrlBytes += items.urlLengths[i] - length;
+  } else {
+    items.unusedUrlBytes += items.urlLengths[i];
+    items.urlOffsets[i] = items.urls.size();
+    items.urls.append(url, prefix.size(), string::npos);
+  }
+  items.urlLengths[i] = length;
+  compactUrls((first + index) / CHECKPOINT_INTERVAL);
+  return true;
+}
+
+bool SkippyM3UItemStore::setDuration(size_t index, uint64_t duration)
+{
+  uint32_t durationUs = (uint32_t) min<uint64_t>((duration + US_TO_NS / 2) / US_TO_NS, UINT32_MAX);
+  Block& items = mutableBlock(index);
+  size_t i = slot(index);
+  uint32_t previous = items.durations[i];
+
+  if (previous == durationUs) {
+    return false;
+  }
+  items.durations[i] = durationUs;
+  // Only the following blocks start at a different time
+  for (size_t next = (first + index) / CHECKPOINT_INTERVAL + 1; next < checkpoints.size(); next++) {
+    checkpoints[next] = checkpoints[next] - previous + durationUs;
+  }
+  endUs = endUs - previous + durationUs;
+  return true;
+}
+
+void SkippyM3UItemStore::url(size_t index, string& out) const
+{
+  const Block& items = block(index);
+  size_t i = slot(index);
+  out.assign(prefix);
+  out.append(items.urls, items.urlOffsets[i], items.urlLengths[i]);
+}
+
+string SkippyM3UItemStore::url(size_t index) const
+{
+  string out;
+  url(index, out);
+  return out;
+}
+
+bool SkippyM3UItemStore::urlEquals(size_t index, const string& url) const
+{
+  const Block& items = block(index);
+  size_t i = slot(index);
+  return url.size() == prefix.size() + items.urlLengths[i]
+    && url.compare(0, prefix.size(), prefix) == 0
+    && url.compare(prefix.size(), items.urlLengths[i], items.urls, items.urlOffsets[i], items.urlLengths[i]) == 0;
+}
+
+// Makes the prefix the common part of the current prefix and the URL, prepending the rest to all stored URLs
+void SkippyM3UItemStore::shrinkPrefix(const string& url)
+{
+  size_t common = 0;
+  while (common < prefix.size() && common < url.size() && prefix[common] == url[common]) {
+    common++;
+  }
+
+  string moved(prefix, common, string::npos);
+  for (size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+    Block& items = writable(blockIndex);
+    size_t from, to;
+    string rebuilt;
+
+    slots(blockIndex, from, to);
+    rebuilt.reserve(items.urls.size() - items.unusedUrlBytes + moved.size() * (to - from));
+    for (size_t i = from; i < to; i++) {
+      uint32_t offset = rebuilt.size();
+      rebuilt.append(moved);
+      rebuilt.append(items.urls, items.urlOffsets[i], items.urlLengths[i]);
+      items.urlOffsets[i] = offset;
+      items.urlLengths[i] += moved.size();
+    }
+    items.urls.swap(rebuilt);
+    items.unusedUrlBytes = 0;
+  }
+  prefix.resize(common);
+}
+
+// Removes unused bytes from the arena of a block once they make up half of it
+void SkippyM3UItemStore::compactUrls(size_t blockIndex)
+{
+  size_t from, to;
+
+  if (blocks[blockIndex]->unusedUrlBytes == 0 || blocks[blockIndex]->unusedUrlBytes < blocks[blockIndex]->urls.size() / 2) {
+    return;
+  }
+
+  Block& items = writable(blockIndex);
+
+  string compacted;
+  slots(blockIndex, from, to);
+  compacted.reserve(items.urls.size() - items.unusedUrlBytes);
+  for (size_t i = from; i < to; i++) {
+    uint32_t offset = compacted.size();
+    compacted.append(items.urls, items.urlOffsets[i], items.urlLengths[i]);
+    items.urlOffsets[i] = offset;
+  }
+  items.urls.swap(compacted);
+  items.unusedUrlBytes = 0;
+}
+
+size_t SkippyM3UItemStore::memoryUsage() const
+{
+  size_t bytes = prefix.capacity() + checkpoints.size() * sizeof(uint64_t);
+  for (const shared_ptr<Block>& items : blocks) {
+    bytes += sizeof(Block)
+      + items->urls.capacity()
+      + items->rangeStarts.capacity() * sizeof(uint64_t)
+      + items->rangeLengths.capacity() * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+// Header of the binary form
+struct SkippyM3UItemStoreHeader
+{
+  uint64_t origin;
+  uint64_t sequenceNo;
+  uint32_t count;
+  uint32_t prefixLength;
+  uint64_t urlBytes;
+  uint32_t rangeCount; // 0 or count
+  uint32_t reserved;
+};
+
+static size_t padded(size_t size)
+{
+  return (size + 7) & ~(size_t) 7;
+}
+
+static void appendPadded(string& out, const void* data, size_t size)
+{
+  out.append((const char*) data, size);
+  out.append(padded(size) - size, '\0');
+}
+
+// Whether a section of the given size (padded) is left, without overflowing on sizes read from the data
+static bool hasPadded(const char* pos, const char* end, uint64_t size)
+{
+  uint64_t left = (uint64_t) (end - pos);
+  return size <= left && ((size + 7) & ~(uint64_t) 7) <= left;
+}
+
+// Reads with memcpy: the data may come from a mapped file without any alignment
+static bool readPadded(const char*& pos, const char* end, void* data, size_t size)
+{
+  if (!hasPadded(pos, end, size)) {
+    return false;
+  }
+  memcpy(data, pos, size);
+  pos += padded(size);
+  return true;
+}
+
+void SkippyM3UItemStore::serialize(string& out) const
+{
+  SkippyM3UItemStoreHeader header;
+  bool hasRanges = false;
+
+  memset(&header, 0, sizeof(header));
+  header.origin = empty() ? endUs : startUs(0);
+  header.sequenceNo = sequenceNo;
+  header.count = size();
+  header.prefixLength = prefix.size();
+  for (size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+    size_t from, to;
+    slots(blockIndex, from, to);
+    for (size_t i = from; i < to; i++) {
+      header.urlBytes += blocks[blockIndex]->urlLengths[i];
+    }
+    hasRanges = hasRanges || !blocks[blockIndex]->rangeLengths.empty();
+  }
+  header.rangeCount = hasRanges ? size() : 0;
+
+  out.reserve(out.size() + sizeof(header) + padded(prefix.size()) + 2 * padded(size() * sizeof(uint32_t)) + padded(header.urlBytes)
+    + (hasRanges ? padded(size() * sizeof(uint64_t)) + padded(size() * sizeof(uint32_t)) : 0));
+  appendPadded(out, &header, sizeof(header));
+  appendPadded(out, prefix.data(), prefix.size());
+
+  // Arrays of the blocks one after the other, then the URLs in item order (without the unused bytes of the arenas)
+  size_t section = out.size();
+  for (size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+    size_t from, to;
+    slots(blockIndex, from, to);
+    out.append((const char*) (blocks[blockIndex]->durations + from), (to - from) * sizeof(uint32_t));
+  }
+  out.append(padded(out.size() - section) - (out.size() - section), '\0');
+
+  section = out.size();
+  for (size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+    size_t from, to;
+    slots(blockIndex, from, to);
+    out.append((const char*) (blocks[blockIndex]->urlLengths + from), (to - from) * sizeof(uint32_t));
+  }
+  out.append(padded(out.size() - section) - (out.size() - section), '\0');
+
+  section = out.size();
+  for (size_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+    const Block& items = *blocks[blockIndex];
+    size_t from, to;
+    slots(blockIndex, from, to);
+    for (size_t i = from; i < to; i++) {
+      out.append(items.urls, items.urlOffsets[i], items.urlLengths[i]);
+    }
+  }
+  out.append(padded(out.size() - section) - (out.size() - section), '\0');
+
+  if (hasRanges) {
+    for (size_t index = 0; index < size(); index++) {
+      uint64_t rangeStart = this->rangeStart(index);
+      out.append((const char*) &rangeStart, sizeof(rangeStart));
+    }
+    out.append(padded(size() * sizeof(uint64_t)) - size() * sizeof(uint64_t), '\0');
+    for (size_t index = 0; index < size(); index++) {
+      const Block& items = block(index);
+      uint32_t rangeLength = items.rangeLengths.empty() ? (uint32_t) NO_RANGE : items.rangeLengths[slot(index)];
+      out.append((const char*) &rangeLength, sizeof(rangeLength));
+    }
+    out.append(padded(size() * sizeof(uint32_t)) - size() * sizeof(uint32_t), '\0');
+  }
+}
+
+bool SkippyM3UItemStore::deserialize(const char* data, size_t size)
+{
+  const char* pos = data;
+  const char* end = data + size;
+  SkippyM3UItemStoreHeader header;
+
+  // Sizes come from the data: each section is checked against what is left before anything gets allocated
+  clear();
+  if (!readPadded(pos, end, &header, sizeof(header))
+    || !hasPadded(pos, end, header.prefixLength)) {
+    return false;
+  }
+  const char* prefixData = pos;
+  pos += padded(header.prefixLength);
+
+  uint64_t arrayBytes = (uint64_t) header.count * sizeof(uint32_t);
+  if (!hasPadded(pos, end, arrayBytes)
+    || !hasPadded(pos + padded(arrayBytes), end, arrayBytes)) {
+    return false;
+  }
+  const char* durationData = pos;
+  const char* lengthData = pos + padded(arrayBytes);
+  pos += 2 * padded(arrayBytes);
+
+  uint64_t urlBytes = 0;
+  for (size_t i = 0; i < header.count; i++) {
+    uint32_t length;
+    memcpy(&length, lengthData + i * sizeof(uint32_t), sizeof(length));
+    urlBytes += length;
+  }
+  if (urlBytes != header.urlBytes || !hasPadded(pos, end, urlBytes)) {
+    return false;
+  }
+  const char* urlData = pos;
+  pos += padded(header.urlBytes);
+
+  const char* rangeStartData = NULL;
+  const char* rangeLengthData = NULL;
+  if (header.rangeCount) {
+    if (header.rangeCount != header.count
+      || !hasPadded(pos, end, (uint64_t) header.count * sizeof(uint64_t))
+      || !hasPadded(pos + padded(header.count * sizeof(uint64_t)), end, arrayBytes)) {
+      return false;
+    }
+    rangeStartData = pos;
+    rangeLengthData = pos + padded(header.count * sizeof(uint64_t));
+  }
+
+  // Reads with memcpy: the data may come from a mapped file without any alignment
+  prefix.assign(prefixData, header.prefixLength);
+  endUs = header.origin;
+  for (size_t i = 0; i < header.count; i++) {
+    uint32_t durationUs, length;
+    memcpy(&durationUs, durationData + i * sizeof(uint32_t), sizeof(durationUs));
+    memcpy(&length, lengthData + i * sizeof(uint32_t), sizeof(length));
+    push(durationUs, urlData, length);
+    urlData += length;
+
+    if (rangeStartData) {
+      uint64_t rangeStart;
+      uint32_t rangeLength;
+      memcpy(&rangeStart, rangeStartData + i * sizeof(uint64_t), sizeof(rangeStart));
+      memcpy(&rangeLength, rangeLengthData + i * sizeof(uint32_t), sizeof(rangeLength));
+      if (rangeLength != NO_RANGE) {
+        setRange(i, (int64_t) rangeStart, (int64_t) (rangeStart + rangeLength));
+      }
+    }
+  }
+  sequenceNo = header.sequenceNo;
+  return true;
+}
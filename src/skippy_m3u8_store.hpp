@@ -0,0 +1,131 @@
+/*
+ * skippy_m3u8_store.hpp
+ *
+ *  Compact storage of the items of a media playlist
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+
+#include "skippy_m3u8_parser.hpp"
+
+// Stores the playlist items as separate arrays instead of an array of SkippyM3UItem:
+//
+// - durations in microseconds, from which start times are derived (start and end are never stored),
+//   with the absolute start of every CHECKPOINT_INTERVAL-th item to avoid summing up the whole list,
+// - URLs in contiguous arenas, without the prefix they share (stored once),
+// - byte ranges as offsets and lengths, only once an item has one.
+//
+// Items are kept in blocks of CHECKPOINT_INTERVAL, each with its own URL arena: evicting items from the front
+// only drops the blocks they fill entirely, so a live refresh costs what it evicts and appends, not the window.
+// Copies of a store share their blocks until one of them changes a block (copy on write): the copy made for
+// each playlist snapshot only duplicates the blocks that the refresh touches.
+//
+// Full URL strings are only built on demand. Keys and IVs are not stored (encryption is not supported).
+class SkippyM3UItemStore
+{
+public:
+  enum { CHECKPOINT_INTERVAL = 64 };
+
+  SkippyM3UItemStore();
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  void clear();
+
+  // Appends an item right after the last one (start time of the item is ignored)
+  void append(const SkippyM3UItem& item);
+  // Removes the first count items (the timeline of the remaining ones doesn't change)
+  void evictFront(size_t count);
+  // Removes all items from index on
+  void truncate(size_t index);
+
+  // These return true if the value changed
+  bool setUrl(size_t index, const std::string& url);
+  bool setDuration(size_t index, uint64_t duration);
+  bool setRange(size_t index, int64_t start, int64_t end);
+
+  // Times are in nanoseconds
+  uint64_t start(size_t index) const;
+  uint64_t duration(size_t index) const { return (uint64_t) block(index).durations[slot(index)] * US_TO_NS; }
+  uint64_t end(size_t index) const { return start(index) + duration(index); }
+  // End of the last item (or the start of the timeline when empty)
+  uint64_t endTime() const;
+  // Index of the item playing at the time, or size() if there is none (binary search on the checkpoints)
+  size_t find(uint64_t time) const;
+
+  // Media sequence numbers are consecutive from the first item on
+  uint64_t firstSequenceNo() const { return sequenceNo; }
+  void setFirstSequenceNo(uint64_t first) { sequenceNo = first; }
+  // Returns false if no item has this sequence number
+  bool indexOf(uint64_t mediaSequenceNo, size_t& index) const;
+
+  std::string url(size_t index) const;
+  // Builds the URL into a string that can be re-used to avoid allocations
+  void url(size_t index, std::string& out) const;
+  bool urlEquals(size_t index, const std::string& url) const;
+
+  // Byte range of the URL (end excluded), the end is -1 for the whole resource
+  int64_t rangeStart(size_t index) const;
+  int64_t rangeEnd(size_t index) const;
+
+  // Approximate heap usage in bytes
+  size_t memoryUsage() const;
+
+  // Binary form in native byte order: a header, the durations, the URL lengths, the URL blob
+  // and the byte ranges (if any), each section padded to 8 bytes. Appended to out.
+  void serialize(std::string& out) const;
+  // Replaces the content, returns false (and leaves the store empty) if the data is not a serialized store
+  bool deserialize(const char* data, size_t size);
+
+private:
+  enum { US_TO_NS = 1000 };
+  enum : uint32_t { NO_RANGE = UINT32_MAX };
+
+  // Items of one checkpoint interval
+  struct Block
+  {
+    Block();
+
+    uint32_t durations[CHECKPOINT_INTERVAL]; // Microseconds
+    uint32_t urlOffsets[CHECKPOINT_INTERVAL];
+    uint32_t urlLengths[CHECKPOINT_INTERVAL];
+    std::string urls;
+    size_t unusedUrlBytes;
+
+    // Byte ranges, empty while no item of the block has one
+    std::vector<uint64_t> rangeStarts;
+    std::vector<uint32_t> rangeLengths; // NO_RANGE for the whole resource
+  };
+
+  // Items are addressed in the blocks from the first one not evicted yet
+  const Block& block(size_t index) const { return *blocks[(first + index) / CHECKPOINT_INTERVAL]; }
+  Block& mutableBlock(size_t index) { return writable((first + index) / CHECKPOINT_INTERVAL); }
+  // Copies the block first if another store shares it
+  Block& writable(size_t blockIndex);
+  size_t slot(size_t index) const { return (first + index) % CHECKPOINT_INTERVAL; }
+  // Slots of the block used by items of the store
+  void slots(size_t blockIndex, size_t& from, size_t& to) const;
+
+  uint64_t startUs(size_t index) const;
+  void push(uint32_t durationUs, const char* url, size_t length);
+  void shrinkPrefix(const std::string& url);
+  void compactUrls(size_t blockIndex);
+
+  // Timing
+  uint64_t endUs; // End of the last item (microseconds)
+  uint64_t sequenceNo; // Of the first item
+  std::deque<uint64_t> checkpoints; // Start of the first slot of every block (microseconds)
+
+  // Items
+  std::deque<std::shared_ptr<Block> > blocks;
+  size_t first; // Slots of the first block whose items have been evicted
+  size_t count;
+  std::string prefix;
+};
\ No newline at end of file
@@ -29,6 +29,10 @@
 
 #include "skippy_fragment.h"
 #include "skippy_uridownloader.h"
+#include "skippy_fragment_cache.h"
+#ifdef SKIPPY_HLS_CURL
+#include "skippy_curl_session.h"
+#endif
 
 #include <string.h>
 
@@ -39,6 +43,11 @@ GST_DEBUG_CATEGORY (skippy_uridownloader_debug);
 
 G_DEFINE_TYPE (SkippyUriDownloader, skippy_uri_downloader, GST_TYPE_BIN);
 
+// Download messages are posted at most this often, unless the percentage moved by the step
+// or the download is complete
+#define PROGRESS_MESSAGE_INTERVAL (100 * GST_MSECOND)
+#define PROGRESS_MESSAGE_PERCENT_STEP 10
+
 #define SKIPPY_URI_DOWNLOADER_GET_PRIVATE(obj)  \
    (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
     TYPE_SKIPPY_URI_DOWNLOADER, SkippyUriDownloaderPrivate))
@@ -66,7 +75,33 @@ struct _SkippyUriDownloaderPrivate
   gsize bytes_loaded;
   gsize bytes_total;
 
+  // Copies of the counters above for the progress getter (g_atomic_int access only, capped at G_MAXINT)
+  gint progress_loaded;
+  gint progress_total;
+  // Last posted download message
+  GstClockTime progress_message_time;
+  guint progress_message_percent;
+
   gulong urisrcpad_probe_id;
+
+  SkippyUriDownloaderDataCallback data_callback;
+  gpointer data_callback_user_data;
+  SkippyUriDownloaderCallback progress_callback;
+
+  // Data that doesn't come from the URI source gets pushed into typefind directly
+  GstPad *typefindsinkpad;
+  gboolean sent_stream_start;
+
+  // Set under the object lock, the fetch takes its own reference into fetch_cache
+  SkippyFragmentCache *cache;
+  // Cache of the current fetch (NULL when it doesn't use it) and references to the buffers pushed downstream
+  SkippyFragmentCache *fetch_cache;
+  GstBufferList *cache_buffers;
+
+#ifdef SKIPPY_HLS_CURL
+  // HTTP(S) fetches go through libcurl instead of a URI source element
+  SkippyCurlTransfer *transfer;
+#endif
 };
 
 static GstStaticPadTemplate srcpadtemplate = GST_STATIC_PAD_TEMPLATE ("src",
@@ -132,6 +167,19 @@ skippy_uri_downloader_init (SkippyUriDownloader * downloader)
   downloader->priv->download_canceled = FALSE;
   downloader->priv->previous_was_interrupted = FALSE;
   downloader->priv->urisrcpad_probe_id = 0;
+  downloader->priv->data_callback = NULL;
+  downloader->priv->data_callback_user_data = NULL;
+  downloader->priv->progress_callback = NULL;
+  downloader->priv->progress_loaded = 0;
+  downloader->priv->progress_total = 0;
+  downloader->priv->typefindsinkpad = NULL;
+  downloader->priv->sent_stream_start = FALSE;
+  downloader->priv->cache = NULL;
+  downloader->priv->fetch_cache = NULL;
+  downloader->priv->cache_buffers = NULL;
+#ifdef SKIPPY_HLS_CURL
+  downloader->priv->transfer = skippy_curl_transfer_new ();
+#endif
 
   // Add typefind
   downloader->priv->typefind = gst_element_factory_make ("typefind", NULL);
@@ -222,14 +270,27 @@ skippy_uri_downloader_reset (SkippyUriDownloader * downloader, SkippyFragment* n
     downloader->priv->bytes_loaded = 0;
     downloader->priv->bytes_total = 0;
     downloader->priv->previous_was_interrupted = FALSE;
+    g_atomic_int_set (&downloader->priv->progress_loaded, 0);
+    g_atomic_int_set (&downloader->priv->progress_total, 0);
   }
 
   downloader->priv->got_segment = FALSE;
   downloader->priv->flushing = FALSE;
+  downloader->priv->progress_message_time = GST_CLOCK_TIME_NONE;
+  downloader->priv->progress_message_percent = 0;
 
   // Clear error when present
   g_clear_error (&downloader->priv->err);
 
+  if (downloader->priv->fetch_cache) {
+    skippy_fragment_cache_unref (downloader->priv->fetch_cache);
+    downloader->priv->fetch_cache = NULL;
+  }
+  if (downloader->priv->cache_buffers) {
+    gst_buffer_list_unref (downloader->priv->cache_buffers);
+    downloader->priv->cache_buffers = NULL;
+  }
+
   // Unref fragment model
   if (downloader->priv->fragment) {
     g_object_unref (downloader->priv->fragment);
@@ -288,6 +349,23 @@ skippy_uri_downloader_dispose (GObject * object)
     gst_element_set_state (downloader->priv->urisrc, GST_STATE_NULL);
   }
 
+  if (downloader->priv->typefindsinkpad) {
+    gst_object_unref (downloader->priv->typefindsinkpad);
+    downloader->priv->typefindsinkpad = NULL;
+  }
+
+  if (downloader->priv->cache) {
+    skippy_fragment_cache_unref (downloader->priv->cache);
+    downloader->priv->cache = NULL;
+  }
+
+#ifdef SKIPPY_HLS_CURL
+  if (downloader->priv->transfer) {
+    skippy_curl_transfer_free (downloader->priv->transfer);
+    downloader->priv->transfer = NULL;
+  }
+#endif
+
   // Dispose base class
   G_OBJECT_CLASS (skippy_uri_downloader_parent_class)->dispose (object);
 
@@ -311,23 +389,81 @@ void
 skippy_uri_downloader_prepare (SkippyUriDownloader * downloader, gchar* uri)
 {
   g_mutex_lock (&downloader->priv->download_lock);
+#ifdef SKIPPY_HLS_CURL
+  // No source element needed for these
+  if (skippy_curl_handles_uri (uri)) {
+    g_mutex_unlock (&downloader->priv->download_lock);
+    return;
+  }
+#endif
   skippy_uri_downloader_create_src (downloader, uri);
   g_mutex_unlock (&downloader->priv->download_lock);
 }
 
-// Getter for buffer - can not be called concurrently with fetch & prepare
+// Getter for buffer (NULL when nothing was downloaded) - can not be called concurrently with fetch & prepare
 //
 // MT-safe
 GstBuffer* skippy_uri_downloader_get_buffer (SkippyUriDownloader *downloader)
 {
-  GstBuffer* buf;
+  GstBuffer* buf = NULL;
   g_mutex_lock (&downloader->priv->download_lock);
-  buf = gst_buffer_ref(downloader->priv->buffer);
+  if (downloader->priv->buffer) {
+    buf = gst_buffer_ref(downloader->priv->buffer);
+  }
   g_mutex_unlock (&downloader->priv->download_lock);
   return buf;
 }
 
-// Handles received bytes info: Called by URL source element streaming thread. Triggers custom message about media byte-interval loaded.
+// Setter for data callback - can not be called concurrently with fetch & prepare
+//
+// MT-safe
+void skippy_uri_downloader_set_data_callback (SkippyUriDownloader *downloader, SkippyUriDownloaderDataCallback callback,
+  gpointer user_data)
+{
+  g_mutex_lock (&downloader->priv->download_lock);
+  downloader->priv->data_callback = callback;
+  downloader->priv->data_callback_user_data = user_data;
+  g_mutex_unlock (&downloader->priv->download_lock);
+}
+
+// Setter for progress callback - can not be called concurrently with fetch & prepare
+//
+// MT-safe
+void skippy_uri_downloader_set_progress_callback (SkippyUriDownloader *downloader, SkippyUriDownloaderCallback callback)
+{
+  g_mutex_lock (&downloader->priv->download_lock);
+  downloader->priv->progress_callback = callback;
+  g_mutex_unlock (&downloader->priv->download_lock);
+}
+
+// Setter for the fragment cache (NULL to stop using it), applies from the next fetch on
+//
+// MT-safe
+void skippy_uri_downloader_set_fragment_cache (SkippyUriDownloader *downloader, SkippyFragmentCache *cache)
+{
+  GST_OBJECT_LOCK (downloader);
+  if (downloader->priv->cache) {
+    skippy_fragment_cache_unref (downloader->priv->cache);
+  }
+  downloader->priv->cache = cache ? skippy_fragment_cache_ref (cache) : NULL;
+  GST_OBJECT_UNLOCK (downloader);
+}
+
+// Getter for progress of the current download - never blocks, the two values are read independently
+//
+// MT-safe
+void skippy_uri_downloader_get_progress (SkippyUriDownloader *downloader, gsize *bytes_loaded, gsize *bytes_total)
+{
+  if (bytes_loaded) {
+    *bytes_loaded = (gsize) g_atomic_int_get (&downloader->priv->progress_loaded);
+  }
+  if (bytes_total) {
+    *bytes_total = (gsize) g_atomic_int_get (&downloader->priv->progress_total);
+  }
+}
+
+// Handles received bytes info: Called by URL source element streaming thread. Updates the progress counters, calls the
+// progress callback and triggers custom message about media byte-interval loaded (rate-limited).
 // Download mutex is locked when this is called (only while fetch executes).
 static void
 skippy_uri_downloader_handle_bytes_received (SkippyUriDownloader* downloader,
@@ -335,17 +471,36 @@ skippy_uri_downloader_handle_bytes_received (SkippyUriDownloader* downloader,
   gsize bytes_loaded, gsize bytes_total)
 {
   GstStructure* s;
-  float percentage = 100.0f * bytes_loaded / bytes_total;
+  GstClockTime now;
+  guint percent = bytes_total ? (guint) (100 * (guint64) bytes_loaded / bytes_total) : 0;
+
+  g_atomic_int_set (&downloader->priv->progress_loaded, (gint) MIN (bytes_loaded, G_MAXINT));
+  g_atomic_int_set (&downloader->priv->progress_total, (gint) MIN (bytes_total, G_MAXINT));
+
+  if (downloader->priv->progress_callback) {
+    downloader->priv->progress_callback (downloader, start_time, stop_time, bytes_loaded, bytes_total);
+  }
 
   // Be silent if we are not linked
   if (!gst_pad_is_linked (downloader->priv->srcpad)) {
     return;
   }
 
-  GST_TRACE ("Loaded %" G_GSIZE_FORMAT " bytes of %" G_GSIZE_FORMAT " -> %f percent of media interval %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT " seconds",
+  // Only post when enough time passed or progress was made since the last message, and always on completion
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (downloader->priv->progress_message_time)
+    && now - downloader->priv->progress_message_time < PROGRESS_MESSAGE_INTERVAL
+    && percent < downloader->priv->progress_message_percent + PROGRESS_MESSAGE_PERCENT_STEP
+    && (bytes_total == 0 || bytes_loaded < bytes_total)) {
+    return;
+  }
+  downloader->priv->progress_message_time = now;
+  downloader->priv->progress_message_percent = percent;
+
+  GST_TRACE ("Loaded %" G_GSIZE_FORMAT " bytes of %" G_GSIZE_FORMAT " -> %u percent of media interval %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT " seconds",
     bytes_loaded,
     bytes_total,
-    percentage,
+    percent,
     GST_TIME_ARGS (start_time),
     GST_TIME_ARGS (stop_time)
   );
@@ -492,6 +647,92 @@ static void skippy_uri_downloader_handle_message (GstBin * bin, GstMessage * mes
   }
 }
 
+// Counts received bytes on the fragment and posts the progress message
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_count_bytes (SkippyUriDownloader* downloader, gsize bytes)
+{
+  // Increment size on fragment model
+  if (downloader->priv->fragment->size == 0) {
+    downloader->priv->fragment->download_first_byte_time = gst_util_get_timestamp ();
+  }
+  downloader->priv->fragment->size += bytes;
+  // Count bytes up
+  downloader->priv->bytes_loaded += bytes;
+  // Triggers message
+  skippy_uri_downloader_handle_bytes_received (downloader,
+    downloader->priv->fragment->start_time, downloader->priv->fragment->stop_time,
+    downloader->priv->bytes_loaded, downloader->priv->bytes_total);
+}
+
+// A single block of memory, allocated for the expected total size once known (and grown by doubling otherwise),
+// so data is copied once and consumers can map it without merging.
+void
+skippy_uri_downloader_append (GstBuffer** aggregate, const guint8* data, gsize bytes, gsize expected_size)
+{
+  GstBuffer *grown;
+  GstMapInfo grown_info;
+  gsize size = 0, capacity = 0, needed;
+
+  if (*aggregate) {
+    size = gst_buffer_get_sizes (*aggregate, NULL, &capacity);
+  }
+  needed = size + bytes;
+
+  // Allocate a new block when we don't have one, it is too small or it is shared
+  if (!*aggregate || needed > capacity || !gst_buffer_is_writable (*aggregate) || gst_buffer_n_memory (*aggregate) != 1) {
+    capacity = MAX (needed, MAX (expected_size, 2 * capacity));
+    GST_TRACE ("Allocating %" G_GSIZE_FORMAT " bytes for the download", capacity);
+    grown = gst_buffer_new_allocate (NULL, capacity, NULL);
+    gst_buffer_set_size (grown, size);
+    if (*aggregate) {
+      if (gst_buffer_map (grown, &grown_info, GST_MAP_WRITE)) {
+        gst_buffer_extract (*aggregate, 0, grown_info.data, size);
+        gst_buffer_unmap (grown, &grown_info);
+      }
+      gst_buffer_unref (*aggregate);
+    }
+    *aggregate = grown;
+  }
+
+  gst_buffer_set_size (*aggregate, needed);
+  gst_buffer_fill (*aggregate, size, data, bytes);
+}
+
+// Appends received data to our own buffer and lets our consumer process it while the download is ongoing.
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_collect (SkippyUriDownloader* downloader, GstBuffer* buf)
+{
+  GstMapInfo info;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (downloader, "Could not map received data");
+    return;
+  }
+
+  skippy_uri_downloader_append (&downloader->priv->buffer, info.data, info.size, downloader->priv->bytes_total);
+
+  if (downloader->priv->data_callback) {
+    downloader->priv->data_callback (downloader, info.data, info.size, downloader->priv->data_callback_user_data);
+  }
+  gst_buffer_unmap (buf, &info);
+}
+
+// Keeps a reference to data that gets pushed downstream when the download is going to be cached (nothing is copied,
+// the cache writer maps the buffers in the background)
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_keep_for_cache (SkippyUriDownloader* downloader, GstBuffer* buf)
+{
+  if (downloader->priv->fetch_cache) {
+    if (!downloader->priv->cache_buffers) {
+      downloader->priv->cache_buffers = gst_buffer_list_new ();
+    }
+    gst_buffer_list_add (downloader->priv->cache_buffers, gst_buffer_ref (buf));
+  }
+}
+
 // Probe buffers from URI src streaming thread
 // Download mutex is locked when this is called (only while fetch executes).
 static GstPadProbeReturn
@@ -514,29 +755,16 @@ skippy_uri_downloader_src_probe_buffer (GstPad *pad, GstPadProbeInfo *info, gpoi
     return GST_PAD_PROBE_DROP;
   }
 
-  // Increment size on fragment model
-  downloader->priv->fragment->size += bytes;
-  // Count bytes up
-  downloader->priv->bytes_loaded += bytes;
-  // Triggers message
-  skippy_uri_downloader_handle_bytes_received (downloader,
-    downloader->priv->fragment->start_time, downloader->priv->fragment->stop_time,
-    downloader->priv->bytes_loaded, downloader->priv->bytes_total);
+  skippy_uri_downloader_count_bytes (downloader, bytes);
 
   // This is only if we are not linked: Drop the buffer and append to our own
   // internal buffer.
   if (!gst_pad_is_linked (downloader->priv->srcpad)) {
-
-    // Copy and append buffer to download aggregate
-    if (downloader->priv->buffer == NULL) {
-      downloader->priv->buffer = gst_buffer_new ();
-    }
-    // Append the buffer into the internal storage (transfers full ownership of the copy)
-    // We rather copy because the original is still owned by the pad at this point
-    downloader->priv->buffer = gst_buffer_append (downloader->priv->buffer, gst_buffer_copy(buf));
+    skippy_uri_downloader_collect (downloader, buf);
     // Drop this buffer (this will return FLOW_OK to internal src)
     return GST_PAD_PROBE_DROP;
   }
+  skippy_uri_downloader_keep_for_cache (downloader, buf);
   // Otherwise keep the probe and go one with regular streaming
   return GST_PAD_PROBE_OK;
 }
@@ -771,6 +999,184 @@ skippy_uri_downloader_handle_failure (SkippyUriDownloader * downloader, GError *
   return SKIPPY_URI_DOWNLOADER_FAILED;
 }
 
+// Sends what a URI source would send before the data of a fetch
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_send_events (SkippyUriDownloader * downloader, SkippyFragment* fragment)
+{
+  GstSegment segment;
+  gchar *stream_id;
+
+  if (!downloader->priv->typefindsinkpad) {
+    downloader->priv->typefindsinkpad = gst_element_get_static_pad (downloader->priv->typefind, "sink");
+  }
+
+  if (!downloader->priv->sent_stream_start) {
+    stream_id = g_strdup_printf ("%08x", g_random_int ());
+    gst_pad_send_event (downloader->priv->typefindsinkpad, gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+    downloader->priv->sent_stream_start = TRUE;
+  }
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  segment.start = segment.position = fragment->range_start;
+  gst_pad_send_event (downloader->priv->typefindsinkpad, gst_event_new_segment (&segment));
+}
+
+// Serves the fragment from the cache like a download: returns FALSE if it isn't cached
+// Download mutex is locked when this is called (only while fetch executes).
+static gboolean
+skippy_uri_downloader_fetch_from_cache (SkippyUriDownloader * downloader, SkippyFragment* fragment)
+{
+  GstBuffer *buf;
+  GstMapInfo info;
+  gsize size;
+
+  buf = skippy_fragment_cache_lookup (downloader->priv->fetch_cache, fragment->uri, fragment->range_start, fragment->range_end);
+  if (!buf) {
+    return FALSE;
+  }
+  size = gst_buffer_get_size (buf);
+  GST_DEBUG_OBJECT (downloader, "Serving %s from the cache (%" G_GSIZE_FORMAT " bytes)", fragment->uri, size);
+
+  // No first byte time: this is not a network measurement
+  fragment->size = size;
+  downloader->priv->bytes_loaded = size;
+  downloader->priv->bytes_total = size;
+  downloader->priv->got_segment = TRUE;
+  skippy_uri_downloader_handle_bytes_received (downloader, fragment->start_time, fragment->stop_time, size, size);
+
+  if (!gst_pad_is_linked (downloader->priv->srcpad)) {
+    // The data stays mapped from the file
+    if (downloader->priv->data_callback && gst_buffer_map (buf, &info, GST_MAP_READ)) {
+      downloader->priv->data_callback (downloader, info.data, info.size, downloader->priv->data_callback_user_data);
+      gst_buffer_unmap (buf, &info);
+    }
+    gst_buffer_replace (&downloader->priv->buffer, buf);
+    gst_buffer_unref (buf);
+  } else {
+    skippy_uri_downloader_send_events (downloader, fragment);
+    if (gst_pad_chain (downloader->priv->typefindsinkpad, buf) != GST_FLOW_OK) {
+      GST_DEBUG_OBJECT (downloader, "Downstream did not accept data");
+    }
+  }
+
+  skippy_uri_downloader_handle_eos (downloader);
+  return TRUE;
+}
+
+// Hands the data of a completed download to the cache (written in the background)
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_store_in_cache (SkippyUriDownloader * downloader, SkippyFragment* fragment)
+{
+  GstBufferList *buffers = NULL;
+
+  if (!downloader->priv->fetch_cache) {
+    return;
+  }
+  if (gst_pad_is_linked (downloader->priv->srcpad)) {
+    buffers = downloader->priv->cache_buffers ? gst_buffer_list_ref (downloader->priv->cache_buffers) : NULL;
+  } else if (downloader->priv->buffer) {
+    buffers = gst_buffer_list_new_sized (1);
+    gst_buffer_list_add (buffers, gst_buffer_ref (downloader->priv->buffer));
+  }
+  if (buffers) {
+    skippy_fragment_cache_store (downloader->priv->fetch_cache, fragment->uri, fragment->range_start, fragment->range_end, buffers);
+    gst_buffer_list_unref (buffers);
+  }
+}
+
+#ifdef SKIPPY_HLS_CURL
+// Takes a block of data from the transfer: it gets collected into our buffer (unlinked) or pushed as it is
+// Download mutex is locked when this is called (only while fetch executes).
+static void
+skippy_uri_downloader_curl_handle_data (SkippyUriDownloader * downloader, GstMemory* memory)
+{
+  GstBuffer *buf = gst_buffer_new ();
+
+  gst_buffer_append_memory (buf, memory);
+  skippy_uri_downloader_count_bytes (downloader, gst_buffer_get_size (buf));
+
+  // This is only if we are not linked
+  if (!gst_pad_is_linked (downloader->priv->srcpad)) {
+    skippy_uri_downloader_collect (downloader, buf);
+    gst_buffer_unref (buf);
+    return;
+  }
+
+  skippy_uri_downloader_keep_for_cache (downloader, buf);
+  if (gst_pad_chain (downloader->priv->typefindsinkpad, buf) != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (downloader, "Downstream did not accept data");
+  }
+}
+
+// Fetches the fragment with a curl transfer instead of the URI source element
+// Download mutex is locked when this is called (only while fetch executes).
+static SkippyUriDownloaderFetchReturn
+skippy_uri_downloader_fetch_with_curl (SkippyUriDownloader * downloader, SkippyFragment* fragment,
+  const gchar * referer, gboolean compress, gboolean refresh, gboolean allow_cache, GError ** err)
+{
+  SkippyCurlTransfer *transfer = downloader->priv->transfer;
+  SkippyCurlTransferStatus status;
+  GstMemory *memory = NULL;
+  GError *transfer_err = NULL;
+  gint64 content_length;
+
+  GST_TRACE_OBJECT (downloader, "Fetching the URI %s with curl", fragment->uri);
+
+  skippy_curl_transfer_start (transfer, fragment->uri, referer, compress, refresh, allow_cache,
+    fragment->range_start, fragment->range_end);
+
+  // Cancellations before the start did not reach the transfer
+  GST_OBJECT_LOCK (downloader);
+  downloader->priv->fetching = TRUE;
+  if (fragment->cancelled || downloader->priv->download_canceled) {
+    skippy_curl_transfer_cancel (transfer);
+  }
+  GST_OBJECT_UNLOCK (downloader);
+
+  if (gst_pad_is_linked (downloader->priv->srcpad)) {
+    skippy_uri_downloader_send_events (downloader, fragment);
+  }
+
+  while ((status = skippy_curl_transfer_wait (transfer, &memory, &transfer_err)) == SKIPPY_CURL_TRANSFER_DATA) {
+    // Response headers are in once we got data
+    if (!downloader->priv->got_segment) {
+      content_length = skippy_curl_transfer_get_content_length (transfer);
+      downloader->priv->bytes_total = content_length >= 0 ? downloader->priv->bytes_loaded + content_length : 0;
+      downloader->priv->got_segment = TRUE;
+    }
+    skippy_uri_downloader_curl_handle_data (downloader, memory);
+    memory = NULL;
+  }
+
+  // After this the session will not touch our transfer anymore
+  skippy_curl_transfer_stop (transfer);
+
+  GST_OBJECT_LOCK (downloader);
+  downloader->priv->fetching = FALSE;
+  downloader->priv->download_canceled = FALSE;
+  GST_OBJECT_UNLOCK (downloader);
+
+  switch (status) {
+    case SKIPPY_CURL_TRANSFER_DONE:
+      // The server didn't tell the size (or sent nothing)
+      if (downloader->priv->bytes_total == 0) {
+        downloader->priv->bytes_total = downloader->priv->bytes_loaded;
+      }
+      skippy_uri_downloader_handle_eos (downloader);
+      skippy_uri_downloader_store_in_cache (downloader, fragment);
+      return SKIPPY_URI_DOWNLOADER_COMPLETED;
+    case SKIPPY_CURL_TRANSFER_FAILED:
+      downloader->priv->err = transfer_err;
+      return skippy_uri_downloader_handle_failure (downloader, err);
+    default:
+      return SKIPPY_URI_DOWNLOADER_CANCELLED;
+  }
+}
+#endif
+
 // Fetch function: can not be called concurrently with setters&getters or prepare function
 // Blocks until download is finished
 //
@@ -779,6 +1185,10 @@ SkippyUriDownloaderFetchReturn skippy_uri_downloader_fetch_fragment (SkippyUriDo
   const gchar * referer, gboolean compress, gboolean refresh, gboolean allow_cache, GError ** err)
 {
   GstStateChangeReturn ret;
+  gboolean use_curl = FALSE;
+#ifdef SKIPPY_HLS_CURL
+  SkippyUriDownloaderFetchReturn fetch_ret;
+#endif
 
   g_return_val_if_fail (downloader, SKIPPY_URI_DOWNLOADER_FAILED);
   g_return_val_if_fail (fragment, SKIPPY_URI_DOWNLOADER_FAILED);
@@ -794,8 +1204,23 @@ SkippyUriDownloaderFetchReturn skippy_uri_downloader_fetch_fragment (SkippyUriDo
   // Storing the current fragment info
   downloader->priv->fragment = g_object_ref (fragment);
 
+  // Fragments we have on disk don't need the network (resumed downloads are never cached)
+  GST_OBJECT_LOCK (downloader);
+  if (downloader->priv->cache && allow_cache && !refresh && !downloader->priv->previous_was_interrupted) {
+    downloader->priv->fetch_cache = skippy_fragment_cache_ref (downloader->priv->cache);
+  }
+  GST_OBJECT_UNLOCK (downloader);
+  if (downloader->priv->fetch_cache && skippy_uri_downloader_fetch_from_cache (downloader, fragment)) {
+    g_mutex_unlock (&downloader->priv->download_lock);
+    return SKIPPY_URI_DOWNLOADER_COMPLETED;
+  }
+
+#ifdef SKIPPY_HLS_CURL
+  use_curl = skippy_curl_handles_uri (fragment->uri);
+#endif
+
   // Make sure we have our data source component set up and wired
-  if (!skippy_uri_downloader_create_src (downloader, fragment->uri)) {
+  if (!use_curl && !skippy_uri_downloader_create_src (downloader, fragment->uri)) {
     g_mutex_unlock (&downloader->priv->download_lock);
     return SKIPPY_URI_DOWNLOADER_FAILED;
   }
@@ -806,6 +1231,14 @@ SkippyUriDownloaderFetchReturn skippy_uri_downloader_fetch_fragment (SkippyUriDo
     fragment->range_end = downloader->priv->bytes_total;
   }
 
+#ifdef SKIPPY_HLS_CURL
+  if (use_curl) {
+    fetch_ret = skippy_uri_downloader_fetch_with_curl (downloader, fragment, referer, compress, refresh, allow_cache, err);
+    g_mutex_unlock (&downloader->priv->download_lock);
+    return fetch_ret;
+  }
+#endif
+
   // Setup URL & range
   if (! (skippy_uri_downloader_set_uri (downloader, fragment->uri, referer, compress, refresh, allow_cache)
     && skippy_uri_downloader_set_range (downloader, fragment->range_start, fragment->range_end))) {
@@ -868,6 +1301,7 @@ SkippyUriDownloaderFetchReturn skippy_uri_downloader_fetch_fragment (SkippyUriDo
   }
 
   // Successful completion
+  skippy_uri_downloader_store_in_cache (downloader, fragment);
   g_mutex_unlock (&downloader->priv->download_lock);
   return SKIPPY_URI_DOWNLOADER_COMPLETED;
 }
@@ -898,6 +1332,12 @@ static void skippy_uri_downloader_cancel (SkippyUriDownloader * downloader, gboo
   if (downloader->priv->fragment) {
     downloader->priv->fragment->cancelled = TRUE;
   }
+#ifdef SKIPPY_HLS_CURL
+  // Only has an effect while a transfer runs
+  if (downloader->priv->transfer) {
+    skippy_curl_transfer_cancel (downloader->priv->transfer);
+  }
+#endif
   GST_TRACE_OBJECT (downloader, "Signaling wait condition.");
   g_cond_signal (&downloader->priv->cond);
   GST_OBJECT_UNLOCK (downloader);
@@ -917,4 +1357,6 @@ void skippy_uri_downloader_continue (SkippyUriDownloader * downloader)
   downloader->priv->bytes_total = 0;
   downloader->priv->download_canceled = FALSE;
   GST_OBJECT_UNLOCK (downloader);
+  g_atomic_int_set (&downloader->priv->progress_loaded, 0);
+  g_atomic_int_set (&downloader->priv->progress_total, 0);
 }
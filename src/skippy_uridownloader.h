@@ -22,6 +22,7 @@
 #pragma once
 
 #include "skippy_fragment.h"
+#include "skippy_fragment_cache.h"
 
 #include <glib-object.h>
 #include <gst/gst.h>
@@ -43,6 +44,8 @@ typedef struct _SkippyUriDownloaderClass SkippyUriDownloaderClass;
 
 typedef void (*SkippyUriDownloaderCallback) (SkippyUriDownloader *downloader, guint64 start_time, guint64 stop_time,
 																				gsize bytes_loaded, gsize bytes_total);
+typedef void (*SkippyUriDownloaderDataCallback) (SkippyUriDownloader *downloader, const guint8 *data, gsize size,
+																				gpointer user_data);
 typedef enum {
 	SKIPPY_URI_DOWNLOADER_VOID,
 	SKIPPY_URI_DOWNLOADER_FAILED,
@@ -75,8 +78,26 @@ SkippyUriDownloaderFetchReturn skippy_uri_downloader_fetch_fragment (SkippyUriDo
 	const gchar * referer, gboolean compress, gboolean refresh, gboolean allow_cache, GError ** err);
 GstBuffer* skippy_uri_downloader_get_buffer (SkippyUriDownloader *downloader);
 
+// Callback is invoked from the data source streaming thread with each chunk of data that we collect
+// into our own buffer (i.e when not linked), so it can be consumed while the download is still ongoing.
+void skippy_uri_downloader_set_data_callback (SkippyUriDownloader *downloader, SkippyUriDownloaderDataCallback callback,
+	gpointer user_data);
+
+// Callback is invoked from the data source streaming thread each time data was received (not rate-limited like
+// the download messages on the bus, so it should return quickly).
+void skippy_uri_downloader_set_progress_callback (SkippyUriDownloader *downloader, SkippyUriDownloaderCallback callback);
+// Bytes loaded and expected (0 when unknown, both capped at G_MAXINT) for the current download, can be polled from any thread without blocking
+void skippy_uri_downloader_get_progress (SkippyUriDownloader *downloader, gsize *bytes_loaded, gsize *bytes_total);
+
+// Fetches allowed to cache are served from the cache when possible, completed ones get stored
+void skippy_uri_downloader_set_fragment_cache (SkippyUriDownloader *downloader, SkippyFragmentCache *cache);
+
 void skippy_uri_downloader_interrupt (SkippyUriDownloader * downloader);
 
 void skippy_uri_downloader_continue (SkippyUriDownloader * downloader);
 
+// Appends data to an aggregate buffer (created when NULL) the way unlinked downloads collect theirs.
+// expected_size is the total size of the download, 0 when unknown.
+void skippy_uri_downloader_append (GstBuffer** aggregate, const guint8* data, gsize bytes, gsize expected_size);
+
 G_END_DECLS
@@ -0,0 +1,234 @@
+#include <string>
+#include <set>
+#include <cstring>
+#include <utime.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "skippy_fragment_cache.h"
+
+#define LOG(...) g_message(__VA_ARGS__)
+
+#define ASSERT(expr) g_assert(expr)
+
+// Size of a cache file with data of the size (header included)
+#define FILE_SIZE(size) (64 + (size))
+
+static std::set<std::string> list_files(const std::string& location)
+{
+	std::set<std::string> names;
+	GDir* dir = g_dir_open(location.c_str(), 0, NULL);
+	const gchar* name;
+
+	ASSERT (dir);
+	while ((name = g_dir_read_name(dir))) {
+		names.insert(name);
+	}
+	g_dir_close(dir);
+	return names;
+}
+
+static void remove_files(const std::string& location)
+{
+	for (const std::string& name : list_files(location)) {
+		g_unlink((location + "/" + name).c_str());
+	}
+}
+
+// Writes happen in the background: closing the cache waits for them, opening it again scans the directory.
+// Closing it once more waits for the scan (and the evictions it makes).
+static SkippyFragmentCache* reopen(SkippyFragmentCache* cache, const std::string& location, guint64 max_size)
+{
+	skippy_fragment_cache_unref(cache);
+	cache = skippy_fragment_cache_open(location.c_str(), max_size);
+	skippy_fragment_cache_unref(cache);
+	return skippy_fragment_cache_open(location.c_str(), max_size);
+}
+
+static GstBuffer* new_buffer(const std::string& data)
+{
+	gchar* copy = g_strndup(data.data(), data.size());
+	return gst_buffer_new_wrapped_full((GstMemoryFlags) 0, copy, data.size(), 0, data.size(), copy, g_free);
+}
+
+static void store(SkippyFragmentCache* cache, const std::string& uri, gint64 range_start, gint64 range_end, const std::string& data)
+{
+	GstBufferList* buffers = gst_buffer_list_new();
+	gst_buffer_list_add(buffers, new_buffer(data));
+	skippy_fragment_cache_store(cache, uri.c_str(), range_start, range_end, buffers);
+	gst_buffer_list_unref(buffers);
+}
+
+// Stores the data and returns the name of the file it was written to
+static std::string store_file(SkippyFragmentCache*& cache, const std::string& location, guint64 max_size, const std::string& uri,
+	const std::string& data)
+{
+	std::set<std::string> before = list_files(location);
+	store(cache, uri, 0, -1, data);
+	cache = reopen(cache, location, max_size);
+	for (const std::string& name : list_files(location)) {
+		if (!before.count(name)) {
+			return name;
+		}
+	}
+	ASSERT (!"No file was written");
+	return "";
+}
+
+// Returns whether the data is cached, checking it if it is
+static bool lookup(SkippyFragmentCache* cache, const std::string& uri, gint64 range_start, gint64 range_end, const std::string& data)
+{
+	GstBuffer* buffer = skippy_fragment_cache_lookup(cache, uri.c_str(), range_start, range_end);
+	GstMapInfo info;
+
+	if (!buffer) {
+		return false;
+	}
+	ASSERT (gst_buffer_map(buffer, &info, GST_MAP_READ));
+	ASSERT (info.size == data.size() && memcmp(info.data, data.data(), data.size()) == 0);
+	gst_buffer_unmap(buffer, &info);
+	gst_buffer_unref(buffer);
+	return true;
+}
+
+static void set_modification_time(const std::string& location, const std::string& name, gint64 seconds_ago)
+{
+	struct utimbuf times;
+	times.actime = times.modtime = g_get_real_time() / G_USEC_PER_SEC - seconds_ago;
+	ASSERT (g_utime((location + "/" + name).c_str(), &times) == 0);
+}
+
+static void test_fragment_cache_keys(const std::string& location)
+{
+	SkippyFragmentCache* cache = skippy_fragment_cache_open(location.c_str(), 1024 * 1024);
+
+	ASSERT (cache);
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3?token=1", 0, -1, ""));
+	store(cache, "http://cdn.example.com/a.mp3?token=1", 0, -1, "whole");
+	store(cache, "http://cdn.example.com/a.mp3?token=1", 0, 100, "range");
+
+	// Data of one fragment in several buffers
+	GstBufferList* buffers = gst_buffer_list_new();
+	gst_buffer_list_add(buffers, new_buffer("first,"));
+	gst_buffer_list_add(buffers, new_buffer("second"));
+	skippy_fragment_cache_store(cache, "http://cdn.example.com/b.mp3", 0, -1, buffers);
+	gst_buffer_list_unref(buffers);
+
+	cache = reopen(cache, location, 1024 * 1024);
+	ASSERT (list_files(location).size() == 3);
+
+	// Signed URIs of the same resource differ in their query only, the byte range is part of the key
+	ASSERT (lookup(cache, "http://cdn.example.com/a.mp3?token=2", 0, -1, "whole"));
+	ASSERT (lookup(cache, "http://cdn.example.com/a.mp3", 0, 100, "range"));
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3", 0, 50, ""));
+	ASSERT (!lookup(cache, "http://cdn.example.com/c.mp3?token=1", 0, -1, ""));
+	ASSERT (lookup(cache, "http://cdn.example.com/b.mp3?token=3", 0, -1, "first,second"));
+
+	skippy_fragment_cache_unref(cache);
+	remove_files(location);
+}
+
+static void test_fragment_cache_corrupt_files(const std::string& location)
+{
+	SkippyFragmentCache* cache = skippy_fragment_cache_open(location.c_str(), 1024 * 1024);
+	std::string data(1000, 'x');
+	std::string name, path;
+	gchar* contents;
+	gsize length;
+
+	// A changed byte of the data
+	name = store_file(cache, location, 1024 * 1024, "http://cdn.example.com/a.mp3", data);
+	path = location + "/" + name;
+	ASSERT (g_file_get_contents(path.c_str(), &contents, &length, NULL));
+	ASSERT (length == FILE_SIZE(data.size()));
+	contents[FILE_SIZE(500)] = 'y';
+	ASSERT (g_file_set_contents(path.c_str(), contents, length, NULL));
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3", 0, -1, ""));
+	ASSERT (!g_file_test(path.c_str(), G_FILE_TEST_EXISTS));
+
+	// Cut off
+	name = store_file(cache, location, 1024 * 1024, "http://cdn.example.com/a.mp3", data);
+	path = location + "/" + name;
+	contents[FILE_SIZE(500)] = 'x';
+	ASSERT (g_file_set_contents(path.c_str(), contents, FILE_SIZE(999), NULL));
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3", 0, -1, ""));
+	ASSERT (!g_file_test(path.c_str(), G_FILE_TEST_EXISTS));
+
+	// Not a cache file at all
+	ASSERT (g_file_set_contents(path.c_str(), "garbage", -1, NULL));
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3", 0, -1, ""));
+
+	// Left over from an interrupted write: removed by the scan
+	ASSERT (g_file_set_contents((path + ".tmp").c_str(), contents, length, NULL));
+	cache = reopen(cache, location, 1024 * 1024);
+	ASSERT (list_files(location).empty());
+
+	g_free(contents);
+	skippy_fragment_cache_unref(cache);
+	remove_files(location);
+}
+
+static void test_fragment_cache_eviction(const std::string& location)
+{
+	std::string data(1000, 'x');
+	guint64 max_size = 3 * FILE_SIZE(data.size());
+	SkippyFragmentCache* cache = skippy_fragment_cache_open(location.c_str(), max_size);
+	std::string a, b, c, d;
+
+	a = store_file(cache, location, max_size, "http://cdn.example.com/a.mp3", data);
+	b = store_file(cache, location, max_size, "http://cdn.example.com/b.mp3", data);
+	c = store_file(cache, location, max_size, "http://cdn.example.com/c.mp3", data);
+	ASSERT (list_files(location).size() == 3);
+
+	// The scan takes the order from the modification times: c, b, a. Using a makes b the least recently used.
+	set_modification_time(location, a, 300);
+	set_modification_time(location, b, 200);
+	set_modification_time(location, c, 100);
+	cache = reopen(cache, location, max_size);
+	ASSERT (lookup(cache, "http://cdn.example.com/a.mp3", 0, -1, data));
+	d = store_file(cache, location, max_size, "http://cdn.example.com/d.mp3", data);
+
+	ASSERT (list_files(location) == std::set<std::string>({ a, c, d }));
+	ASSERT (!lookup(cache, "http://cdn.example.com/b.mp3", 0, -1, data));
+	ASSERT (lookup(cache, "http://cdn.example.com/c.mp3", 0, -1, data));
+
+	// A smaller limit evicts down to it when the cache is opened again
+	cache = reopen(cache, location, max_size);
+	set_modification_time(location, a, 300);
+	set_modification_time(location, c, 100);
+	set_modification_time(location, d, 200);
+	cache = reopen(cache, location, 2 * FILE_SIZE(data.size()));
+	ASSERT (list_files(location) == std::set<std::string>({ c, d }));
+	ASSERT (!lookup(cache, "http://cdn.example.com/a.mp3", 0, -1, data));
+	ASSERT (lookup(cache, "http://cdn.example.com/d.mp3", 0, -1, data));
+
+	// Data larger than the limit isn't written
+	store(cache, "http://cdn.example.com/e.mp3", 0, -1, std::string(3 * data.size(), 'e'));
+	cache = reopen(cache, location, 2 * FILE_SIZE(data.size()));
+	ASSERT (!lookup(cache, "http://cdn.example.com/e.mp3", 0, -1, ""));
+	ASSERT (list_files(location).size() == 2);
+
+	skippy_fragment_cache_unref(cache);
+	remove_files(location);
+}
+
+int
+main (int argc, char **argv)
+{
+	gchar* location;
+
+	gst_init(&argc, &argv);
+	location = g_dir_make_tmp("skippy-fragment-cache-XXXXXX", NULL);
+	ASSERT (location);
+
+	test_fragment_cache_keys(location);
+	test_fragment_cache_corrupt_files(location);
+	test_fragment_cache_eviction(location);
+
+	g_rmdir(location);
+	g_free(location);
+
+	LOG ("All test assertions passed");
+
+	return 0;
+}
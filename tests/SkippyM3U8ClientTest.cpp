@@ -0,0 +1,484 @@
+#include <string>
+#include <cstring>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "skippy_m3u8.h"
+#include "skippy_uridownloader.h"
+#include "skippy_download_pool.h"
+
+#define LOG(...) g_message(__VA_ARGS__)
+
+#define ASSERT(expr) g_assert(expr)
+
+// Live window of count 10 second segments from the media sequence number first on
+static std::string live_playlist(int first, int count, const std::string& query = "")
+{
+	std::string playlist = "#EXTM3U\n#EXT-X-TARGETDURATION:10\n#EXT-X-MEDIA-SEQUENCE:" + std::to_string(first) + "\n";
+	for (int i = first; i < first + count; i++) {
+		playlist += "#EXTINF:10,\nhttp://cdn.example.com/live/" + std::to_string(i) + ".ts" + query + "\n";
+	}
+	return playlist;
+}
+
+static SkippyHlsInternalError load_playlist(SkippyM3U8Client* client, const gchar* uri, const std::string& playlist)
+{
+	gchar* data = (gchar*) g_malloc(playlist.size());
+	memcpy(data, playlist.data(), playlist.size());
+	GstBuffer* buffer = gst_buffer_new_wrapped_full((GstMemoryFlags) 0, data, playlist.size(), 0, playlist.size(), data, g_free);
+	SkippyHlsInternalError ret = skippy_m3u8_client_load_playlist(client, uri, buffer);
+	gst_buffer_unref(buffer);
+	return ret;
+}
+
+// Checks the fragment at the index of the current window (or the current one with index -1)
+static void check_fragment(SkippyM3U8Client* client, gint64 index, guint64 sequence_number, const std::string& uri, GstClockTime start_time)
+{
+	SkippyM3U8FragmentDescriptor* fragment = index < 0 ? skippy_m3u8_client_acquire_current_fragment(client)
+		: skippy_m3u8_client_acquire_fragment(client, index);
+
+	ASSERT (fragment);
+	if (uri != fragment->uri || fragment->sequence_number != sequence_number || fragment->start_time != start_time) {
+		LOG ("Expected %s (%d at %d s), got %s (%d at %d s)", uri.c_str(), (int) sequence_number, (int) (start_time / GST_SECOND),
+			fragment->uri, (int) fragment->sequence_number, (int) (fragment->start_time / GST_SECOND));
+	}
+	ASSERT (uri == fragment->uri);
+	ASSERT (fragment->sequence_number == sequence_number);
+	ASSERT (fragment->start_time == start_time);
+	ASSERT (fragment->stop_time == fragment->start_time + fragment->duration);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+}
+
+static void test_client_consecutive_live_windows()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(100, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_is_live(client));
+	ASSERT (skippy_m3u8_client_seek_to_sequence_number(client, 104));
+
+	// Two segments slid out of the window, two new ones: the timeline and the cursor don't move
+	ASSERT (load_playlist(client, NULL, live_playlist(102, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 104);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 120 * GST_SECOND);
+	check_fragment(client, -1, 104, "http://cdn.example.com/live/104.ts", 40 * GST_SECOND);
+	check_fragment(client, 0, 102, "http://cdn.example.com/live/102.ts", 20 * GST_SECOND);
+	check_fragment(client, 9, 111, "http://cdn.example.com/live/111.ts", 110 * GST_SECOND);
+	ASSERT (!skippy_m3u8_client_acquire_fragment(client, 10));
+
+	// The next one evicts the current segment: playback continues with the first one left
+	ASSERT (load_playlist(client, NULL, live_playlist(106, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 106);
+	check_fragment(client, -1, 106, "http://cdn.example.com/live/106.ts", 60 * GST_SECOND);
+	skippy_m3u8_client_advance_to_next_fragment(client);
+	check_fragment(client, -1, 107, "http://cdn.example.com/live/107.ts", 70 * GST_SECOND);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 160 * GST_SECOND);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_token_refresh()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	std::string vod = live_playlist(0, 6, "?token=a") + "#EXT-X-ENDLIST\n";
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8?token=a", vod) == NO_ERROR);
+	skippy_m3u8_client_advance_to_next_fragment(client);
+	skippy_m3u8_client_advance_to_next_fragment(client);
+	check_fragment(client, -1, 2, "http://cdn.example.com/live/2.ts?token=a", 20 * GST_SECOND);
+
+	// After a 403 the playlist is fetched again: same items, new tokens
+	vod = live_playlist(0, 6, "?token=b") + "#EXT-X-ENDLIST\n";
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8?token=b", vod) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 2);
+	check_fragment(client, -1, 2, "http://cdn.example.com/live/2.ts?token=b", 20 * GST_SECOND);
+	check_fragment(client, 0, 0, "http://cdn.example.com/live/0.ts?token=b", 0);
+	check_fragment(client, 5, 5, "http://cdn.example.com/live/5.ts?token=b", 50 * GST_SECOND);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 60 * GST_SECOND);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_truncated_window()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(100, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_seek_to_sequence_number(client, 109));
+
+	// The last two items are gone: the cursor waits at the end for the next item
+	ASSERT (load_playlist(client, NULL, live_playlist(100, 8)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 80 * GST_SECOND);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 108);
+	ASSERT (!skippy_m3u8_client_acquire_current_fragment(client));
+	ASSERT (!skippy_m3u8_client_acquire_fragment(client, 8));
+
+	ASSERT (load_playlist(client, NULL, live_playlist(101, 9)) == NO_ERROR);
+	check_fragment(client, -1, 108, "http://cdn.example.com/live/108.ts", 80 * GST_SECOND);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_updated_items()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	std::string playlist = live_playlist(100, 6);
+	SkippyM3U8FragmentDescriptor* fragment;
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", playlist) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_seek_to_sequence_number(client, 104));
+
+	// Item 102 got shorter and item 103 is a byte range now
+	playlist.replace(playlist.find("#EXTINF:10,\nhttp://cdn.example.com/live/102.ts"), strlen("#EXTINF:10,"), "#EXTINF:4,");
+	playlist.insert(playlist.find("#EXTINF:10,\nhttp://cdn.example.com/live/103.ts"), "#EXT-X-BYTERANGE:5000@1000\n");
+	ASSERT (load_playlist(client, NULL, playlist) == NO_ERROR);
+
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 104);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 54 * GST_SECOND);
+	fragment = skippy_m3u8_client_acquire_fragment(client, 2);
+	ASSERT (fragment->duration == 4 * GST_SECOND && fragment->range_end == -1);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+	fragment = skippy_m3u8_client_acquire_fragment(client, 3);
+	ASSERT (fragment->start_time == 24 * GST_SECOND);
+	ASSERT (fragment->range_start == 1000 && fragment->range_end == 6000);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+	check_fragment(client, -1, 104, "http://cdn.example.com/live/104.ts", 34 * GST_SECOND);
+
+	// And back
+	ASSERT (load_playlist(client, NULL, live_playlist(100, 6)) == NO_ERROR);
+	fragment = skippy_m3u8_client_acquire_fragment(client, 3);
+	ASSERT (fragment->start_time == 30 * GST_SECOND && fragment->range_end == -1);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_sequence_goes_backwards()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(100, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_seek_to_sequence_number(client, 105));
+
+	// Another stream (or a restarted encoder): the model gets replaced, the cursor keeps its index in the window
+	ASSERT (load_playlist(client, NULL, live_playlist(50, 8)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 55);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 80 * GST_SECOND);
+	check_fragment(client, -1, 55, "http://cdn.example.com/live/55.ts", 50 * GST_SECOND);
+	check_fragment(client, 0, 50, "http://cdn.example.com/live/50.ts", 0);
+
+	// Past the end of a shorter window
+	ASSERT (load_playlist(client, NULL, live_playlist(20, 3)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 23);
+	ASSERT (!skippy_m3u8_client_acquire_current_fragment(client));
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_fragment_descriptors()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	SkippyM3U8FragmentDescriptor *fragment, *recycled;
+	std::string vod = live_playlist(0, 6, "?token=a") + "#EXT-X-ENDLIST\n";
+
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8?token=a", vod) == NO_ERROR);
+	fragment = skippy_m3u8_client_acquire_current_fragment(client);
+	ASSERT (std::string(fragment->playlist_uri) == "http://cdn.example.com/live/playlist.m3u8?token=a");
+	ASSERT (fragment->part_index == -1 && fragment->range_end == -1);
+
+	// The strings stay valid until the descriptor is released, whatever the playlist does meanwhile
+	vod = live_playlist(0, 6, "?token=b") + "#EXT-X-ENDLIST\n";
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8?token=b", vod) == NO_ERROR);
+	ASSERT (skippy_m3u8_fragment_descriptor_ref(fragment) == fragment);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+	ASSERT (std::string(fragment->uri) == "http://cdn.example.com/live/0.ts?token=a");
+	ASSERT (std::string(fragment->playlist_uri) == "http://cdn.example.com/live/playlist.m3u8?token=a");
+	check_fragment(client, -1, 0, "http://cdn.example.com/live/0.ts?token=b", 0);
+
+	// Released descriptors get recycled
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+	recycled = skippy_m3u8_client_acquire_fragment(client, 5);
+	ASSERT (recycled == fragment);
+	ASSERT (std::string(recycled->uri) == "http://cdn.example.com/live/5.ts?token=b" && recycled->sequence_number == 5);
+	skippy_m3u8_fragment_descriptor_unref(recycled);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_lookahead()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	std::string vod = live_playlist(0, 6) + "#EXT-X-ENDLIST\n";
+	SkippyM3U8Lookahead* lookahead;
+
+	// Segments 3 and 4 are byte ranges
+	vod.insert(vod.find("#EXTINF:10,\nhttp://cdn.example.com/live/3.ts"), "#EXT-X-BYTERANGE:1000@0\n");
+	vod.insert(vod.find("#EXTINF:10,\nhttp://cdn.example.com/live/4.ts"), "#EXT-X-BYTERANGE:3000@1000\n");
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", vod) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_seek_to_sequence_number(client, 2));
+
+	// From the current fragment on, without moving the cursor
+	lookahead = skippy_m3u8_client_lookahead(client, 4);
+	ASSERT (lookahead->n_fragments == 4);
+	for (guint i = 0; i < lookahead->n_fragments; i++) {
+		ASSERT (lookahead->fragments[i]->sequence_number == 2 + i);
+		ASSERT (lookahead->fragments[i]->start_time == (2 + i) * 10 * GST_SECOND);
+		ASSERT (lookahead->cumulative_durations[i] == (i + 1) * 10 * GST_SECOND);
+	}
+	ASSERT (lookahead->known_bytes == 4000 && lookahead->n_unknown_sizes == 2);
+	skippy_m3u8_lookahead_free(lookahead);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 2);
+
+	// Up to the end of the playlist
+	lookahead = skippy_m3u8_client_lookahead(client, 10);
+	ASSERT (lookahead->n_fragments == 4 && lookahead->fragments[3]->sequence_number == 5);
+	skippy_m3u8_lookahead_free(lookahead);
+
+	// All fragments playing in a time window
+	lookahead = skippy_m3u8_client_lookahead_window(client, 15 * GST_SECOND, 35 * GST_SECOND);
+	ASSERT (lookahead->n_fragments == 3);
+	ASSERT (lookahead->fragments[0]->sequence_number == 1 && lookahead->fragments[2]->sequence_number == 3);
+	ASSERT (lookahead->cumulative_durations[2] == 30 * GST_SECOND);
+	ASSERT (lookahead->known_bytes == 1000 && lookahead->n_unknown_sizes == 2);
+	skippy_m3u8_lookahead_free(lookahead);
+
+	lookahead = skippy_m3u8_client_lookahead_window(client, 0, 10 * GST_SECOND);
+	ASSERT (lookahead->n_fragments == 1 && lookahead->fragments[0]->sequence_number == 0);
+	skippy_m3u8_lookahead_free(lookahead);
+
+	lookahead = skippy_m3u8_client_lookahead_window(client, 60 * GST_SECOND, 70 * GST_SECOND);
+	ASSERT (lookahead->n_fragments == 0);
+	skippy_m3u8_lookahead_free(lookahead);
+
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_cached_playlist()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	SkippyM3U8Client* other = skippy_m3u8_client_new();
+	std::string vod = live_playlist(0, 6, "?token=a") + "#EXT-X-ENDLIST\n";
+
+	ASSERT (!skippy_m3u8_client_load_cached_playlist(other, "http://cdn.example.com/cached/playlist.m3u8"));
+	ASSERT (load_playlist(client, "http://cdn.example.com/cached/playlist.m3u8?token=a", vod) == NO_ERROR);
+
+	// Signed URIs of the same playlist differ in their query only
+	ASSERT (skippy_m3u8_client_load_cached_playlist(other, "http://cdn.example.com/cached/playlist.m3u8?token=b"));
+	ASSERT (!skippy_m3u8_client_is_live(other));
+	ASSERT (skippy_m3u8_client_get_total_duration(other) == 60 * GST_SECOND);
+	check_fragment(other, -1, 0, "http://cdn.example.com/live/0.ts?token=a", 0);
+	check_fragment(other, 5, 5, "http://cdn.example.com/live/5.ts?token=a", 50 * GST_SECOND);
+	ASSERT (!skippy_m3u8_client_load_cached_playlist(other, "http://cdn.example.com/cached/other.m3u8?token=a"));
+	skippy_m3u8_client_free(other);
+	skippy_m3u8_client_free(client);
+
+	// Live playback starts at the live edge, like with the downloaded playlist
+	client = skippy_m3u8_client_new();
+	ASSERT (load_playlist(client, "http://cdn.example.com/cached/live.m3u8", live_playlist(100, 10)) == NO_ERROR);
+	other = skippy_m3u8_client_new();
+	ASSERT (skippy_m3u8_client_load_cached_playlist(other, "http://cdn.example.com/cached/live.m3u8"));
+	ASSERT (skippy_m3u8_client_is_live(other));
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(other) == 107);
+
+	skippy_m3u8_client_free(other);
+	skippy_m3u8_client_free(client);
+}
+
+static std::string save_snapshot(SkippyM3U8Client* client, const std::string& location)
+{
+	std::string path = location + "/playlist.snapshot";
+	gchar* contents;
+	gsize length;
+
+	ASSERT (skippy_m3u8_client_save_playlist_snapshot(client, path.c_str()));
+	ASSERT (g_file_get_contents(path.c_str(), &contents, &length, NULL));
+	std::string data(contents, length);
+	g_free(contents);
+	g_unlink(path.c_str());
+	return data;
+}
+
+static void test_client_snapshot(const std::string& location)
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	SkippyM3U8Client* other = skippy_m3u8_client_new();
+	std::string vod = live_playlist(0, 6) + "#EXT-X-ENDLIST\n";
+	SkippyM3U8FragmentDescriptor* fragment;
+	std::string data;
+
+	ASSERT (!skippy_m3u8_client_save_playlist_snapshot(client, (location + "/empty.snapshot").c_str()));
+	vod.insert(vod.find("#EXTINF:10,\nhttp://cdn.example.com/live/3.ts"), "#EXT-X-BYTERANGE:5000@1000\n");
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", vod) == NO_ERROR);
+	data = save_snapshot(client, location);
+
+	// Loaded like a playlist, without parsing
+	ASSERT (load_playlist(other, "http://cdn.example.com/live/playlist.m3u8", data) == NO_ERROR);
+	ASSERT (!skippy_m3u8_client_is_live(other));
+	ASSERT (skippy_m3u8_client_get_total_duration(other) == 60 * GST_SECOND);
+	check_fragment(other, -1, 0, "http://cdn.example.com/live/0.ts", 0);
+	check_fragment(other, 5, 5, "http://cdn.example.com/live/5.ts", 50 * GST_SECOND);
+	fragment = skippy_m3u8_client_acquire_fragment(other, 3);
+	ASSERT (fragment->range_start == 1000 && fragment->range_end == 6000);
+	skippy_m3u8_fragment_descriptor_unref(fragment);
+
+	// Cut off snapshots are rejected and leave the playlist as it was
+	ASSERT (load_playlist(other, NULL, data.substr(0, data.size() - 1)) != NO_ERROR);
+	ASSERT (load_playlist(other, NULL, data.substr(0, data.size() / 2)) != NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_total_duration(other) == 60 * GST_SECOND);
+	skippy_m3u8_client_free(other);
+	skippy_m3u8_client_free(client);
+
+	// A live snapshot starts at the live edge
+	client = skippy_m3u8_client_new();
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(100, 10)) == NO_ERROR);
+	data = save_snapshot(client, location);
+	other = skippy_m3u8_client_new();
+	ASSERT (load_playlist(other, "http://cdn.example.com/live/playlist.m3u8", data) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_is_live(other));
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(other) == 107);
+	check_fragment(other, 0, 100, "http://cdn.example.com/live/100.ts", 0);
+
+	skippy_m3u8_client_free(other);
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_live_start()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	std::string playlist = live_playlist(100, 10);
+
+	// Three target durations back from the live edge
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", playlist) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 107);
+	check_fragment(client, -1, 107, "http://cdn.example.com/live/107.ts", 70 * GST_SECOND);
+
+	// Reloaded after a target duration, after half of one when nothing changed
+	ASSERT (skippy_m3u8_client_get_reload_interval(client) == 10 * GST_SECOND);
+	ASSERT (load_playlist(client, NULL, playlist) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_reload_interval(client) == 5 * GST_SECOND);
+	ASSERT (load_playlist(client, NULL, live_playlist(101, 10)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_reload_interval(client) == 10 * GST_SECOND);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 107);
+	skippy_m3u8_client_free(client);
+
+	// Shorter windows start at their first item, finished playlists aren't reloaded
+	client = skippy_m3u8_client_new();
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(100, 2)) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_current_sequence_number(client) == 100);
+	ASSERT (load_playlist(client, NULL, live_playlist(100, 4) + "#EXT-X-ENDLIST\n") == NO_ERROR);
+	ASSERT (!GST_CLOCK_TIME_IS_VALID (skippy_m3u8_client_get_reload_interval(client)));
+	skippy_m3u8_client_free(client);
+}
+
+static void test_client_prefetch_planning()
+{
+	GstElement* bin = gst_bin_new(NULL);
+	SkippyDownloadPool* pool = skippy_download_pool_new(GST_BIN (bin), 4);
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	SkippyM3U8Lookahead* lookahead;
+	SkippyFragment* fragment;
+
+	// Without measurements all slots are used: the short startup fragments are all in flight at once
+	ASSERT (load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", live_playlist(0, 6) + "#EXT-X-ENDLIST\n") == NO_ERROR);
+	ASSERT (skippy_download_pool_get_prefetch_count(pool) == 3);
+	lookahead = skippy_m3u8_client_lookahead(client, skippy_download_pool_get_prefetch_count(pool) + 1);
+	ASSERT (lookahead->n_fragments == 4 && lookahead->fragments[0]->sequence_number == 0);
+	skippy_m3u8_lookahead_free(lookahead);
+
+	// One more request for every transfer time the latency covers
+	fragment = skippy_fragment_new("http://cdn.example.com/live/0.ts");
+	fragment->download_start_time = GST_SECOND;
+	fragment->download_first_byte_time = fragment->download_start_time + 200 * GST_MSECOND;
+	fragment->download_stop_time = fragment->download_first_byte_time + 100 * GST_MSECOND;
+	skippy_download_pool_measure(pool, fragment);
+	ASSERT (skippy_download_pool_get_prefetch_count(pool) == 2);
+	skippy_download_pool_set_max_downloads(pool, 2);
+	ASSERT (skippy_download_pool_get_prefetch_count(pool) == 1);
+	skippy_download_pool_set_max_downloads(pool, 1);
+	ASSERT (skippy_download_pool_get_prefetch_count(pool) == 0);
+	ASSERT (!skippy_download_pool_is_pending(pool, 1));
+	g_object_unref(fragment);
+
+	skippy_m3u8_client_free(client);
+	skippy_download_pool_free(pool);
+	gst_object_unref(bin);
+}
+
+static void test_client_playlist_in_chunks()
+{
+	SkippyM3U8Client* client = skippy_m3u8_client_new();
+	std::string playlist = live_playlist(0, 100) + "#EXT-X-ENDLIST\n";
+	GstBuffer *aggregate = NULL, *shared;
+	GstMapInfo info;
+	gsize capacity;
+	const guint8* block = NULL;
+	int blocks = 0;
+
+	// Unknown size: the block grows by doubling
+	for (size_t i = 0; i < playlist.size(); i += 7) {
+		skippy_uri_downloader_append(&aggregate, (const guint8*) playlist.data() + i, MIN(7, playlist.size() - i), 0);
+		ASSERT (gst_buffer_n_memory(aggregate) == 1);
+		ASSERT (gst_buffer_map(aggregate, &info, GST_MAP_READ));
+		if (info.data != block) {
+			block = info.data;
+			blocks++;
+		}
+		gst_buffer_unmap(aggregate, &info);
+	}
+	ASSERT (gst_buffer_get_size(aggregate) == playlist.size());
+	ASSERT (blocks <= 12);
+	ASSERT (skippy_m3u8_client_load_playlist(client, "http://cdn.example.com/live/playlist.m3u8", aggregate) == NO_ERROR);
+	ASSERT (skippy_m3u8_client_get_total_duration(client) == 1000 * GST_SECOND);
+	check_fragment(client, 99, 99, "http://cdn.example.com/live/99.ts", 990 * GST_SECOND);
+	gst_buffer_unref(aggregate);
+	aggregate = NULL;
+
+	// Known size: one block
+	for (size_t i = 0; i < playlist.size(); i += 7) {
+		skippy_uri_downloader_append(&aggregate, (const guint8*) playlist.data() + i, MIN(7, playlist.size() - i), playlist.size());
+		gst_buffer_get_sizes(aggregate, NULL, &capacity);
+		ASSERT (capacity == playlist.size());
+	}
+	ASSERT (gst_buffer_memcmp(aggregate, 0, playlist.data(), playlist.size()) == 0);
+
+	// A block still referenced elsewhere isn't written to
+	shared = gst_buffer_ref(aggregate);
+	skippy_uri_downloader_append(&aggregate, (const guint8*) "x", 1, 0);
+	ASSERT (aggregate != shared && gst_buffer_get_size(shared) == playlist.size());
+	ASSERT (gst_buffer_get_size(aggregate) == playlist.size() + 1);
+	ASSERT (gst_buffer_memcmp(aggregate, 0, playlist.data(), playlist.size()) == 0);
+	gst_buffer_unref(shared);
+	gst_buffer_unref(aggregate);
+
+	skippy_m3u8_client_free(client);
+}
+
+int
+main (int argc, char **argv)
+{
+	gchar* location;
+
+	gst_init(&argc, &argv);
+	location = g_dir_make_tmp("skippy-m3u8-client-XXXXXX", NULL);
+	ASSERT (location);
+
+	test_client_consecutive_live_windows();
+	test_client_token_refresh();
+	test_client_truncated_window();
+	test_client_updated_items();
+	test_client_sequence_goes_backwards();
+	test_client_fragment_descriptors();
+	test_client_lookahead();
+	test_client_cached_playlist();
+	test_client_snapshot(location);
+	test_client_live_start();
+	test_client_prefetch_planning();
+	test_client_playlist_in_chunks();
+
+	g_rmdir(location);
+	g_free(location);
+
+	LOG ("All test assertions passed");
+
+	return 0;
+}
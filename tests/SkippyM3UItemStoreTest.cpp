@@ -0,0 +1,358 @@
+#include <string>
+#include <glib-object.h>
+
+#include "skippy_m3u8_store.hpp"
+
+#define LOG(...) g_message(__VA_ARGS__)
+
+#define ASSERT(expr) g_assert(expr)
+
+#define MS_TO_NS ((uint64_t) 1000 * 1000)
+
+static SkippyM3UItem make_item(const std::string& url, uint64_t duration, int64_t rangeStart = 0, int64_t rangeEnd = -1)
+{
+	SkippyM3UItem item = SkippyM3UItem();
+	item.url = url;
+	item.duration = duration;
+	item.rangeStart = rangeStart;
+	item.rangeEnd = rangeEnd;
+	return item;
+}
+
+static std::string segment_url(size_t i)
+{
+	return "http://cdn.example.com/live/segment" + std::to_string(i) + ".ts?token=abc";
+}
+
+// Durations differ from one item to the next so that start times can't be right by accident
+static uint64_t segment_duration(size_t i)
+{
+	return (1000 + i % 13) * MS_TO_NS;
+}
+
+static void append_segments(SkippyM3UItemStore& store, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; i++) {
+		store.append(make_item(segment_url(i), segment_duration(i)));
+	}
+}
+
+// Compares the items with the segments from first on, and the times with origin as the start of the first one
+static void check_segments(const SkippyM3UItemStore& store, size_t first, uint64_t origin)
+{
+	uint64_t start = origin;
+	for (size_t index = 0; index < store.size(); index++) {
+		ASSERT (store.url(index) == segment_url(first + index));
+		ASSERT (store.urlEquals(index, segment_url(first + index)));
+		ASSERT (store.duration(index) == segment_duration(first + index));
+		ASSERT (store.start(index) == start);
+		ASSERT (store.end(index) == start + store.duration(index));
+		start += store.duration(index);
+	}
+	ASSERT (store.endTime() == start);
+}
+
+static void test_store_append()
+{
+	SkippyM3UItemStore store;
+	size_t index;
+
+	ASSERT (store.empty() && store.size() == 0 && store.endTime() == 0);
+
+	store.setFirstSequenceNo(10);
+	store.append(make_item("http://cdn.example.com/a/1.aac", 10 * 1000 * MS_TO_NS));
+	store.append(make_item("http://cdn.example.com/a/2.aac", 9500 * MS_TO_NS, 100, 300));
+	store.append(make_item("http://cdn.example.com/a/3.aac", 10 * 1000 * MS_TO_NS));
+
+	ASSERT (store.size() == 3);
+	ASSERT (store.url(1) == "http://cdn.example.com/a/2.aac");
+	ASSERT (store.start(0) == 0 && store.start(1) == 10 * 1000 * MS_TO_NS);
+	ASSERT (store.start(2) == 19500 * MS_TO_NS && store.endTime() == 29500 * MS_TO_NS);
+
+	// Only the second item has a byte range
+	ASSERT (store.rangeStart(0) == 0 && store.rangeEnd(0) == -1);
+	ASSERT (store.rangeStart(1) == 100 && store.rangeEnd(1) == 300);
+	ASSERT (store.rangeEnd(2) == -1);
+
+	ASSERT (store.firstSequenceNo() == 10);
+	ASSERT (store.indexOf(12, index) && index == 2);
+	ASSERT (!store.indexOf(9, index) && !store.indexOf(13, index));
+}
+
+static void test_store_find_across_checkpoints()
+{
+	SkippyM3UItemStore store;
+	size_t count = 5 * SkippyM3UItemStore::CHECKPOINT_INTERVAL + 7;
+
+	append_segments(store, 0, count);
+	ASSERT (store.size() == count);
+	check_segments(store, 0, 0);
+
+	for (size_t index = 0; index < count; index++) {
+		ASSERT (store.find(store.start(index)) == index);
+		ASSERT (store.find(store.end(index) - 1000) == index);
+	}
+	ASSERT (store.find(store.endTime()) == count);
+
+	// Changing a duration moves the following items, including those of later blocks
+	ASSERT (store.setDuration(10, 2000 * MS_TO_NS));
+	ASSERT (!store.setDuration(10, 2000 * MS_TO_NS));
+	ASSERT (store.start(11) == store.end(10));
+	for (size_t index = 0; index < count; index++) {
+		ASSERT (store.find(store.start(index)) == index);
+	}
+	ASSERT (store.endTime() == store.end(count - 1));
+
+	ASSERT (!store.setRange(100, 0, -1));
+	ASSERT (store.setRange(100, 500, 1500));
+	ASSERT (store.rangeStart(100) == 500 && store.rangeEnd(100) == 1500);
+	ASSERT (store.rangeEnd(99) == -1 && store.rangeEnd(101) == -1);
+	ASSERT (store.setRange(100, 0, -1));
+	ASSERT (store.rangeEnd(100) == -1);
+}
+
+static void test_store_evict_front()
+{
+	SkippyM3UItemStore store;
+	size_t count = 3 * SkippyM3UItemStore::CHECKPOINT_INTERVAL;
+	uint64_t origin;
+
+	append_segments(store, 0, count);
+
+	// Part of the first block only
+	origin = store.start(10);
+	store.evictFront(10);
+	ASSERT (store.size() == count - 10 && store.firstSequenceNo() == 10);
+	check_segments(store, 10, origin);
+	ASSERT (store.find(origin - 1000) == store.size());
+	ASSERT (store.find(origin) == 0);
+
+	// Across the end of the first block
+	origin = store.start(100);
+	store.evictFront(100);
+	ASSERT (store.size() == count - 110 && store.firstSequenceNo() == 110);
+	check_segments(store, 110, origin);
+
+	// Refresh of a live window: new items at the end, the same number evicted at the front
+	append_segments(store, count, count + 70);
+	origin = store.start(70);
+	store.evictFront(70);
+	ASSERT (store.size() == count - 110 && store.firstSequenceNo() == 180);
+	check_segments(store, 180, origin);
+	for (size_t index = 0; index < store.size(); index++) {
+		ASSERT (store.find(store.start(index)) == index);
+	}
+
+	// Everything: the timeline continues where the items ended
+	origin = store.endTime();
+	store.evictFront(store.size() + 5);
+	ASSERT (store.empty() && store.firstSequenceNo() == count + 70);
+	ASSERT (store.endTime() == origin);
+	append_segments(store, count + 70, count + 75);
+	check_segments(store, count + 70, origin);
+}
+
+static void test_store_truncate()
+{
+	SkippyM3UItemStore store;
+	size_t count = 2 * SkippyM3UItemStore::CHECKPOINT_INTERVAL + 20;
+	uint64_t end;
+
+	append_segments(store, 0, count);
+	store.setRange(count - 1, 0, 100);
+
+	// Within a block, then the items at the end are appended again with other URLs
+	end = store.end(99);
+	store.truncate(100);
+	ASSERT (store.size() == 100 && store.endTime() == end);
+	check_segments(store, 0, 0);
+	store.append(make_item("http://cdn.example.com/live/other.ts", 1000 * MS_TO_NS));
+	ASSERT (store.url(100) == "http://cdn.example.com/live/other.ts");
+	ASSERT (store.start(100) == end && store.rangeEnd(100) == -1);
+	ASSERT (store.find(end) == 100);
+
+	// At a block boundary
+	store.truncate(SkippyM3UItemStore::CHECKPOINT_INTERVAL);
+	ASSERT (store.size() == SkippyM3UItemStore::CHECKPOINT_INTERVAL);
+	check_segments(store, 0, 0);
+	append_segments(store, SkippyM3UItemStore::CHECKPOINT_INTERVAL, count);
+	check_segments(store, 0, 0);
+
+	// Past the end does nothing, all of it leaves the timeline at the start
+	store.truncate(count);
+	ASSERT (store.size() == count);
+	store.truncate(0);
+	ASSERT (store.empty() && store.endTime() == 0);
+}
+
+static void test_store_set_url()
+{
+	SkippyM3UItemStore store;
+	size_t count = SkippyM3UItemStore::CHECKPOINT_INTERVAL + 10;
+
+	append_segments(store, 0, count);
+	ASSERT (!store.setUrl(5, segment_url(5)));
+
+	// Longer, then shorter (in place), then back: the neighbours don't change
+	ASSERT (store.setUrl(5, "http://cdn.example.com/live/segment5.ts?token=a-much-longer-token"));
+	ASSERT (store.url(5) == "http://cdn.example.com/live/segment5.ts?token=a-much-longer-token");
+	ASSERT (store.setUrl(5, "http://cdn.example.com/live/segment5.ts?t=1"));
+	ASSERT (store.url(5) == "http://cdn.example.com/live/segment5.ts?t=1");
+	ASSERT (!store.urlEquals(5, "http://cdn.example.com/live/segment5.ts?t=12"));
+	ASSERT (store.url(4) == segment_url(4) && store.url(6) == segment_url(6));
+
+	// New tokens for the whole window, over and over (the arenas get compacted on the way)
+	for (int refresh = 0; refresh < 20; refresh++) {
+		for (size_t index = 0; index < count; index++) {
+			std::string token(refresh % 2 ? 40 : 5, 'a' + refresh);
+			ASSERT (store.setUrl(index, "http://cdn.example.com/live/segment" + std::to_string(index) + ".ts?token=" + token));
+		}
+	}
+	for (size_t index = 0; index < count; index++) {
+		ASSERT (store.url(index) == "http://cdn.example.com/live/segment" + std::to_string(index) + ".ts?token=" + std::string(40, 't'));
+	}
+	ASSERT (store.memoryUsage() < 4 * count * 100);
+}
+
+static void test_store_shrink_prefix()
+{
+	SkippyM3UItemStore store;
+
+	append_segments(store, 0, 100);
+
+	// Another host: the prefix shared by all items gets shorter
+	store.append(make_item("http://backup.example.com/live/segment100.ts", 1000 * MS_TO_NS));
+	ASSERT (store.url(100) == "http://backup.example.com/live/segment100.ts");
+	ASSERT (store.url(0) == segment_url(0) && store.url(99) == segment_url(99));
+
+	// Again with a URL that doesn't share anything
+	ASSERT (store.setUrl(50, "/relative/segment50.ts"));
+	ASSERT (store.url(50) == "/relative/segment50.ts");
+	ASSERT (store.url(49) == segment_url(49) && store.url(100) == "http://backup.example.com/live/segment100.ts");
+	ASSERT (store.urlEquals(51, segment_url(51)));
+}
+
+static void test_store_copies_are_independent()
+{
+	SkippyM3UItemStore store;
+	size_t count = 2 * SkippyM3UItemStore::CHECKPOINT_INTERVAL;
+
+	append_segments(store, 0, count);
+
+	SkippyM3UItemStore copy = store;
+	copy.setUrl(3, "http://cdn.example.com/live/changed.ts");
+	copy.setDuration(70, 5000 * MS_TO_NS);
+	copy.setRange(71, 0, 10);
+	copy.evictFront(2);
+	copy.append(make_item("http://other.example.com/next.ts", 1000 * MS_TO_NS));
+
+	ASSERT (store.size() == count);
+	check_segments(store, 0, 0);
+	ASSERT (store.rangeEnd(71) == -1);
+
+	ASSERT (copy.url(1) == "http://cdn.example.com/live/changed.ts");
+	ASSERT (copy.duration(68) == 5000 * MS_TO_NS && copy.rangeEnd(69) == 10);
+	ASSERT (copy.url(copy.size() - 1) == "http://other.example.com/next.ts");
+}
+
+static void check_same_items(const SkippyM3UItemStore& a, const SkippyM3UItemStore& b)
+{
+	ASSERT (a.size() == b.size());
+	ASSERT (a.firstSequenceNo() == b.firstSequenceNo());
+	ASSERT (a.endTime() == b.endTime());
+	for (size_t index = 0; index < a.size(); index++) {
+		ASSERT (a.url(index) == b.url(index));
+		ASSERT (a.start(index) == b.start(index) && a.duration(index) == b.duration(index));
+		ASSERT (a.rangeStart(index) == b.rangeStart(index) && a.rangeEnd(index) == b.rangeEnd(index));
+	}
+}
+
+// Deserializes the data with a value written over it
+template<typename T>
+static bool deserialize_changed(SkippyM3UItemStore& store, const std::string& data, size_t offset, T value)
+{
+	std::string changed = data;
+	memcpy(&changed[offset], &value, sizeof(value));
+	bool valid = store.deserialize(changed.data(), changed.size());
+	ASSERT (valid || store.empty());
+	return valid;
+}
+
+static void test_store_serialize()
+{
+	SkippyM3UItemStore store, restored;
+	std::string data;
+	size_t count = 2 * SkippyM3UItemStore::CHECKPOINT_INTERVAL + 30;
+
+	// Empty
+	store.serialize(data);
+	ASSERT (restored.deserialize(data.data(), data.size()) && restored.empty());
+
+	// Evicted items, changed URLs and byte ranges on some items
+	store.setFirstSequenceNo(1000);
+	append_segments(store, 0, count);
+	store.evictFront(40);
+	store.setUrl(10, "http://cdn.example.com/live/segment50.ts?token=renewed");
+	store.setRange(100, 1024, 4096);
+	data.clear();
+	store.serialize(data);
+	ASSERT (data.size() % 8 == 0);
+	ASSERT (restored.deserialize(data.data(), data.size()));
+	check_same_items(store, restored);
+	ASSERT (restored.find(store.start(100)) == 100);
+
+	// Without any byte range
+	SkippyM3UItemStore plain;
+	append_segments(plain, 0, 10);
+	data.clear();
+	plain.serialize(data);
+	ASSERT (restored.deserialize(data.data(), data.size()));
+	check_same_items(plain, restored);
+
+	// Truncated anywhere
+	data.clear();
+	store.serialize(data);
+	for (size_t size = 0; size < data.size(); size++) {
+		ASSERT (!restored.deserialize(data.data(), size));
+		ASSERT (restored.empty());
+	}
+
+	// Header fields that don't match the data (sizes that would overflow included)
+	uint32_t prefixLength;
+	uint64_t urlBytes;
+	memcpy(&prefixLength, &data[20], sizeof(prefixLength));
+	memcpy(&urlBytes, &data[24], sizeof(urlBytes));
+	ASSERT (!deserialize_changed(restored, data, 16, (uint32_t) 0xffffffff)); // Item count
+	ASSERT (!deserialize_changed(restored, data, 16, (uint32_t) (store.size() + 1)));
+	ASSERT (!deserialize_changed(restored, data, 20, (uint32_t) 0xffffffff)); // Prefix length
+	ASSERT (!deserialize_changed(restored, data, 20, (uint32_t) (prefixLength + 8)));
+	ASSERT (!deserialize_changed(restored, data, 24, (uint64_t) 0xfffffffffffffff0ull)); // URL bytes
+	ASSERT (!deserialize_changed(restored, data, 24, (uint64_t) (urlBytes - 1)));
+	ASSERT (!deserialize_changed(restored, data, 32, (uint32_t) 1)); // Byte range count
+
+	// URL lengths that don't add up to the blob
+	size_t lengths = 40 + (prefixLength + 7) / 8 * 8 + (store.size() * sizeof(uint32_t) + 7) / 8 * 8;
+	ASSERT (!deserialize_changed(restored, data, lengths + 4, (uint32_t) 0x10000000));
+
+	// Not a store at all
+	std::string garbage(256, '\xff');
+	ASSERT (!restored.deserialize(garbage.data(), garbage.size()));
+	ASSERT (restored.empty());
+}
+
+int
+main (int argc, char **argv)
+{
+	test_store_append();
+	test_store_find_across_checkpoints();
+	test_store_evict_front();
+	test_store_truncate();
+	test_store_set_url();
+	test_store_shrink_prefix();
+	test_store_copies_are_independent();
+	test_store_serialize();
+
+	LOG ("All test assertions passed");
+
+	return 0;
+}
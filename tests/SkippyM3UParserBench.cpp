@@ -0,0 +1,214 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <sys/resource.h>
+#include <gst/gst.h>
+
+#include "skippy_m3u8_parser.hpp"
+#include "skippy_m3u8.h"
+
+#define LOG(...) g_message(__VA_ARGS__)
+
+// Parser scaling benchmark: generates synthetic playlists, measures parsing them
+// with SkippyM3UParser and loading them into a SkippyM3U8Client, writes the results as JSON.
+//
+// Usage: SkippyM3UParserBench [results.json] [max segments]
+
+// Counts every heap allocation of the process
+static size_t allocation_count = 0;
+static size_t allocated_bytes = 0;
+
+void* operator new(size_t size)
+{
+	allocation_count++;
+	allocated_bytes += size;
+	void* p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+// Peak resident set size of the process so far, in kilobytes
+static long get_peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+// Deterministic, so that every run parses the same data
+static uint32_t next_random(uint32_t& state)
+{
+	state = state * 1664525 + 1013904223;
+	return state;
+}
+
+// Media playlist with CDN-style signed segment URLs (VOD ends with an end tag, EVENT doesn't)
+static std::string generate_playlist(size_t segments, bool vod)
+{
+	std::ostringstream out;
+	uint32_t state = (uint32_t) segments;
+	char hex[65];
+
+	out << "#EXTM3U\n";
+	out << "#EXT-X-VERSION:3\n";
+	out << "#EXT-X-TARGETDURATION:10\n";
+	out << "#EXT-X-MEDIA-SEQUENCE:0\n";
+	out << "#EXT-X-PLAYLIST-TYPE:" << (vod ? "VOD" : "EVENT") << "\n";
+
+	for (size_t i = 0; i < segments; i++) {
+		for (int c = 0; c < 64; c += 8) {
+			snprintf(hex + c, 9, "%08x", next_random(state));
+		}
+		out << "#EXTINF:" << (9 + next_random(state) % 2) << "." << (next_random(state) % 1000000) << ",\n";
+		out << "https://cdn.example.com/v1/tracks/" << (next_random(state) % 100000000)
+			<< "/hls/128k/segment-" << i << ".mp3?Expires=" << (1500000000 + i)
+			<< "&Signature=" << hex << "&Key-Pair-Id=APKAJ4EXAMPLE7TQ2MQ\n";
+	}
+
+	if (vod) {
+		out << "#EXT-X-ENDLIST\n";
+	}
+	return out.str();
+}
+
+struct BenchResult
+{
+	std::string name;
+	std::string type;
+	size_t segments;
+	size_t bytes;
+	size_t iterations;
+	double seconds;
+	size_t allocations; // Per iteration
+	size_t allocatedBytes; // Per iteration
+	long peakRssKb;
+};
+
+static void print_result(const BenchResult& r)
+{
+	double mbPerSecond = (double) r.bytes * r.iterations / r.seconds / (1024 * 1024);
+	double segmentsPerSecond = (double) r.segments * r.iterations / r.seconds;
+
+	LOG ("%-12s %-5s %8d segments: %9.2f MB/s %12.0f segments/s %9d allocations %8ld KB peak RSS",
+		r.name.c_str(), r.type.c_str(), (int) r.segments, mbPerSecond, segmentsPerSecond,
+		(int) r.allocations, r.peakRssKb);
+}
+
+static void write_results(const std::string& path, const std::vector<BenchResult>& results)
+{
+	std::ofstream file(path);
+
+	file << "{\n  \"benchmark\": \"SkippyM3UParser\",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		file << "    {\"name\": \"" << r.name << "\", \"type\": \"" << r.type << "\""
+			<< ", \"segments\": " << r.segments
+			<< ", \"bytes\": " << r.bytes
+			<< ", \"iterations\": " << r.iterations
+			<< ", \"seconds\": " << r.seconds
+			<< ", \"mb_per_second\": " << (double) r.bytes * r.iterations / r.seconds / (1024 * 1024)
+			<< ", \"segments_per_second\": " << (double) r.segments * r.iterations / r.seconds
+			<< ", \"allocations_per_iteration\": " << r.allocations
+			<< ", \"allocated_bytes_per_iteration\": " << r.allocatedBytes
+			<< ", \"peak_rss_kb\": " << r.peakRssKb << "}"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n}\n";
+
+	LOG ("Results written to %s", path.c_str());
+}
+
+// Enough iterations to parse about a million segments per case
+static size_t get_iterations(size_t segments)
+{
+	return segments >= 1000000 ? 1 : 1000000 / segments;
+}
+
+static BenchResult bench_parse(const std::string& playlist, size_t segments, const char* type)
+{
+	BenchResult r = { "parse", type, segments, playlist.size(), get_iterations(segments), 0, 0, 0, 0 };
+	SkippyM3UParser parser;
+
+	size_t allocations = allocation_count;
+	size_t bytes = allocated_bytes;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < r.iterations; i++) {
+		SkippyM3UPlaylist list = parser.parse("http://bench/playlist.m3u8", playlist);
+		g_assert (list.items.size() == segments);
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.allocations = (allocation_count - allocations) / r.iterations;
+	r.allocatedBytes = (allocated_bytes - bytes) / r.iterations;
+	r.peakRssKb = get_peak_rss_kb();
+	return r;
+}
+
+static BenchResult bench_client_load(const std::string& playlist, size_t segments, const char* type)
+{
+	BenchResult r = { "client_load", type, segments, playlist.size(), get_iterations(segments), 0, 0, 0, 0 };
+	GstBuffer* buffer = gst_buffer_new_wrapped_full ((GstMemoryFlags) GST_MEMORY_FLAG_READONLY,
+		(gpointer) playlist.data(), playlist.size(), 0, playlist.size(), NULL, NULL);
+
+	size_t allocations = allocation_count;
+	size_t bytes = allocated_bytes;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < r.iterations; i++) {
+		// A new client each time: we measure the initial load, not the merge of a refresh
+		SkippyM3U8Client* client = skippy_m3u8_client_new ();
+		skippy_m3u8_client_load_playlist (client, "http://bench/playlist.m3u8", buffer);
+		skippy_m3u8_client_free (client);
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.allocations = (allocation_count - allocations) / r.iterations;
+	r.allocatedBytes = (allocated_bytes - bytes) / r.iterations;
+	r.peakRssKb = get_peak_rss_kb();
+
+	gst_buffer_unref (buffer);
+	return r;
+}
+
+int
+main (int argc, char **argv)
+{
+	std::string output = argc > 1 ? argv[1] : "build/SkippyM3UParserBench.json";
+	size_t maxSegments = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	const size_t sizes[] = { 10, 1000, 100000, 1000000 };
+	std::vector<BenchResult> results;
+
+	gst_init (&argc, &argv);
+
+	// Peak RSS only grows: running the sizes in ascending order keeps it meaningful per size
+	for (size_t segments : sizes) {
+		if (segments > maxSegments) {
+			break;
+		}
+		for (int vod = 1; vod >= 0; vod--) {
+			const char* type = vod ? "vod" : "event";
+			std::string playlist = generate_playlist(segments, vod);
+
+			results.push_back(bench_parse(playlist, segments, type));
+			print_result(results.back());
+			results.push_back(bench_client_load(playlist, segments, type));
+			print_result(results.back());
+		}
+	}
+
+	write_results(output, results);
+	return 0;
+}
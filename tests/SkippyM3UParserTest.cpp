@@ -1,9 +1,12 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 #include <glib-object.h>
 
-#include "skippyHLS/SkippyM3UParser.hpp"
+#include "skippy_m3u8_parser.hpp"
+#include "skippy_m3u8_scan.hpp"
 
 #define LOG(...) g_message(__VA_ARGS__)
 
@@ -82,10 +85,440 @@ static void test_parse_fixture_with_14_items()
 	}
 }
 
+static void test_parser_reuse_and_line_endings()
+{
+	std::string playlist = "#EXTM3U\r\n#EXT-X-TARGETDURATION:10\r\n#EXTINF:2.5,Title, with. delimiters\r\n\r\nhttp://a/1.mp3\r\n#EXTINF:0.000000001,\r\nhttp://a/2.mp3\r\n#EXT-X-ENDLIST";
+
+	SkippyM3UParser p;
+	for (int run = 0; run < 2; run++) {
+		SkippyM3UPlaylist list = p.parse("reuse", playlist.data(), playlist.size());
+
+		ASSERT (list.isComplete);
+		ASSERT (list.items.size() == 2);
+		ASSERT (list.items[0].index == 0);
+		ASSERT (list.items[0].url == "http://a/1.mp3");
+		ASSERT (list.items[0].duration == 2500000000);
+		ASSERT (list.items[1].index == 1);
+		ASSERT (list.items[1].url == "http://a/2.mp3");
+		ASSERT (list.items[1].start == 2500000000);
+		ASSERT (list.items[1].duration == 1);
+		ASSERT (list.totalDuration == 2500000001);
+	}
+}
+
+static void test_parse_fixture_in_chunks()
+{
+	std::string uri = "tests/fixture14.m3u8";
+	std::string playlists[2];
+	playlists[0] = get_content_from_file(uri);
+	SkippyM3UParser whole;
+	SkippyM3UPlaylist expected = whole.parse(uri, playlists[0]);
+
+	// Same data with CRLF line endings
+	for (size_t i = 0; i < playlists[0].size(); i++) {
+		if (playlists[0][i] == '\n') {
+			playlists[1] += '\r';
+		}
+		playlists[1] += playlists[0][i];
+	}
+
+	for (int variant = 0; variant < 2; variant++) {
+		const std::string& playlist = playlists[variant];
+		// Includes chunk sizes that split lines and CRLF pairs
+		for (size_t chunkSize = 1; chunkSize < 64; chunkSize += 7) {
+			SkippyM3UParser p;
+			size_t emitted = 0;
+			p.begin(uri);
+			for (size_t offset = 0; offset < playlist.size(); offset += chunkSize) {
+				emitted += p.feed(playlist.data() + offset, std::min(chunkSize, playlist.size() - offset));
+				ASSERT (emitted == p.playlist().items.size());
+			}
+			SkippyM3UPlaylist list = p.finish();
+
+			ASSERT (list.isComplete);
+			ASSERT (emitted == 14);
+			ASSERT (list.items.size() == expected.items.size());
+			ASSERT (list.totalDuration == expected.totalDuration);
+			for (size_t i = 0; i < list.items.size(); i++) {
+				ASSERT (list.items[i].url == expected.items[i].url);
+				ASSERT (list.items[i].start == expected.items[i].start);
+			}
+		}
+	}
+}
+
+static void test_parse_master_playlist()
+{
+	std::string playlist =
+		"#EXTM3U\n"
+		"#EXT-X-STREAM-INF:PROGRAM-ID=1,BANDWIDTH=256000,CODECS=\"mp4a.40.2,mp3\",RESOLUTION=0x0\n"
+		"high/playlist.m3u8\n"
+		"#EXT-X-STREAM-INF:BANDWIDTH=64000,CODECS=\"opus\"\n"
+		"http://a/low/playlist.m3u8\n";
+
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("http://a/master.m3u8", playlist);
+	const SkippyM3UMasterPlaylist& master = p.masterPlaylist();
+
+	ASSERT (list.items.size() == 0);
+	ASSERT (master.uri == "http://a/master.m3u8");
+	ASSERT (master.items.size() == 2);
+	ASSERT (master.items[0].uri == "high/playlist.m3u8");
+	ASSERT (master.items[0].bandwidthKbps == 256);
+	ASSERT (master.items[0].programId == 1);
+	ASSERT (master.items[0].codec == "mp4a.40.2,mp3");
+	ASSERT (master.items[0].resolution == "0x0");
+	ASSERT (master.items[1].uri == "http://a/low/playlist.m3u8");
+	ASSERT (master.items[1].bandwidthKbps == 64);
+	ASSERT (master.items[1].codec == "opus");
+
+	// Parser state is reset for the next parse
+	p.parse("http://a/low/playlist.m3u8", "#EXTM3U\n#EXTINF:1,\nx.mp3\n#EXT-X-ENDLIST\n");
+	ASSERT (p.masterPlaylist().items.size() == 0);
+}
+
+static void test_scan_matches_scalar_search()
+{
+	// Long enough to cover whole blocks and the scalar tail at every offset
+	std::string line = "#EXT-X-PROGRAM-DATE-TIME:2015-06-01T12:00:00.000Z,title with spaces\nhttp://a/segment_without_delimiters_0123456789.mp3\n";
+
+	for (size_t from = 0; from < line.size(); from++) {
+		const char* begin = line.data() + from;
+		const char* end = line.data() + line.size();
+
+		const char* newline = begin;
+		while (newline != end && *newline != '\n') {
+			newline++;
+		}
+		ASSERT (SkippyM3UScan::findNewline(begin, end) == newline);
+
+		const char* delimiter = begin;
+		while (delimiter != end && !strchr("# -.,:", *delimiter)) {
+			delimiter++;
+		}
+		ASSERT (SkippyM3UScan::findDelimiter(begin, end) == delimiter);
+	}
+}
+
+static void test_parse_validates_utf8()
+{
+	SkippyM3UParser p;
+	std::string valid = "#EXTM3U\n#EXTINF:1,Caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x8e\xb5\nx.mp3\n#EXT-X-ENDLIST\n";
+
+	p.parse("", valid);
+	ASSERT (p.isValidUtf8());
+
+	// Sequences split across chunks at every position
+	for (size_t split = 0; split <= valid.size(); split++) {
+		p.begin("");
+		p.feed(valid.data(), split);
+		p.feed(valid.data() + split, valid.size() - split);
+		ASSERT (p.finish().items.size() == 1);
+		ASSERT (p.isValidUtf8());
+	}
+
+	const char* invalid[] = {
+		"\xc3",             // Truncated
+		"\xc0\xaf",         // Overlong
+		"\xe0\x80\xaf",     // Overlong
+		"\xed\xa0\x80",     // Surrogate
+		"\xf4\x90\x80\x80", // Above U+10FFFF
+		"\xff",
+		"\x80",
+	};
+	for (const char* bytes : invalid) {
+		std::string playlist = "#EXTM3U\n#EXTINF:1,";
+		playlist += bytes;
+		playlist += "\nx.mp3\n#EXT-X-ENDLIST\n";
+		SkippyM3UPlaylist list = p.parse("", playlist);
+		ASSERT (!p.isValidUtf8());
+		ASSERT (!list.isComplete);
+	}
+
+	// NUL bytes are rejected like g_utf8_validate does
+	std::string nul("#EXTM3U\n\0\n", 10);
+	p.parse("", nul);
+	ASSERT (!p.isValidUtf8());
+
+	// Reset by the next parse
+	p.parse("", valid);
+	ASSERT (p.isValidUtf8());
+}
+
+static void test_parse_ignored_and_unknown_tags()
+{
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("", "#EXTM3U\n"
+		"#EXT-X-VERSION:4\n"
+		"#EXT-X-INDEPENDENT-SEGMENTS\n"
+		"#EXT-X-TARGETDURATION:6\n"
+		"#EXT-X-MEDIA-SEQUENCE:7\n"
+		"#EXT-X-PLAYLIST-TYPE:VOD\n"
+		"# A comment\n"
+		"#EXT-X-FUTURE-TAG:A=B\n"
+		"#EXTINF:5.5,Title\n"
+		"#EXT-X-PROGRAM-DATE-TIME:2015-06-01T12:00:00.000Z\n"
+		"#EXT-X-DISCONTINUITY\n"
+		"a.mp3\n"
+		"#EXT-X-KEY:METHOD=NONE\n"
+		"#EXTINF:4,\n"
+		"#EXT-X-UNKNOWN\n"
+		"b.mp3\n"
+		"#EXT-X-ENDLIST\n");
+
+	ASSERT (list.isComplete);
+	ASSERT (list.sequenceNo == 7);
+	ASSERT (list.targetDuration == 6000000000);
+	ASSERT (list.type == "VOD");
+	ASSERT (list.items.size() == 2);
+	ASSERT (list.items[0].url == "a.mp3");
+	ASSERT (list.items[0].duration == 5500000000);
+	ASSERT (list.items[1].url == "b.mp3");
+	ASSERT (list.items[1].duration == 4000000000);
+	ASSERT (list.totalDuration == 9500000000);
+}
+
+static void test_parse_in_parallel()
+{
+	std::string playlist = "#EXTM3U\n#EXT-X-TARGETDURATION:10\n#EXT-X-MEDIA-SEQUENCE:42\n#EXT-X-PLAYLIST-TYPE:EVENT\n";
+	for (int i = 0; i < 1000; i++) {
+		playlist += "#EXTINF:" + std::to_string(i % 10) + ".25,\n#EXT-X-PROGRAM-DATE-TIME:2015-06-01T12:00:00Z\n";
+		playlist += "http://a/" + std::to_string(i) + ".mp3\n";
+	}
+
+	for (int complete = 0; complete < 2; complete++) {
+		SkippyM3UParser single, parallel;
+		single.setParallelParsing(0, 1);
+		parallel.setParallelParsing(0, 4);
+
+		SkippyM3UPlaylist expected = single.parse("", playlist);
+		SkippyM3UPlaylist list = parallel.parse("", playlist);
+
+		ASSERT (parallel.isValidUtf8());
+		ASSERT (list.isComplete == expected.isComplete);
+		ASSERT (list.sequenceNo == expected.sequenceNo);
+		ASSERT (list.targetDuration == expected.targetDuration);
+		ASSERT (list.totalDuration == expected.totalDuration);
+		ASSERT (list.type == expected.type);
+		ASSERT (list.items.size() == 1000);
+		for (size_t i = 0; i < list.items.size(); i++) {
+			ASSERT (list.items[i].url == expected.items[i].url);
+			ASSERT (list.items[i].index == expected.items[i].index);
+			ASSERT (list.items[i].start == expected.items[i].start);
+			ASSERT (list.items[i].end == expected.items[i].end);
+		}
+
+		playlist += "#EXT-X-ENDLIST\n";
+	}
+}
+
+static void test_parse_live_playlist()
+{
+	const std::string playlist = "#EXTM3U\n"
+		"#EXT-X-TARGETDURATION:8\n"
+		"#EXT-X-MEDIA-SEQUENCE:2680\n"
+		"#EXTINF:7.975,\n"
+		"https://radio.example.com/live/2680.aac\n"
+		"#EXTINF:7.941,\n"
+		"https://radio.example.com/live/2681.aac\n"
+		"#EXTINF:7.975,\n"
+		"https://radio.example.com/live/2682.aac";
+
+	// No end tag: the header is still read, the playlist is just not complete
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("", playlist);
+	ASSERT (!list.isComplete);
+	ASSERT (list.sequenceNo == 2680);
+	ASSERT (list.targetDuration == 8000000000);
+	ASSERT (list.items.size() == 3);
+	ASSERT (list.items[2].url == "https://radio.example.com/live/2682.aac");
+	ASSERT (list.totalDuration == 23891000000);
+
+	// Same when fed in pieces
+	p.begin("");
+	p.feed(playlist.data(), 50);
+	p.feed(playlist.data() + 50, playlist.size() - 50);
+	SkippyM3UPlaylist fed = p.finish();
+	ASSERT (!fed.isComplete);
+	ASSERT (fed.sequenceNo == 2680);
+	ASSERT (fed.items.size() == 3);
+	ASSERT (fed.totalDuration == list.totalDuration);
+}
+
+static void test_parse_low_latency_playlist()
+{
+	const std::string playlist = "#EXTM3U\n"
+		"#EXT-X-TARGETDURATION:4\n"
+		"#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=1.5\n"
+		"#EXT-X-PART-INF:PART-TARGET=0.5\n"
+		"#EXT-X-MEDIA-SEQUENCE:100\n"
+		"#EXT-X-PART:DURATION=0.5,URI=\"100.0.aac\",INDEPENDENT=YES\n"
+		"#EXT-X-PART:DURATION=0.5,URI=\"100.1.aac\"\n"
+		"#EXTINF:1.0,\n"
+		"100.aac\n"
+		"#EXT-X-PART:DURATION=0.25,URI=\"101.0.aac\",INDEPENDENT=YES\n"
+		"#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"101.1.aac\"\n";
+
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("", playlist);
+	ASSERT (!list.isComplete);
+	ASSERT (list.canBlockReload);
+	ASSERT (list.partHoldBack == 1500000000);
+	ASSERT (list.partTargetDuration == 500000000);
+	ASSERT (list.items.size() == 1);
+	ASSERT (list.items[0].url == "100.aac");
+
+	// Parts of the next segment are listed before it has an item
+	ASSERT (list.parts.size() == 3);
+	ASSERT (list.parts[0].url == "100.0.aac");
+	ASSERT (list.parts[0].index == 0 && list.parts[0].partNo == 0 && list.parts[0].independent);
+	ASSERT (list.parts[1].index == 0 && list.parts[1].partNo == 1 && !list.parts[1].independent);
+	ASSERT (list.parts[2].index == 1 && list.parts[2].partNo == 0);
+	ASSERT (list.parts[2].duration == 250000000);
+	ASSERT (list.preloadHint == "101.1.aac");
+
+	// Parts keep the index of their segment when chunks are parsed in parallel
+	std::string longPlaylist = "#EXTM3U\n#EXT-X-TARGETDURATION:4\n#EXT-X-PART-INF:PART-TARGET=0.5\n";
+	for (int i = 0; i < 200; i++) {
+		longPlaylist += "#EXT-X-PART:DURATION=0.5,URI=\"" + std::to_string(i) + ".0.aac\"\n";
+		longPlaylist += "#EXT-X-PART:DURATION=0.5,URI=\"" + std::to_string(i) + ".1.aac\"\n";
+		longPlaylist += "#EXTINF:1.0,\n" + std::to_string(i) + ".aac\n";
+	}
+	longPlaylist += "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"200.0.aac\"\n";
+	SkippyM3UParser parallel;
+	parallel.setParallelParsing(0, 4);
+	SkippyM3UPlaylist merged = parallel.parse("", longPlaylist);
+	ASSERT (merged.parts.size() == 400);
+	for (size_t i = 0; i < merged.parts.size(); i++) {
+		ASSERT (merged.parts[i].index == i / 2);
+		ASSERT (merged.parts[i].partNo == i % 2);
+		ASSERT (merged.parts[i].url == std::to_string(i / 2) + "." + std::to_string(i % 2) + ".aac");
+	}
+	ASSERT (merged.partTargetDuration == 500000000);
+	ASSERT (merged.preloadHint == "200.0.aac");
+
+	// The parser is reset in between
+	list = p.parse("", "#EXTM3U\n#EXTINF:1.0,\n1.aac\n#EXT-X-ENDLIST\n");
+	ASSERT (list.parts.empty() && list.preloadHint.empty() && !list.canBlockReload);
+}
+
+static void test_parse_delta_update()
+{
+	const std::string playlist = "#EXTM3U\n"
+		"#EXT-X-TARGETDURATION:6\n"
+		"#EXT-X-SERVER-CONTROL:CAN-SKIP-UNTIL=36.0\n"
+		"#EXT-X-MEDIA-SEQUENCE:500\n"
+		"#EXT-X-SKIP:SKIPPED-SEGMENTS=120\n"
+		"#EXTINF:6.0,\n"
+		"620.aac\n"
+		"#EXTINF:6.0,\n"
+		"621.aac\n";
+
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("", playlist);
+	ASSERT (list.canSkipUntil == 36000000000);
+	ASSERT (list.skippedSegments == 120);
+	ASSERT (list.sequenceNo == 500);
+	// Only the listed segments are items, their index counts the skipped ones
+	ASSERT (list.items.size() == 2);
+	ASSERT (list.items[0].url == "620.aac" && list.items[0].index == 120);
+	ASSERT (list.items[1].index == 121);
+	ASSERT (list.totalDuration == 12000000000);
+
+	// A repeated skip doesn't add up, one after the first item is ignored
+	std::string repeated = playlist;
+	repeated.insert(repeated.find("#EXTINF"), "#EXT-X-SKIP:SKIPPED-SEGMENTS=120\n");
+	repeated += "#EXT-X-SKIP:SKIPPED-SEGMENTS=5\n#EXTINF:6.0,\n622.aac\n";
+	list = p.parse("", repeated);
+	ASSERT (list.skippedSegments == 120);
+	ASSERT (list.items.size() == 3);
+	ASSERT (list.items[0].index == 120 && list.items[2].index == 122);
+
+	list = p.parse("", "#EXTM3U\n#EXTINF:1.0,\n1.aac\n");
+	ASSERT (list.skippedSegments == 0 && list.canSkipUntil == 0 && list.items[0].index == 0);
+}
+
+static void test_parse_byte_ranges()
+{
+	const std::string playlist = "#EXTM3U\n"
+		"#EXT-X-TARGETDURATION:10\n"
+		"#EXTINF:10.0,\n"
+		"#EXT-X-BYTERANGE:1000@500\n"
+		"track.aac\n"
+		"#EXT-X-BYTERANGE:2000\n"
+		"#EXTINF:10.0,\n"
+		"track.aac\n"
+		"#EXTINF:10.0,\n"
+		"other.aac\n"
+		"#EXT-X-BYTERANGE:300@0\n"
+		"#EXTINF:5.0,\n"
+		"track.aac\n"
+		"#EXT-X-ENDLIST\n";
+
+	SkippyM3UParser p;
+	SkippyM3UPlaylist list = p.parse("", playlist);
+	ASSERT (list.items.size() == 4);
+	ASSERT (list.items[0].rangeStart == 500 && list.items[0].rangeEnd == 1500);
+	// No offset: continues after the previous sub-range
+	ASSERT (list.items[1].rangeStart == 1500 && list.items[1].rangeEnd == 3500);
+	ASSERT (list.items[2].rangeStart == 0 && list.items[2].rangeEnd == -1);
+	ASSERT (list.items[3].rangeStart == 0 && list.items[3].rangeEnd == 300);
+
+	// Chunks parsed in parallel continue the offsets of the previous chunk
+	std::string track = "#EXTM3U\n#EXT-X-TARGETDURATION:10\n#EXT-X-BYTERANGE:100@0\n";
+	for (int i = 0; i < 1000; i++) {
+		track += "#EXTINF:10.0,\n";
+		if (i > 0) {
+			track += "#EXT-X-BYTERANGE:" + std::to_string(100 + i % 7) + "\n";
+		}
+		track += "track.aac\n";
+	}
+	SkippyM3UParser single, parallel;
+	single.setParallelParsing(0, 1);
+	parallel.setParallelParsing(0, 4);
+	SkippyM3UPlaylist expected = single.parse("", track);
+	list = parallel.parse("", track);
+	ASSERT (list.items.size() == 1000);
+	for (size_t i = 0; i < list.items.size(); i++) {
+		ASSERT (list.items[i].rangeStart == expected.items[i].rangeStart);
+		ASSERT (list.items[i].rangeEnd == expected.items[i].rangeEnd);
+		ASSERT (i == 0 || list.items[i].rangeStart == list.items[i - 1].rangeEnd);
+	}
+
+	// Same with the byte range (and other tags of the item) before its EXTINF: chunks must not separate them
+	std::string before = "#EXTM3U\n#EXT-X-TARGETDURATION:10\n";
+	for (int i = 0; i < 1000; i++) {
+		before += "#EXT-X-BYTERANGE:" + std::to_string(100 + i % 7) + (i == 0 ? "@0" : "") + "\n";
+		before += "#EXT-X-DISCONTINUITY\n#EXT-X-PROGRAM-DATE-TIME:2015-06-01T12:00:00Z\n";
+		before += "#EXTINF:10.0,\ntrack.aac\n";
+	}
+	before += "#EXT-X-ENDLIST\n";
+	expected = single.parse("", before);
+	list = parallel.parse("", before);
+	ASSERT (expected.items.size() == 1000 && list.items.size() == 1000);
+	for (size_t i = 0; i < list.items.size(); i++) {
+		ASSERT (expected.items[i].rangeEnd - expected.items[i].rangeStart == (int64_t) (100 + i % 7));
+		ASSERT (list.items[i].rangeStart == expected.items[i].rangeStart);
+		ASSERT (list.items[i].rangeEnd == expected.items[i].rangeEnd);
+		ASSERT (list.items[i].index == i);
+	}
+}
+
 int
 main (int argc, char **argv)
 {
 	test_parse_fixture_with_14_items();
+	test_parser_reuse_and_line_endings();
+	test_parse_fixture_in_chunks();
+	test_parse_master_playlist();
+	test_scan_matches_scalar_search();
+	test_parse_validates_utf8();
+	test_parse_ignored_and_unknown_tags();
+	test_parse_in_parallel();
+	test_parse_live_playlist();
+	test_parse_low_latency_playlist();
+	test_parse_delta_update();
+	test_parse_byte_ranges();
 
 	LOG ("All test assertions passed");
 